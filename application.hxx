@@ -1,15 +1,65 @@
 #pragma once
 
 #include "storage.hxx"
+#include "snapshot.hxx"
+#include "resultCache.hxx"
+#include "symbolIndex.hxx"
+#include "backgroundIndex.hxx"
+#include "callGraph.hxx"
+#include "classHierarchy.hxx"
+#include "textIndex.hxx"
 #include "libclang++/libclang++.hxx"
 #include "libclang++/translationUnitCache.hxx"
+#include "request/cancellation.hxx"
+#include "request/scheduler.hxx"
+#include <json/json.h>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_set>
 
 class Application {
 public:
-  Application (Storage & storage, unsigned int cacheLimit)
+  Application (Storage & storage, unsigned int cacheLimit,
+               Request::Cancellation & cancellation,
+               Request::Scheduler & scheduler)
     : storage_ (storage),
-      tu_ (cacheLimit)
+      tu_ (cacheLimit),
+      results_ (resultCacheLimit_, maxCachedResult_),
+      cancellation_ (cancellation),
+      scheduler_ (scheduler),
+      generation_ (0),
+      reparsesSkipped_ (0),
+      idleReparses_ (0),
+      staleIndexed_ (0),
+      hybridFromIndex_ (0),
+      hybridFromSource_ (0),
+      hotSetSaved_ (time (NULL)),
+      hotSetRestored_ (0),
+      symbols_ ([this] (int cursor, SymbolIndex & index) {
+          return scanSymbols_ (cursor, index);
+        }),
+      changedSymbolsGeneration_ (0),
+      changedSymbolsBuild_ (0),
+      calls_ ([this] (int cursor, CallGraph & graph) {
+          return scanCalls_ (cursor, graph);
+        }),
+      hierarchy_ ([this] (int cursor, ClassHierarchy & graph) {
+          return scanHierarchy_ (cursor, graph);
+        }),
+      liteResolved_ (0),
+      liteParsed_ (0),
+      text_ ([this] (int cursor, TextIndex & index) {
+          return scanText_ (cursor, index);
+        }),
+      textGeneration_ (0),
+      textBuild_ (0),
+      textReset_ (false),
+      textScanned_ (0),
+      textSkipped_ (0),
+      completionHits_ (0),
+      completionMisses_ (0)
   {
     const size_t size = 4096;
     cwd_ = new char[size];
@@ -17,33 +67,60 @@ public:
       // FIXME: correctly handle this case
      throw std::runtime_error ("Not enough space to store current directory name.");
     }
+
+    loadHotSet_();
   }
 
   ~Application () {
+    try {
+      saveHotSet_ (/*force=*/true);
+    } catch (...) {
+      // Never let a storage error escape the destructor
+    }
     delete[] cwd_;
   }
 
 
   struct CompilationDatabaseArgs {
     std::string fileName;
+    int         shard;
+    int         shards;
   };
   void compilationDatabase (CompilationDatabaseArgs & args, std::ostream & cout);
 
 
+  // In lite mode, only declarations, base classes and the include graph are
+  // indexed: references are found on demand by grep(), by parsing the
+  // translation units which may use the symbol.
   struct IndexArgs {
     std::vector<std::string> exclude;
     bool                     diagnostics;
+    bool                     lite;
   };
   void index (IndexArgs & args, std::ostream & cout);
   void update (IndexArgs & args, std::ostream & cout);
 
 
+  // Unsaved contents of an editor buffer: full contents, edits to apply to the
+  // buffer known by the server at baseVersion, or only the version of this
+  // buffer. Without any of them, the file is read from disk.
+  struct BufferArgs {
+    Json::Value content;      // full buffer contents (string)
+    std::string bufferPath;   // file to read full contents from
+    Json::Value edits;        // array of {offset, length, text} edits
+    int         version;      // buffer version (0 = unversioned)
+    int         baseVersion;  // version edits apply to
+  };
+
+
   struct FindDefinitionArgs {
     std::string fileName;
     int         offset;
     bool        diagnostics;
     bool        mostSpecific;
     bool        fromIndex;
+    bool        hybrid;
+    BufferArgs  buffer;
   };
   void findDefinition (FindDefinitionArgs & args, std::ostream & cout);
 
@@ -51,45 +128,292 @@ public:
   struct GrepArgs {
     std::string usr;
     bool find_overridens;
+    std::string kind;
+    bool        declOnly;
+    std::string path;
+    int         cursor;
+    int         limit;
+    bool        countOnly;
   };
   void grep (const GrepArgs & args, std::ostream & cout);
 
 
+  // Combine find (most specific symbol only) and grep in one request. The
+  // symbol is looked up in the translation unit if the file changed since it
+  // was indexed.
+  struct ReferencesArgs {
+    std::string fileName;
+    int         offset;
+    GrepArgs    grep;
+  };
+  void references (ReferencesArgs & args, std::ostream & cout);
+
+
+  struct FileSymbolsArgs {
+    std::string fileName;
+    int         begin;
+    int         end;
+  };
+  void fileSymbols (FileSymbolsArgs & args, std::ostream & cout);
+
+
+  // Search declared symbols by name, in an in-memory index (see SymbolIndex)
+  struct SymbolsArgs {
+    std::string query;
+    std::string kind;
+    int         limit;
+  };
+  void symbols (SymbolsArgs & args, std::ostream & cout);
+
+
+  // Walk the call graph (see CallGraph) from a function, given by its USR or
+  // by the location of a reference to it
+  struct CallGraphArgs {
+    std::string usr;
+    std::string fileName;
+    int         offset;
+    int         depth;
+    int         limit;
+  };
+  void callers (CallGraphArgs & args, std::ostream & cout);
+  void callees (CallGraphArgs & args, std::ostream & cout);
+
+
+  // Find the classes deriving from a class, or the methods overriding a
+  // method, transitively (see ClassHierarchy)
+  struct HierarchyArgs {
+    std::string usr;
+    std::string fileName;
+    int         offset;
+    bool        bases;  // find bases (or overridden methods) instead
+    int         limit;
+  };
+  void hierarchy (HierarchyArgs & args, std::ostream & cout);
+
+
+  // Search file contents, only reading the files which may match according to
+  // their trigrams. Results are output in the same format as grep.
+  struct TextSearchArgs {
+    std::string pattern;
+    bool        regex;
+    bool        ignoreCase;
+    std::string path;
+    int         limit;
+  };
+  void textSearch (TextSearchArgs & args, std::ostream & cout);
+
+
+  // Diagnostics of translation units parsed from the files on disk are stored
+  // in the index; those of unsaved buffers are only kept in memory.
+  struct DiagnosticsArgs {
+    std::string fileName;  // file name (all files if empty)
+  };
+  void diagnostics (DiagnosticsArgs & args, std::ostream & cout);
+
+
   struct CompleteArgs {
     std::string fileName;
     int         line;
     int         column;
+    std::string prefix;
+    int         limit;
+    bool        json;
+    BufferArgs  buffer;
   };
   void complete (CompleteArgs & args, std::ostream & cout);
 
 
+  struct WarmArgs {
+    std::string fileName;
+    BufferArgs  buffer;
+  };
+  void warm (WarmArgs & args, std::ostream & cout);
+
+  // Perform background work while the server is idle; false if there is
+  // nothing to do
+  bool idle ();
+
+
+  struct ExportArgs {
+    std::string fileName;
+    std::string root;
+  };
+  void exportSnapshot (ExportArgs & args, std::ostream & cout);
+
+
+  struct MergeArgs {
+    std::vector<std::string> databases;
+  };
+  void merge (MergeArgs & args, std::ostream & cout);
+
+
+  void stats (std::ostream & cout);
+
+  // Serve index queries from a read-only snapshot. Relative file names are
+  // resolved against root, which defaults to the source root of the local
+  // index (or to the root recorded in the snapshot, without local sources).
+  void loadSnapshot (const std::string & fileName, const std::string & root) {
+    snapshot_.reset (new Snapshot (fileName,
+                                   root != "" ? root : Snapshot::sourceRoot (storage_)));
+    snapshotSymbols_.reset();
+    snapshotCalls_.reset();
+    snapshotHierarchy_.reset();
+  }
+
+
 private:
   void updateIndex_ (IndexArgs & args, std::ostream & cout);
-  void findDefinitionFromIndex_  (FindDefinitionArgs & args, std::ostream & cout);
+  void indexFile_ (const std::string & fileName, IndexArgs & args, std::ostream & cout);
+  bool indexStale_ ();
+  bool lite_ ();
+  LibClang::TranslationUnit parseLite_ (const std::string & fileName);
+  std::vector<Storage::Reference> resolveReferences_ (const std::string & usr,
+                                                      ResultCache::Dependencies & dependencies);
+  int scanSymbols_ (int cursor, SymbolIndex & index);
+  bool updateChangedSymbols_ ();
+  bool indexSymbols_ ();
+  int scanText_ (int cursor, TextIndex & index);
+  bool updateText_ ();
+  bool indexText_ ();
+  int scanCalls_ (int cursor, CallGraph & graph);
+  bool indexCalls_ ();
+  int scanHierarchy_ (int cursor, ClassHierarchy & graph);
+  bool indexHierarchy_ ();
+  std::string usrAt_ (const std::string & fileName, int offset);
+  void walkCalls_ (CallGraphArgs & args, bool callers, std::ostream & cout);
+  bool findDefinitionFromIndex_  (FindDefinitionArgs & args, std::ostream & cout);
+  bool dirty_ (const std::string & fileName);
   void findDefinitionFromSource_ (FindDefinitionArgs & args, std::ostream & cout);
 
-  LibClang::TranslationUnit & translationUnit_ (std::string fileName) {
-    std::string directory;
-    std::vector<std::string> clArgs;
-    storage_.getCompileCommand (fileName, directory, clArgs);
-
-    // chdir() to the correct directory
-    // (whether we need to parse the TU for the first time or reparse it)
-    chdir (directory.c_str());
-
-    if (!tu_.contains (fileName)) {
-      LibClang::TranslationUnit tu = index_.parse (clArgs);
-      tu_.insert (fileName, tu);
-      return tu_.get (fileName);
-    } else {
-      LibClang::TranslationUnit & tu = tu_.get (fileName);
-      tu.reparse();
-      return tu;
-    }
-  }
+  LibClang::TranslationUnit & translationUnit_ (std::string fileName,
+                                               bool withBuffers = true);
+  void storeDiagnostics_ (const std::string & fileName, LibClang::TranslationUnit & tu,
+                          bool persistent);
+
+  void updateBuffer_ (const std::string & fileName, const BufferArgs & args);
+  void setBuffer_ (const std::string & fileName, const std::string & contents,
+                   int version);
+  LibClang::UnsavedFiles unsavedFiles_ () const;
+  std::string contents_ (const std::string & fileName) const;
+  bool upToDate_ (const std::string & fileName, const LibClang::TranslationUnit & tu) const;
+  bool filesUnchanged_ (const LibClang::TranslationUnit & tu, time_t since,
+                        const std::string & except = "") const;
+
+  void loadHotSet_ ();
+  bool restoreHotSet_ ();
+  void saveHotSet_ (bool force);
 
   Storage & storage_;
+  std::unique_ptr<Snapshot> snapshot_;
   LibClang::Index index_;
   LibClang::TranslationUnitCache tu_;
+
+  // Results of index queries
+  enum { resultCacheLimit_ = 64 * 1024 * 1024,
+         maxCachedResult_  = 1024 * 1024 };
+  ResultCache results_;
+  Request::Cancellation & cancellation_;
+  Request::Scheduler & scheduler_;
   char* cwd_;
+
+  // Unsaved editor buffers
+  struct Buffer_ {
+    std::string contents;
+    int         version;
+  };
+  std::map<std::string, Buffer_> buffers_;
+  unsigned int generation_;
+  std::map<std::string, unsigned int> bufferChanges_;  // changes of each buffer
+
+  // State of the sources when translation units were last (re)parsed
+  struct Parsed_ {
+    unsigned int generation;
+    time_t       time;
+  };
+  std::map<std::string, Parsed_> parsed_;
+
+  // Diagnostics of translation units parsed with unsaved buffers
+  std::map<std::string, std::vector<Storage::Diagnostic> > bufferDiagnostics_;
+  unsigned int reparsesSkipped_;
+  unsigned int idleReparses_;
+
+  // Files found out of date by hybrid find requests, to be re-indexed
+  std::deque<std::string> staleFiles_;
+
+  // Last check of each file against the index (see dirty_), with the index
+  // generation and modification times at the time of the check
+  struct StaleCheck_ {
+    unsigned long            generation;
+    time_t                   mtime;          // of the file itself
+    std::vector<std::string> includes;
+    time_t                   includesMtime;  // latest of the includes
+    time_t                   time;           // when includes were last stat'ed
+    bool                     stale;
+  };
+  std::map<std::string, StaleCheck_> staleChecks_;
+  unsigned int staleIndexed_;
+  unsigned int hybridFromIndex_;
+  unsigned int hybridFromSource_;
+
+  // Translation units used in the previous session, waiting to be re-parsed
+  // (hottest first), and last persisted hot set
+  std::deque<std::string> hotSet_;
+  std::vector<std::string> savedHotSet_;
+  time_t hotSetSaved_;
+  enum { hotSetPeriod_ = 60 };  // seconds between saves
+  unsigned int hotSetRestored_;
+
+  // Index of symbol names, and index of the declarations in the files
+  // changed since it was built, which hide the ones of the same files
+  BackgroundIndex<SymbolIndex> symbols_;
+  enum { symbolsChunk_ = 50000 };  // declarations read per idle step
+  std::unique_ptr<SymbolIndex> changedSymbols_;
+  std::unordered_set<int> changedSymbolFiles_;
+  unsigned long changedSymbolsGeneration_;  // index generation it reflects
+  unsigned int changedSymbolsBuild_;        // build of symbols_ it completes
+
+  // Index of symbol names in the snapshot, built on first use
+  std::unique_ptr<SymbolIndex> snapshotSymbols_;
+
+  // Call graph, and the one of the snapshot, built on first use
+  BackgroundIndex<CallGraph> calls_;
+  enum { callsChunk_ = 100000 };  // calls read per idle step
+  std::unique_ptr<CallGraph> snapshotCalls_;
+
+  // Class hierarchy, and the one of the snapshot, built on first use
+  BackgroundIndex<ClassHierarchy> hierarchy_;
+  enum { hierarchyChunk_ = 100000 };  // edges read per idle step
+  std::unique_ptr<ClassHierarchy> snapshotHierarchy_;
+
+  // References resolved by parsing, for lite indices
+  unsigned int liteResolved_;  // symbols resolved
+  unsigned int liteParsed_;    // translation units parsed to resolve them
+
+  // Trigram index of file contents, updated in place for changed files
+  BackgroundIndex<TextIndex> text_;
+  enum { textChunk_ = 1000 };     // files read per idle step
+  unsigned long textGeneration_;  // index generation it reflects
+  unsigned int textBuild_;        // build of text_ it was updated from
+  bool textReset_;                // all files may have changed since
+  unsigned int textScanned_;  // files read by textSearch
+  unsigned int textSkipped_;  // files ruled out by the trigram index
+
+  // Completion results for the last completion context of each file
+  struct Candidate_ {
+    std::string  typedText;
+    std::string  text;
+    std::string  kind;
+    unsigned int priority;
+  };
+  struct CompletionContext_ {
+    size_t                  start;       // offset of the completed identifier
+    size_t                  before;      // hash of the contents preceding it
+    size_t                  after;       // hash of the contents following it
+    unsigned int            generation;  // of the other unsaved buffers
+    time_t                  time;        // when candidates were computed
+    std::vector<Candidate_> candidates;
+  };
+  std::map<std::string, CompletionContext_> completions_;
+  unsigned int completionHits_;
+  unsigned int completionMisses_;
 };
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+/** @brief In-memory index built from the index database in short steps
+ *
+ * In-memory indices (SymbolIndex, CallGraph, ClassHierarchy) are built by
+ * scanning a table of the index database by chunks of rows, one chunk per
+ * idle step, then frozen by their finish() method. The current index keeps
+ * being used while the next one is built, and is replaced only once the new
+ * one is complete.
+ */
+template <typename Index>
+class BackgroundIndex {
+public:
+  /** @brief Function reading the chunk of rows following a cursor into an
+   *         index
+   *
+   * It returns the cursor of the last row read, or -1 once all rows have been
+   * read (see e.g. Storage::calls()).
+   */
+  typedef std::function<int (int cursor, Index & index)> Scan;
+
+  BackgroundIndex (Scan scan)
+    : scan_ (scan),
+      generation_ (0),
+      nextGeneration_ (0),
+      cursor_ (0),
+      builds_ (0)
+  { }
+
+  /** @brief Start building a new index from scratch
+   *
+   * A build already in progress is abandoned.
+   *
+   * @param generation  index generation at which the build starts
+   */
+  void start (unsigned long generation) {
+    next_.reset (new Index);
+    nextGeneration_ = generation;
+    cursor_ = 0;
+  }
+
+  /** @brief Perform one step of the build in progress
+   *
+   * @return @c false if no build is in progress
+   */
+  bool step () {
+    if (!next_) {
+      return false;
+    }
+
+    const int last = scan_ (cursor_, *next_);
+    if (last >= 0) {
+      cursor_ = last;
+      return true;
+    }
+
+    next_->finish();
+    current_ = std::move (next_);
+    generation_ = nextGeneration_;
+    ++builds_;
+    return true;
+  }
+
+  /** @brief Perform one step of keeping the index up to date
+   *
+   * A new build is started whenever the index generation changed since the
+   * current index was built.
+   *
+   * @return @c false if there is nothing to do
+   */
+  bool update (unsigned long generation) {
+    if (!next_ && (!current_ || generation_ != generation)) {
+      start (generation);
+    }
+    return step();
+  }
+
+  /** @brief Get the current index, waiting for the first build if needed
+   *
+   * @param generation  index generation, used if a build has to be started
+   * @param check       function called between build steps, which may throw
+   *                    to abandon the wait; the build then goes on in later
+   *                    steps
+   */
+  const Index & get (unsigned long generation, std::function<void()> check) {
+    while (!current_) {
+      check();
+      if (!next_) {
+        start (generation);
+      }
+      step();
+    }
+    return *current_;
+  }
+
+  /** @brief Current index, or NULL if none was built yet
+   */
+  const Index * current () const {
+    return current_.get();
+  }
+
+  /** @brief Current index, which may be updated in place, or NULL if none was
+   *         built yet
+   */
+  Index * current () {
+    return current_.get();
+  }
+
+  /** @brief Index generation at which the current index build started
+   */
+  unsigned long generation () const {
+    return generation_;
+  }
+
+  bool building () const {
+    return (bool)next_;
+  }
+
+  /** @brief Number of completed builds
+   */
+  unsigned int builds () const {
+    return builds_;
+  }
+
+  /** @brief Estimated memory usage of the current and next indices, in bytes
+   */
+  size_t memoryUsage () const {
+    return (current_ ? current_->memoryUsage() : 0)
+      + (next_ ? next_->memoryUsage() : 0);
+  }
+
+private:
+  Scan scan_;
+  std::unique_ptr<Index> current_;
+  std::unique_ptr<Index> next_;
+  unsigned long generation_;
+  unsigned long nextGeneration_;
+  int cursor_;
+  unsigned int builds_;
+};
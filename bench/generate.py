@@ -0,0 +1,244 @@
+#! /usr/bin/python
+
+"""
+Generate a synthetic C++ project, along with its compilation database.
+
+The project is made of headers, each one declaring a class with methods, free
+functions and a chain of recursive templates, and of translation units
+including a random subset of the headers and calling the symbols they declare.
+Its size and shape are controlled by the number of translation units, the
+number of headers included by each translation unit (header fan-in), the
+depth of template instantiations and the number of symbols per header.
+
+Besides the sources and `compile_commands.json', a `bench.json' manifest lists
+locations where benchmarks can send requests: references to symbols (for
+`find' requests) and member accesses (for `complete' requests).
+"""
+
+import os
+import sys
+import json
+import random
+import argparse
+
+
+# Only random() gives the same sequences with all Python versions: choices are
+# derived from it, so that a seed always gives the same project
+def pick (rand, n):
+    "Random integer in [0, N)."
+    return int (rand.random() * n)
+
+
+def sample (rand, n, k):
+    "K distinct random integers in [0, N)."
+    population = list (range (n))
+    for i in range (k):
+        j = i + pick (rand, n - i)
+        population[i], population[j] = population[j], population[i]
+    return population[:k]
+
+
+def headerName (h):
+    return "h%d.hxx" % h
+
+
+def writeHeader (path, h, bases, includes, options):
+    "Write header number H, deriving from BASES and including INCLUDES."
+    lines = ["#pragma once", ""]
+    for i in includes:
+        lines.append ("#include \"%s\"" % headerName (i))
+    lines += ["", "namespace bench {", ""]
+
+    # Recursive template, instantiated TEMPLATE_DEPTH times by useChain
+    lines += ["template <int N>",
+              "struct Chain%d : Chain%d<N-1> {" % (h, h),
+              "  int value%d () const { return N + Chain%d<N-1>::value%d(); }" % (h, h, h),
+              "};",
+              "",
+              "template <>",
+              "struct Chain%d<0> {" % h,
+              "  int value%d () const { return 0; }" % h,
+              "};",
+              "",
+              "inline int useChain%d () {" % h,
+              "  return Chain%d<%d>().value%d();" % (h, options.template_depth, h),
+              "}",
+              ""]
+
+    if bases:
+        derive = " : " + ", ".join (["public Class%d" % b for b in bases])
+    else:
+        derive = ""
+    lines += ["class Class%d%s {" % (h, derive),
+              "public:",
+              "  virtual ~Class%d () {}" % h]
+    for s in range (options.symbols):
+        lines.append ("  int method%d_%d (int x);" % (h, s))
+    lines.append ("  virtual int run (int x);")
+    lines += ["};", ""]
+
+    for s in range (options.symbols):
+        lines.append ("int function%d_%d (int x);" % (h, s))
+    lines += ["", "}", ""]
+
+    f = open (path, "w")
+    f.write ("\n".join (lines))
+    f.close()
+
+
+class Source:
+    "Source file being written, keeping track of offsets and line numbers."
+
+    def __init__ (self):
+        self.text = ""
+        self.line = 1
+
+    def add (self, text):
+        "Append TEXT, and return its starting offset and (line, column)."
+        offset = len (self.text)
+        column = offset - (self.text.rfind ("\n") + 1) + 1
+        pos = (offset, self.line, column)
+        self.text += text
+        self.line += text.count ("\n")
+        return pos
+
+
+def writeSource (path, tu, headers, defines, options, rand, manifest):
+    """Write translation unit number TU, including HEADERS and defining the
+    symbols declared in DEFINES."""
+    src = Source()
+    for h in headers:
+        src.add ("#include \"%s\"\n" % headerName (h))
+    src.add ("\n")
+
+    # Out-of-line definitions of the symbols declared in some headers
+    for h in defines:
+        for s in range (options.symbols):
+            src.add ("int bench::Class%d::method%d_%d (int x) { return x + %d; }\n"
+                     % (h, h, s, s))
+            src.add ("int bench::function%d_%d (int x) { return x * %d; }\n"
+                     % (h, s, s + 1))
+        src.add ("int bench::Class%d::run (int x) { return useChain%d() + x; }\n\n"
+                 % (h, h))
+
+    # Functions using the symbols declared in included headers
+    for s in range (options.symbols):
+        h = headers[pick (rand, len (headers))]
+        m = pick (rand, options.symbols)
+        src.add ("int tu%d_%d (int x) {\n" % (tu, s))
+        src.add ("  bench::Class%d obj;\n" % h)
+        src.add ("  int y = obj.")
+        (offset, line, column) = src.add ("method%d_%d" % (h, m))
+        src.add (" (x);\n")
+        manifest["find"].append ({"file": path, "offset": offset})
+        manifest["complete"].append ({"file": path, "line": line, "column": column})
+
+        src.add ("  y += bench::")
+        (offset, line, column) = src.add ("function%d_%d" % (h, m))
+        src.add (" (y);\n")
+        manifest["find"].append ({"file": path, "offset": offset})
+
+        src.add ("  return y + bench::useChain%d() + obj.run (x);\n" % h)
+        src.add ("}\n\n")
+
+    f = open (path, "w")
+    f.write (src.text)
+    f.close()
+
+
+def generate (directory, options):
+    "Generate a project in DIRECTORY according to OPTIONS, and return its manifest."
+    rand = random.Random (options.seed)
+    root = os.path.realpath (directory)
+    include = os.path.join (root, "include")
+    source = os.path.join (root, "src")
+    for d in [include, source]:
+        if not os.path.isdir (d):
+            os.makedirs (d)
+
+    # Headers form layers: each header includes (and derives from) a few
+    # headers of lower numbers
+    for h in range (options.headers):
+        includes = sample (rand, h, min (h, 2))
+        bases = includes[:1]
+        writeHeader (os.path.join (include, headerName (h)), h, bases, includes, options)
+
+    manifest = {"project": {"tus":            options.tus,
+                            "headers":        options.headers,
+                            "fanIn":          options.fan_in,
+                            "templateDepth":  options.template_depth,
+                            "symbols":        options.symbols,
+                            "seed":           options.seed},
+                "root":     root,
+                "touch":    os.path.join (include, headerName (0)),
+                "find":     [],
+                "complete": []}
+
+    database = []
+    fanIn = max (1, min (options.fan_in, options.headers))
+    for tu in range (options.tus):
+        # Each header is defined in one translation unit, which includes it
+        defines = list (range (tu, options.headers, options.tus))
+        headers = sample (rand, options.headers, fanIn)
+        headers = sorted (set (headers) | set (defines))
+
+        name = "tu%d.cxx" % tu
+        path = os.path.join (source, name)
+        writeSource (path, tu, headers, defines, options, rand, manifest)
+        database.append ({"directory": root,
+                          "command":   "clang++ -std=c++11 -Iinclude -c src/%s -o src/tu%d.o"
+                                       % (name, tu),
+                          "file":      "src/%s" % name})
+
+    f = open (os.path.join (root, "compile_commands.json"), "w")
+    json.dump (database, f, indent=4, separators=(",", ": "))
+    f.close()
+
+    f = open (os.path.join (root, "bench.json"), "w")
+    json.dump (manifest, f, indent=4, separators=(",", ": "))
+    f.close()
+    return manifest
+
+
+def addOptions (parser):
+    "Add project generation options to PARSER."
+    parser.add_argument (
+        "--tus", type = int, default = 200,
+        help = "number of translation units (default: %(default)s)")
+    parser.add_argument (
+        "--headers", type = int, default = 100,
+        help = "number of headers (default: %(default)s)")
+    parser.add_argument (
+        "--fan-in", type = int, default = 20,
+        help = "number of headers included by each translation unit"
+        " (default: %(default)s)")
+    parser.add_argument (
+        "--template-depth", type = int, default = 16,
+        help = "depth of recursive template instantiations"
+        " (default: %(default)s)")
+    parser.add_argument (
+        "--symbols", type = int, default = 20,
+        help = "number of methods and functions per header, and of functions"
+        " per translation unit (default: %(default)s)")
+    parser.add_argument (
+        "--seed", type = int, default = 0,
+        help = "random seed (default: %(default)s)")
+
+
+def main ():
+    parser = argparse.ArgumentParser (
+        description = "Generate a synthetic C++ project and its compilation database.")
+    parser.add_argument (
+        "output",
+        help = "directory where the project is generated")
+    addOptions (parser)
+    options = parser.parse_args()
+
+    manifest = generate (options.output, options)
+    sys.stdout.write ("Generated %d translation units and %d headers in %s\n"
+                      % (options.tus, options.headers, manifest["root"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit (main())
@@ -0,0 +1,53 @@
+"""
+Summaries of request latencies.
+"""
+
+import math
+
+
+def percentiles (latencies):
+    "Summarize a list of latencies (in seconds) in milliseconds."
+    if not latencies:
+        return {"count": 0}
+    latencies = sorted (latencies)
+    def rank (p):
+        # Nearest-rank percentile
+        return 1000 * latencies[max (0, int (math.ceil (p * len (latencies))) - 1)]
+    return {"count": len (latencies),
+            "mean":  1000 * sum (latencies) / len (latencies),
+            "p50":   rank (0.50),
+            "p90":   rank (0.90),
+            "p99":   rank (0.99),
+            "max":   1000 * latencies[-1]}
+
+
+# Upper bounds of histogram buckets, in milliseconds
+buckets = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000]
+
+
+def histogram (latencies):
+    """Count latencies (in seconds) in each bucket. The last count is for
+    latencies above all buckets."""
+    counts = [0] * (len (buckets) + 1)
+    for latency in latencies:
+        i = 0
+        while i < len (buckets) and 1000 * latency > buckets[i]:
+            i += 1
+        counts[i] += 1
+    return counts
+
+
+def formatHistogram (counts, width = 50):
+    "Format a histogram as text, one line per non-empty bucket."
+    lines = []
+    total = max (1, max (counts))
+    for i in range (len (counts)):
+        if counts[i] == 0:
+            continue
+        if i < len (buckets):
+            label = "<= %d ms" % buckets[i]
+        else:
+            label = " > %d ms" % buckets[-1]
+        bar = "#" * max (1, int (round (float (width) * counts[i] / total)))
+        lines.append ("  %-12s %7d %s" % (label, counts[i], bar))
+    return "\n".join (lines)
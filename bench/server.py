@@ -0,0 +1,131 @@
+"""
+Run a clang-tags server and send it requests, for benchmarking purposes.
+
+Requests are sent over a persistent connection using the framed protocol (see
+request/frame.hxx), so that latencies do not include the cost of starting a
+client process for each request.
+"""
+
+import os
+import sys
+import json
+import time
+import socket
+import struct
+import subprocess
+
+
+class Connection:
+    "Persistent connection to a clang-tags server."
+
+    def __init__ (self, socketPath):
+        self.socket = socket.socket (socket.AF_UNIX, socket.SOCK_STREAM)
+        self.socket.connect (socketPath)
+        self.nextId = 0
+
+    def close (self):
+        self.socket.close()
+
+    def sendFrame (self, payload):
+        data = payload.encode ("utf-8")
+        self.socket.sendall (struct.pack (">I", len (data)) + data)
+
+    def readFrame (self):
+        prefix = self.readBytes (4)
+        if prefix is None:
+            return None
+        (size,) = struct.unpack (">I", prefix)
+        return json.loads (self.readBytes (size).decode ("utf-8"))
+
+    def readBytes (self, size):
+        data = b""
+        while len (data) < size:
+            chunk = self.socket.recv (size - len (data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    def send (self, request):
+        "Send REQUEST without waiting for the response, and return its id."
+        self.nextId += 1
+        request = dict (request)
+        request["id"] = self.nextId
+        self.sendFrame (json.dumps (request))
+        return self.nextId
+
+    def receive (self):
+        """Wait for the end of a response, and return its id, output and end
+        frame. Output of other responses received meanwhile is discarded."""
+        output = {}
+        while True:
+            frame = self.readFrame()
+            if frame is None:
+                raise RuntimeError ("connection closed by server")
+            requestId = frame.get ("id")
+            if "data" in frame:
+                output[requestId] = output.get (requestId, "") + frame["data"]
+            if frame.get ("end"):
+                return (requestId, output.get (requestId, ""), frame)
+
+    def request (self, request):
+        """Send REQUEST and wait for its response.
+
+        Return the response output, and the elapsed time in seconds."""
+        start = time.time()
+        requestId = self.send (request)
+        while True:
+            (endId, output, frame) = self.receive()
+            if endId == requestId:
+                break
+        elapsed = time.time() - start
+        if "error" in frame:
+            raise RuntimeError ("%s: %s" % (request["command"], frame["error"]))
+        return (output, elapsed)
+
+
+class Server:
+    "clang-tags server process running in a given directory."
+
+    def __init__ (self, executable, directory, options = []):
+        self.directory  = directory
+        self.socketPath = os.path.join (directory, ".ct.sock")
+        for name in [".ct.sock", ".ct.pid"]:
+            path = os.path.join (directory, name)
+            if os.path.exists (path):
+                os.remove (path)
+
+        self.log = open (os.path.join (directory, ".ct.log"), "w")
+        self.process = subprocess.Popen ([executable] + options,
+                                         cwd    = directory,
+                                         stdout = self.log,
+                                         stderr = subprocess.STDOUT)
+        while not os.path.exists (self.socketPath):
+            if self.process.poll() is not None:
+                raise RuntimeError ("server exited with status %d"
+                                    % self.process.returncode)
+            time.sleep (0.01)
+
+    def connect (self):
+        return Connection (self.socketPath)
+
+    def peakRss (self):
+        "Peak resident set size of the server so far, in bytes."
+        f = open ("/proc/%d/status" % self.process.pid)
+        for line in f:
+            if line.startswith ("VmHWM:"):
+                f.close()
+                return int (line.split()[1]) * 1024
+        f.close()
+        return None
+
+    def stop (self):
+        try:
+            connection = self.connect()
+            connection.request ({"command": "exit"})
+            connection.close()
+        except (RuntimeError, socket.error):
+            # The server exits while answering
+            pass
+        self.process.wait()
+        self.log.close()
@@ -0,0 +1,311 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <ctime>
+
+LibClang::TranslationUnit & Application::translationUnit_ (std::string fileName,
+                                                          bool withBuffers) {
+  std::string directory;
+  std::vector<std::string> clArgs;
+  storage_.getCompileCommand (fileName, directory, clArgs);
+
+  // chdir() to the correct directory
+  // (whether we need to parse the TU for the first time or reparse it)
+  chdir (directory.c_str());
+
+  // Unsaved buffers make no difference if there are none
+  const bool fromDisk = !withBuffers || buffers_.empty();
+  withBuffers = withBuffers || buffers_.empty();
+
+  if (withBuffers && tu_.contains (fileName)) {
+    LibClang::TranslationUnit & tu = tu_.get (fileName);
+    if (upToDate_ (fileName, tu)) {
+      ++reparsesSkipped_;
+      return tu;
+    }
+  }
+
+  // Parsing can not be interrupted: give up now if the request is obsolete
+  cancellation_.check (/*force=*/true);
+
+  // Translation units used in the editor are parsed with a precompiled
+  // preamble and cached completion results. Cached translation units may be
+  // indexed later: macro definitions and expansions are always recorded.
+  unsigned int options = CXTranslationUnit_DetailedPreprocessingRecord;
+  LibClang::UnsavedFiles unsaved;
+  if (withBuffers) {
+    options |= clang_defaultEditingTranslationUnitOptions();
+    Parsed_ & parsed = parsed_[fileName];
+    parsed.generation = generation_;
+    parsed.time       = time (NULL);
+    unsaved = unsavedFiles_();
+  } else {
+    // The translation unit will not match the unsaved buffers
+    parsed_.erase (fileName);
+  }
+
+  if (!tu_.contains (fileName)) {
+    LibClang::TranslationUnit tu = index_.parse (clArgs, unsaved, options);
+    tu_.insert (fileName, tu);
+    storeDiagnostics_ (fileName, tu, fromDisk);
+    return tu_.get (fileName);
+  } else {
+    LibClang::TranslationUnit & tu = tu_.get (fileName);
+    tu.reparse (unsaved);
+    storeDiagnostics_ (fileName, tu, fromDisk);
+    return tu;
+  }
+}
+
+bool Application::idle () {
+  // Refresh translation units recently used in the editor, so that the next
+  // interactive request finds an up-to-date AST
+  const auto & focused = scheduler_.focused();
+  for (auto it = focused.begin() ; it != focused.end() ; ++it) {
+    const std::string fileName = *it;
+    if (!tu_.contains (fileName)) {
+      continue;
+    }
+
+    try {
+      // Relative include paths are relative to the compilation directory
+      std::string directory;
+      std::vector<std::string> clArgs;
+      storage_.getCompileCommand (fileName, directory, clArgs);
+      chdir (directory.c_str());
+      if (upToDate_ (fileName, tu_.get (fileName))) {
+        continue;
+      }
+
+      const unsigned int skipped = reparsesSkipped_;
+      translationUnit_ (fileName);
+      if (reparsesSkipped_ == skipped) {
+        ++idleReparses_;
+        return true;
+      }
+    } catch (std::exception & e) {
+      std::cerr << "Could not reparse `" << fileName << "': " << e.what() << std::endl;
+
+      // Do not try again until the file or the index changes
+      Parsed_ & parsed = parsed_[fileName];
+      parsed.generation = generation_;
+      parsed.time       = time (NULL);
+    }
+  }
+
+  if (indexStale_()) {
+    return true;
+  }
+
+  if (indexSymbols_()) {
+    return true;
+  }
+
+  if (indexText_()) {
+    return true;
+  }
+
+  if (indexCalls_()) {
+    return true;
+  }
+
+  if (indexHierarchy_()) {
+    return true;
+  }
+
+  if (restoreHotSet_()) {
+    return true;
+  }
+
+  saveHotSet_ (/*force=*/false);
+  return false;
+}
+
+void Application::loadHotSet_ () {
+  try {
+    savedHotSet_ = storage_.getOption ("hotSet", Storage::Vector());
+  } catch (std::runtime_error & e) {
+    // No hot set was saved by a previous session
+    return;
+  }
+  hotSet_.assign (savedHotSet_.begin(), savedHotSet_.end());
+}
+
+bool Application::restoreHotSet_ () {
+  while (!hotSet_.empty()) {
+    const std::string fileName = hotSet_.front();
+    hotSet_.pop_front();
+    if (tu_.contains (fileName)) {
+      continue;
+    }
+
+    // Stop before the cache would have to evict translation units: those
+    // already parsed are hotter than the remaining ones
+    const unsigned long average = tu_.size() > 0 ? tu_.memoryUsage() / tu_.size() : 0;
+    if (tu_.memoryUsage() + average > tu_.memoryLimit()) {
+      hotSet_.clear();
+      return false;
+    }
+
+    try {
+      translationUnit_ (fileName);
+    } catch (std::runtime_error & e) {
+      // The file is not part of the project anymore
+      continue;
+    }
+    ++hotSetRestored_;
+    return true;
+  }
+  return false;
+}
+
+void Application::saveHotSet_ (bool force) {
+  // Do not overwrite the previous hot set until it has been restored
+  if (!hotSet_.empty()) {
+    return;
+  }
+
+  const time_t now = time (NULL);
+  if (!force && now - hotSetSaved_ < hotSetPeriod_) {
+    return;
+  }
+  hotSetSaved_ = now;
+
+  const std::vector<std::string> hotSet = tu_.hotSet();
+  if (hotSet.empty() || hotSet == savedHotSet_) {
+    return;
+  }
+  storage_.setOption ("hotSet", hotSet);
+  savedHotSet_ = hotSet;
+}
+
+void Application::warm (WarmArgs & args, std::ostream & cout) {
+  scheduler_.focus (args.fileName);
+
+  try {
+    updateBuffer_ (args.fileName, args.buffer);
+  } catch (std::runtime_error & e) {
+    cout << "Error: " << e.what() << std::endl;
+    return;
+  }
+
+  Timer timer;
+  translationUnit_ (args.fileName);
+  cout << args.fileName << ":\t" << timer.get() << "s." << std::endl;
+}
+
+bool Application::upToDate_ (const std::string & fileName,
+                             const LibClang::TranslationUnit & tu) const {
+  auto it = parsed_.find (fileName);
+  if (it == parsed_.end() || it->second.generation != generation_) {
+    return false;
+  }
+
+  // Check that no file was modified on disk since the last parse
+  return filesUnchanged_ (tu, it->second.time);
+}
+
+bool Application::filesUnchanged_ (const LibClang::TranslationUnit & tu, time_t since,
+                                   const std::string & except) const {
+  const auto files = tu.files();
+  for (auto file = files.begin() ; file != files.end() ; ++file) {
+    if (*file == except) {
+      continue;
+    }
+    struct stat fileStat;
+    if (stat (file->c_str(), &fileStat) != 0
+        || fileStat.st_mtime >= since) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Application::updateBuffer_ (const std::string & fileName, const BufferArgs & args) {
+  auto it = buffers_.find (fileName);
+
+  if (!args.content.isNull()) {
+    setBuffer_ (fileName, args.content.asString(), args.version);
+  }
+  else if (args.bufferPath != "") {
+    // The buffer path may for example be a shared memory file, or a memfd
+    // exposed as /proc/PID/fd/FD
+    std::ifstream buffer (args.bufferPath);
+    if (!buffer) {
+      throw std::runtime_error ("cannot read buffer `" + args.bufferPath + "'");
+    }
+    std::ostringstream contents;
+    contents << buffer.rdbuf();
+    setBuffer_ (fileName, contents.str(), args.version);
+  }
+  else if (!args.edits.isNull()) {
+    if (it == buffers_.end() || it->second.version != args.baseVersion) {
+      throw std::runtime_error ("buffer out of date for `" + fileName
+                                + "': full contents needed");
+    }
+
+    // Each edit applies to the result of the previous ones
+    std::string contents = it->second.contents;
+    for (unsigned int i = 0 ; i < args.edits.size() ; ++i) {
+      const Json::Value & edit = args.edits[i];
+      const unsigned int offset = edit["offset"].asUInt();
+      const unsigned int length = edit["length"].asUInt();
+      if (offset > contents.size() || length > contents.size() - offset) {
+        throw std::runtime_error ("invalid edit for `" + fileName + "'");
+      }
+      contents.replace (offset, length, edit["text"].asString());
+    }
+    setBuffer_ (fileName, contents, args.version);
+  }
+  else if (args.version != 0) {
+    if (it == buffers_.end() || it->second.version != args.version) {
+      throw std::runtime_error ("unknown buffer version for `" + fileName
+                                + "': full contents needed");
+    }
+  }
+  else if (it != buffers_.end()) {
+    // The file has been saved
+    buffers_.erase (it);
+    ++generation_;
+    ++bufferChanges_[fileName];
+  }
+}
+
+void Application::setBuffer_ (const std::string & fileName, const std::string & contents,
+                              int version) {
+  auto it = buffers_.find (fileName);
+  if (it == buffers_.end() || it->second.contents != contents) {
+    // Sources changed: translation units will have to be reparsed
+    ++generation_;
+    ++bufferChanges_[fileName];
+  }
+
+  Buffer_ & buffer = buffers_[fileName];
+  buffer.contents = contents;
+  buffer.version  = version;
+}
+
+std::string Application::contents_ (const std::string & fileName) const {
+  auto it = buffers_.find (fileName);
+  if (it != buffers_.end()) {
+    return it->second.contents;
+  }
+
+  std::ifstream file (fileName);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+LibClang::UnsavedFiles Application::unsavedFiles_ () const {
+  LibClang::UnsavedFiles unsaved;
+  for (auto it = buffers_.begin() ; it != buffers_.end() ; ++it) {
+    unsaved.addBuffer (it->first, it->second.contents);
+  }
+  return unsaved;
+}
@@ -0,0 +1,122 @@
+#include "callGraph.hxx"
+
+#include <algorithm>
+
+CallGraph::CallGraph ()
+{ }
+
+uint32_t CallGraph::intern_ (const std::string & usr) {
+  auto it = ids_.find (usr);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  const uint32_t id = usrs_.size();
+  usrs_.push_back (usr);
+  ids_[usr] = id;
+  return id;
+}
+
+void CallGraph::add (const std::string & caller, const std::string & callee) {
+  const uint32_t from = intern_ (caller);
+  const uint32_t to   = intern_ (callee);
+  edges_.push_back (std::make_pair (from, to));
+}
+
+void CallGraph::finish () {
+  std::sort (edges_.begin(), edges_.end());
+  edges_.erase (std::unique (edges_.begin(), edges_.end()), edges_.end());
+
+  // Edges are sorted by caller: callees are taken in order
+  const size_t n = usrs_.size();
+  calleeOffsets_.assign (n + 1, 0);
+  callerOffsets_.assign (n + 1, 0);
+  for (auto it = edges_.begin() ; it != edges_.end() ; ++it) {
+    ++calleeOffsets_[it->first + 1];
+    ++callerOffsets_[it->second + 1];
+  }
+  for (size_t i = 0 ; i < n ; ++i) {
+    calleeOffsets_[i+1] += calleeOffsets_[i];
+    callerOffsets_[i+1] += callerOffsets_[i];
+  }
+
+  callees_.resize (edges_.size());
+  callers_.resize (edges_.size());
+  std::vector<uint32_t> next (callerOffsets_.begin(), callerOffsets_.end() - 1);
+  for (size_t i = 0 ; i < edges_.size() ; ++i) {
+    callees_[i] = edges_[i].second;
+    callers_[next[edges_[i].second]++] = edges_[i].first;
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t> >().swap (edges_);
+}
+
+std::vector<CallGraph::Node> CallGraph::callers (const std::string & usr, int depth,
+                                                 size_t limit,
+                                                 std::function<void()> check) const {
+  return walk_ (usr, depth, limit, callerOffsets_, callers_, check);
+}
+
+std::vector<CallGraph::Node> CallGraph::callees (const std::string & usr, int depth,
+                                                 size_t limit,
+                                                 std::function<void()> check) const {
+  return walk_ (usr, depth, limit, calleeOffsets_, callees_, check);
+}
+
+std::vector<CallGraph::Node> CallGraph::walk_ (const std::string & usr, int depth,
+                                               size_t limit,
+                                               const std::vector<uint32_t> & offsets,
+                                               const std::vector<uint32_t> & targets,
+                                               std::function<void()> check) const {
+  std::vector<Node> res;
+  res.push_back (Node {usr, "", 0});
+
+  auto it = ids_.find (usr);
+  if (it == ids_.end()) {
+    return res;
+  }
+
+  // Breadth-first walk; the queue holds (id, index in res)
+  std::vector<bool> visited (usrs_.size(), false);
+  std::vector<std::pair<uint32_t, size_t> > queue;
+  visited[it->second] = true;
+  queue.push_back (std::make_pair (it->second, 0));
+
+  for (size_t head = 0 ; head < queue.size() ; ++head) {
+    const uint32_t id   = queue[head].first;
+    const Node &   node = res[queue[head].second];
+    if (node.depth >= depth) {
+      break;
+    }
+    if (check && head % 1024 == 0) {
+      check();
+    }
+
+    const int nextDepth = node.depth + 1;
+    const std::string from = node.usr;
+    for (uint32_t i = offsets[id] ; i < offsets[id+1] ; ++i) {
+      const uint32_t target = targets[i];
+      if (visited[target]) {
+        continue;
+      }
+      if (limit > 0 && res.size() > limit) {
+        return res;
+      }
+      visited[target] = true;
+      queue.push_back (std::make_pair (target, res.size()));
+      res.push_back (Node {usrs_[target], from, nextDepth});
+    }
+  }
+  return res;
+}
+
+size_t CallGraph::memoryUsage () const {
+  // Hash table nodes are counted as a key, a value and two pointers
+  size_t memory = sizeof (uint32_t) * (calleeOffsets_.capacity() + callees_.capacity()
+                                       + callerOffsets_.capacity() + callers_.capacity())
+    + sizeof (std::pair<uint32_t, uint32_t>) * edges_.capacity();
+  for (auto it = usrs_.begin() ; it != usrs_.end() ; ++it) {
+    memory += 2 * (sizeof (std::string) + it->capacity())  // + key in ids_
+      + sizeof (uint32_t) + 2 * sizeof (void*);
+  }
+  return memory;
+}
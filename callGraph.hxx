@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** @brief In-memory call graph between functions
+ *
+ * Call edges are added one by one (typically by chunks of calls read from the
+ * index database, see Storage::calls()), then the graph is frozen by finish()
+ * before being queried. Functions are identified by their USR, interned as
+ * dense ids. Edges are stored twice, in compressed sparse row form: for each
+ * function, the ids of its callees (resp. callers) are stored contiguously in
+ * a single array, indexed by a table of offsets, so that the neighbours of a
+ * function are found in constant time.
+ */
+class CallGraph {
+public:
+  /** @brief Function reached by a walk of the graph */
+  struct Node {
+    std::string usr;
+    std::string from;   /**< @brief USR of the function it was reached from ("" for the root) */
+    int         depth;  /**< @brief number of edges from the root */
+  };
+
+  CallGraph ();
+
+  /** @brief Add a call edge
+   *
+   * Duplicate edges (several calls between the same functions) are merged by
+   * finish().
+   *
+   * @param caller  USR of the calling function
+   * @param callee  USR of the called function
+   */
+  void add (const std::string & caller, const std::string & callee);
+
+  /** @brief Build adjacency tables
+   *
+   * This must be called once, after all edges have been added.
+   */
+  void finish ();
+
+  /** @brief Functions calling a function, transitively
+   *
+   * Functions are visited breadth-first, so that each one is output once, at
+   * its shortest distance from the root, after the function it was reached
+   * from.
+   *
+   * @param usr    USR of the root function
+   * @param depth  maximum distance from the root
+   * @param limit  maximum number of functions, besides the root (0 = unlimited)
+   * @param check  function called periodically, which may throw to abandon
+   *               the walk
+   *
+   * @return the root, followed by the functions reached from it
+   */
+  std::vector<Node> callers (const std::string & usr, int depth, size_t limit,
+                             std::function<void()> check = std::function<void()>()) const;
+
+  /** @brief Functions called by a function, transitively
+   *
+   * Same as callers(), following edges the other way.
+   */
+  std::vector<Node> callees (const std::string & usr, int depth, size_t limit,
+                             std::function<void()> check = std::function<void()>()) const;
+
+  /** @brief Number of functions in the graph
+   */
+  size_t size () const {
+    return usrs_.size();
+  }
+
+  /** @brief Number of distinct edges in the graph
+   */
+  size_t edges () const {
+    return callees_.size();
+  }
+
+  /** @brief Estimated memory usage, in bytes
+   */
+  size_t memoryUsage () const;
+
+private:
+  uint32_t intern_ (const std::string & usr);
+
+  std::vector<Node> walk_ (const std::string & usr, int depth, size_t limit,
+                           const std::vector<uint32_t> & offsets,
+                           const std::vector<uint32_t> & targets,
+                           std::function<void()> check) const;
+
+  std::vector<std::string> usrs_;                   // by id
+  std::unordered_map<std::string, uint32_t> ids_;   // by USR
+  std::vector<uint32_t> calleeOffsets_;             // start of the callees of each id
+  std::vector<uint32_t> callees_;
+  std::vector<uint32_t> callerOffsets_;             // start of the callers of each id
+  std::vector<uint32_t> callers_;
+
+  // Edges (caller, callee), only needed until finish()
+  std::vector<std::pair<uint32_t, uint32_t> > edges_;
+};
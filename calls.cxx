@@ -0,0 +1,75 @@
+#include "application.hxx"
+
+int Application::scanCalls_ (int cursor, CallGraph & graph) {
+  return storage_.calls (
+    cursor, callsChunk_,
+    [&graph] (const std::string & caller, const std::string & callee) {
+      graph.add (caller, callee);
+    });
+}
+
+bool Application::indexCalls_ () {
+  return calls_.update (storage_.generation());
+}
+
+void Application::callers (CallGraphArgs & args, std::ostream & cout) {
+  walkCalls_ (args, /*callers=*/true, cout);
+}
+
+void Application::callees (CallGraphArgs & args, std::ostream & cout) {
+  walkCalls_ (args, /*callers=*/false, cout);
+}
+
+void Application::walkCalls_ (CallGraphArgs & args, bool callers, std::ostream & cout) {
+  const std::string usr = args.usr != ""
+    ? args.usr
+    : usrAt_ (args.fileName, args.offset);
+  if (usr == "") {
+    return;
+  }
+
+  const CallGraph * graph;
+  if (snapshot_) {
+    // Snapshots never change: their call graph is built once
+    if (!snapshotCalls_) {
+      std::unique_ptr<CallGraph> snapshotCalls (new CallGraph);
+      snapshot_->calls ([&snapshotCalls] (const std::string & caller,
+                                          const std::string & callee) {
+                          snapshotCalls->add (caller, callee);
+                        });
+      snapshotCalls->finish();
+      snapshotCalls_ = std::move (snapshotCalls);
+    }
+    graph = snapshotCalls_.get();
+  } else {
+    // The first request has to wait for the whole graph to be built
+    graph = &calls_.get (storage_.generation(),
+                         [this] () { cancellation_.check (/*force=*/true); });
+  }
+
+  auto check = [this] () { cancellation_.check(); };
+  const auto nodes = callers
+    ? graph->callers (usr, args.depth, args.limit, check)
+    : graph->callees (usr, args.depth, args.limit, check);
+
+  Json::FastWriter writer;
+  for (auto it = nodes.begin() ; it != nodes.end() ; ++it) {
+    cancellation_.check();
+
+    // Functions without any indexed declaration (e.g. in excluded paths) are
+    // output without a location
+    Storage::Definition def;
+    Json::Value json;
+    const bool found = snapshot_
+      ? snapshot_->definition (it->usr, def)
+      : storage_.definition (it->usr, def);
+    if (found) {
+      json = def.json();
+    } else {
+      json["usr"] = it->usr;
+    }
+    json["from"]  = it->from;
+    json["depth"] = it->depth;
+    cout << writer.write (json);
+  }
+}
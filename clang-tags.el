@@ -1,19 +1,128 @@
 (require 'compile)
+(require 'json)
 
 (defconst ct/source-location-re
   "\\(.+\\):\\([[:digit:]]+\\)-\\([[:digit:]]+\\):\\([[:digit:]]+\\)-\\([[:digit:]]+\\)")
 
-(defvar ct/options ""
-  "Command-line options for `clang-tags'")
+(defvar ct/most-specific nil
+  "If non-nil, `ct/find-def' only returns the most specific definition")
 
-;; (setq ct/options "")
-;; (setq ct/options "--debug --most-specific")
+(defvar ct/client "clang-tags-client"
+  "Program used to send requests to the clang-tags server")
 
 (defvar ct/default-directory "."
   "Directory in which `clang-tags' shoud be run")
 
 
-
+
+;;; Requests to the server
+
+;; Requests are sent by `ct/client' rather than the `clang-tags' script, which
+;; is much slower to start. The JSON results are formatted here instead.
+
+(defun ct/start-request (name buffer request)
+  "Send REQUEST to the clang-tags server.
+
+REQUEST is an alist, sent in JSON format. The server response is
+written to BUFFER (which may be nil) by a process called NAME,
+which is returned."
+  (let* ((default-directory ct/default-directory)
+         (proc (start-process name buffer ct/client)))
+    (process-send-string proc (concat (json-encode request) "\n\n"))
+    (process-send-eof proc)
+    proc))
+
+(defun ct/request (request buffer-name mode format)
+  "Send REQUEST to the clang-tags server, and display the results.
+
+Results are displayed in BUFFER-NAME, which is put in MODE. Each
+line of the response holding a JSON object is formatted by
+calling FORMAT, which returns the text to insert; consecutive
+identical results (e.g. references on the same line) are only
+inserted once. Other lines are inserted unchanged."
+  (let ((buffer (get-buffer-create buffer-name))
+        (directory (expand-file-name ct/default-directory)))
+    (let ((proc (get-buffer-process buffer)))
+      (when proc
+        (delete-process proc)))
+    (switch-to-buffer buffer)
+    (let ((inhibit-read-only t))
+      (erase-buffer))
+    (funcall mode)
+    (setq default-directory (file-name-as-directory directory))
+    (setq next-error-last-buffer buffer)
+    (let ((proc (let ((ct/default-directory directory))
+                  (ct/start-request "clang-tags" buffer request))))
+      (process-put proc 'ct/format format)
+      (process-put proc 'ct/partial "")
+      (set-process-filter proc 'ct/request-filter)
+      (set-process-sentinel proc 'ct/request-sentinel)
+      proc)))
+
+(defun ct/request-filter (proc string)
+  "Insert the complete lines of the server response, formatted."
+  (let ((lines (split-string (concat (process-get proc 'ct/partial) string) "\n")))
+    ;; The last line is not complete yet
+    (process-put proc 'ct/partial (car (last lines)))
+    (when (buffer-live-p (process-buffer proc))
+      (with-current-buffer (process-buffer proc)
+        (let ((inhibit-read-only t))
+          (save-excursion
+            (goto-char (point-max))
+            (dolist (line (butlast lines))
+              (let ((text (ct/format-line line (process-get proc 'ct/format))))
+                (unless (equal text (process-get proc 'ct/last))
+                  (process-put proc 'ct/last text)
+                  (insert text))))))))))
+
+(defun ct/format-line (line format)
+  "Format LINE with FORMAT if it holds a JSON object."
+  (let ((json (and (string-match "^{" line)
+                   (condition-case nil
+                       (let ((json-object-type 'alist)
+                             (json-key-type 'symbol))
+                         (json-read-from-string line))
+                     (error nil)))))
+    (or (and json
+             (condition-case nil
+                 (funcall format json)
+               (error nil)))
+        (concat line "\n"))))
+
+(defun ct/request-sentinel (proc event)
+  "Report the end of a request."
+  (when (memq (process-status proc) '(exit signal))
+    (message "clang-tags: %s" (replace-regexp-in-string "\n" "" event))))
+
+(defun ct/get (key json)
+  "Get the value of KEY in the JSON object."
+  (cdr (assq key json)))
+
+(defun ct/relative-file (json)
+  "Get the file name of a JSON result, relative to `default-directory'."
+  (let ((file (ct/get 'file json)))
+    (if (equal file "")
+        "<unknown>"
+      (file-relative-name file))))
+
+(defun ct/format-reference (ref)
+  "Format a reference found by `grep' or `references' requests."
+  (cond ((assq 'count ref)
+         (format "%d\n" (ct/get 'count ref)))
+        ((assq 'next ref)
+         (format "-- more results: use --cursor %d\n" (ct/get 'next ref)))
+        (t
+         (format "%s:%d:%s\n" (ct/relative-file ref)
+                 (ct/get 'line1 ref) (ct/get 'lineContents ref)))))
+
+(defun ct/format-declaration (decl)
+  "Format a declaration found by `symbols' requests."
+  (format "%s:%d:%d: %s %s\n" (ct/relative-file decl)
+          (ct/get 'line1 decl) (ct/get 'col1 decl)
+          (ct/get 'kind decl) (ct/get 'spelling decl)))
+
+
+
 ;;; Specific compilation mode for `clang-tags find-def'
 
 (defvar ct/find-def-scroll-output 'first-error)
@@ -55,27 +164,43 @@ inherited from `compilation-mode':
 
 ;;; Front-end for `clang-tags find-def'
 
+(defun ct/format-definition (refdef)
+  "Format a definition found by `find' requests."
+  (let ((ref (ct/get 'ref refdef))
+        (def (ct/get 'def refdef)))
+    (concat
+     (format "-- %s -- %s %s\n"
+             (ct/get 'substring ref) (ct/get 'kind ref) (ct/get 'spelling ref))
+     (format "   %s:%d-%d:%d-%d: %s\n" (ct/relative-file def)
+             (ct/get 'line1 def) (ct/get 'line2 def)
+             (ct/get 'col1 def) (1- (ct/get 'col2 def)) (ct/get 'spelling def))
+     (format "   USR: %s\n" (ct/get 'usr def))
+     (format "   isVirtual: %s\n\n"
+             (if (eq (ct/get 'isVirtual def) t) "True" "False")))))
+
 (defun ct/find-def (argp)
   "Find the definition of the symbol under point
 
 This function uses `clang-tags' to find the location of the
 definition(s) of the symbol under point. Results are presented in a
-buffer which allows quickly navigating to those locations."
+buffer which allows quickly navigating to those locations.
+
+The definition is looked for in the index, unless the file changed
+since it was indexed. With a prefix argument ARGP, the file is always
+recompiled."
   (interactive "P")
-  (let* ((offset (- (position-bytes (point)) 1))
-         (default-directory ct/default-directory)
-         (fromIndex (if argp "-r" "-i"))
-         (command (format "cd %s;\ntime clang-tags find-def %s %s %d %s\n"
-                          ct/default-directory
-                          fromIndex
-                          buffer-file-name offset ct/options)))
+  (ct/request `((command      . "find")
+                (file         . ,(file-truename (buffer-file-name)))
+                (offset       . ,(- (position-bytes (point)) 1))
+                (mostSpecific . ,(if ct/most-specific t :json-false))
+                (fromIndex    . ,(if argp :json-false t))
+                (hybrid       . ,(if argp :json-false t)))
+              "*ct/find-def*"
+              'ct/find-def-mode
+              'ct/format-definition))
 
-    (switch-to-buffer (get-buffer-create "*ct/find-def*"))
-    (compilation-start command
-                       'ct/find-def-mode)))
 
 
-
 ;;; Front-end for `clang-tags grep'
 
 (defun ct/grep-tag (usr)
@@ -91,19 +216,94 @@ operations."
                     (search-forward "USR: ")
                     (buffer-substring (point) (line-end-position)))))
   (message "%s" usr)
-  (switch-to-buffer (get-buffer-create "*ct/grep*"))
-  (compilation-start (format "clang-tags grep '%s' | sort -u" usr)
-                     'grep-mode
-                     (lambda (mode) "" "*ct/grep*")))
+  (ct/request `((command . "grep")
+                (usr     . ,usr))
+              "*ct/grep*"
+              'grep-mode
+              'ct/format-reference))
+
+
+
+;;; Front-end for `clang-tags references'
+
+(defun ct/references ()
+  "Find in the code base all uses of the symbol at point.
+
+This is equivalent to `ct/find-def' followed by `ct/grep-tag' on the
+most specific definition, but only needs one request to the server."
+  (interactive)
+  (ct/request `((command . "references")
+                (file    . ,(file-truename (buffer-file-name)))
+                (offset  . ,(- (position-bytes (point)) 1)))
+              "*ct/grep*"
+              'grep-mode
+              'ct/format-reference))
+
+
+
+;;; Front-end for `clang-tags symbols'
+
+(defun ct/symbols (query)
+  "Find in the code base the declarations of symbols matching QUERY.
+
+QUERY may be a symbol name, a prefix, a substring or an
+abbreviation.  Results are presented in a `grep-mode' buffer, best
+matches first."
+  (interactive (list (read-string "Symbol: " nil nil (thing-at-point 'symbol))))
+  (ct/request `((command . "symbols")
+                (query   . ,query))
+              "*ct/symbols*"
+              'grep-mode
+              'ct/format-declaration))
+
+
+
+;;; Front-end for `clang-tags diagnostics'
+
+(defun ct/format-diagnostic (diag)
+  "Format a diagnostic listed by `diagnostics' requests."
+  (format "%s:%d:%d: %s: %s\n" (ct/relative-file diag)
+          (ct/get 'line1 diag) (ct/get 'col1 diag)
+          (ct/get 'severity diag) (ct/get 'message diag)))
+
+(defun ct/diagnostics (argp)
+  "List the compilation errors and warnings stored for the current file.
+
+With a prefix argument ARGP, list them for the whole project.
+Diagnostics come from the last parse of each translation unit, so
+that no compilation is needed."
+  (interactive "P")
+  (ct/request (if argp
+                  '((command . "diagnostics"))
+                `((command . "diagnostics")
+                  (file    . ,(file-truename (buffer-file-name)))))
+              "*ct/diagnostics*"
+              'compilation-mode
+              'ct/format-diagnostic))
+
+
+
+;;; Prepare the current file for completion
+(defun ct/warm ()
+  "Ask the clang-tags server to parse the current file in the background."
+  (interactive)
+  (when (buffer-file-name)
+    (ct/start-request "clang-tags-warm" nil
+                      `((command . "warm")
+                        (file    . ,(file-truename (buffer-file-name)))))))
+
 
 
-
 ;;; Clang-tags minor mode
 (define-minor-mode clang-tags-mode
   "\\{clang-tags-mode-map}"
   :lighter " ct"
   :keymap (let ((map (make-sparse-keymap)))
             (define-key map (kbd "M-.") 'ct/find-def)
-            map))
+            (define-key map (kbd "M-,") 'ct/references)
+            (define-key map (kbd "C-M-.") 'ct/symbols)
+            map)
+  (when clang-tags-mode
+    (ct/warm)))
 
 (provide 'clang-tags)
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "classHierarchy.hxx"
+
+#include <algorithm>
+
+ClassHierarchy::ClassHierarchy ()
+{ }
+
+uint32_t ClassHierarchy::intern_ (const std::string & usr) {
+  auto it = ids_.find (usr);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  const uint32_t id = usrs_.size();
+  usrs_.push_back (usr);
+  ids_[usr] = id;
+  return id;
+}
+
+void ClassHierarchy::add (const std::string & usr, const std::string & base) {
+  const uint32_t derived = intern_ (usr);
+  const uint32_t to      = intern_ (base);
+  if (derived != to) {
+    edges_.push_back (std::make_pair (derived, to));
+  }
+}
+
+void ClassHierarchy::finish () {
+  std::sort (edges_.begin(), edges_.end());
+  edges_.erase (std::unique (edges_.begin(), edges_.end()), edges_.end());
+
+  // Edges are sorted by derived symbol: bases are taken in order
+  const size_t n = usrs_.size();
+  baseOffsets_.assign (n + 1, 0);
+  std::vector<uint32_t> derivedOffsets (n + 1, 0);
+  for (auto it = edges_.begin() ; it != edges_.end() ; ++it) {
+    ++baseOffsets_[it->first + 1];
+    ++derivedOffsets[it->second + 1];
+  }
+  for (size_t i = 0 ; i < n ; ++i) {
+    baseOffsets_[i+1]   += baseOffsets_[i];
+    derivedOffsets[i+1] += derivedOffsets[i];
+  }
+
+  bases_.resize (edges_.size());
+  std::vector<uint32_t> derived (edges_.size());
+  std::vector<uint32_t> next (derivedOffsets.begin(), derivedOffsets.end() - 1);
+  for (size_t i = 0 ; i < edges_.size() ; ++i) {
+    bases_[i] = edges_[i].second;
+    derived[next[edges_[i].second]++] = edges_[i].first;
+  }
+  std::vector<std::pair<uint32_t, uint32_t> >().swap (edges_);
+
+  // Number roots first; symbols left over can only be part of cycles, which
+  // a consistent index never contains
+  pre_.assign (n, 0);
+  last_.assign (n, 0);
+  order_.clear();
+  order_.reserve (n);
+  crossEdges_.clear();
+  std::vector<bool> visited (n, false);
+  for (uint32_t id = 0 ; id < n ; ++id) {
+    if (baseOffsets_[id] == baseOffsets_[id+1]) {
+      number_ (id, visited, derivedOffsets, derived);
+    }
+  }
+  for (uint32_t id = 0 ; id < n ; ++id) {
+    if (!visited[id]) {
+      number_ (id, visited, derivedOffsets, derived);
+    }
+  }
+
+  // Cross edges were recorded with the id of their base
+  for (auto it = crossEdges_.begin() ; it != crossEdges_.end() ; ++it) {
+    it->first = pre_[it->first];
+  }
+  std::sort (crossEdges_.begin(), crossEdges_.end());
+}
+
+void ClassHierarchy::number_ (uint32_t root, std::vector<bool> & visited,
+                              const std::vector<uint32_t> & derivedOffsets,
+                              const std::vector<uint32_t> & derived) {
+  // Iterative depth-first traversal: (id, next edge to follow)
+  std::vector<std::pair<uint32_t, uint32_t> > stack;
+  visited[root] = true;
+  pre_[root] = order_.size();
+  order_.push_back (root);
+  stack.push_back (std::make_pair (root, derivedOffsets[root]));
+
+  while (!stack.empty()) {
+    const uint32_t id = stack.back().first;
+    const uint32_t edge = stack.back().second;
+    if (edge == derivedOffsets[id+1]) {
+      last_[id] = order_.size() - 1;
+      stack.pop_back();
+      continue;
+    }
+    ++stack.back().second;
+
+    const uint32_t child = derived[edge];
+    if (visited[child]) {
+      crossEdges_.push_back (std::make_pair (id, child));
+      continue;
+    }
+    visited[child] = true;
+    pre_[child] = order_.size();
+    order_.push_back (child);
+    stack.push_back (std::make_pair (child, derivedOffsets[child]));
+  }
+}
+
+std::vector<std::string> ClassHierarchy::derived (const std::string & usr, size_t limit,
+                                                  std::function<void()> check) const {
+  std::vector<std::string> res;
+  auto it = ids_.find (usr);
+  if (it == ids_.end()) {
+    return res;
+  }
+
+  // Subtrees to output, by their root; the root itself is not output
+  std::vector<bool> seen (usrs_.size(), false);
+  std::vector<uint32_t> roots (1, it->second);
+  seen[pre_[it->second]] = true;
+
+  for (size_t i = 0 ; i < roots.size() ; ++i) {
+    if (check) {
+      check();
+    }
+
+    const uint32_t begin = pre_[roots[i]];
+    const uint32_t end   = last_[roots[i]];
+    if (i > 0 && seen[begin]) {
+      // Part of a subtree output earlier
+      continue;
+    }
+    for (uint32_t pre = begin ; pre <= end ; ++pre) {
+      if (seen[pre] && pre != begin) {
+        // Nested subtree output earlier
+        pre = last_[order_[pre]];
+        continue;
+      }
+      if (pre != begin || i > 0) {
+        if (limit > 0 && res.size() >= limit) {
+          return res;
+        }
+        res.push_back (usrs_[order_[pre]]);
+      }
+      seen[pre] = true;
+    }
+
+    // Descendants reached through other bases
+    auto edge = std::lower_bound (crossEdges_.begin(), crossEdges_.end(),
+                                  std::make_pair (begin, (uint32_t)0));
+    for ( ; edge != crossEdges_.end() && edge->first <= end ; ++edge) {
+      if (!seen[pre_[edge->second]]) {
+        roots.push_back (edge->second);
+      }
+    }
+  }
+  return res;
+}
+
+std::vector<std::string> ClassHierarchy::bases (const std::string & usr, size_t limit,
+                                                std::function<void()> check) const {
+  std::vector<std::string> res;
+  auto it = ids_.find (usr);
+  if (it == ids_.end()) {
+    return res;
+  }
+
+  std::vector<bool> visited (usrs_.size(), false);
+  std::vector<uint32_t> queue (1, it->second);
+  visited[it->second] = true;
+  for (size_t head = 0 ; head < queue.size() ; ++head) {
+    if (check && head % 1024 == 0) {
+      check();
+    }
+    const uint32_t id = queue[head];
+    for (uint32_t i = baseOffsets_[id] ; i < baseOffsets_[id+1] ; ++i) {
+      const uint32_t base = bases_[i];
+      if (visited[base]) {
+        continue;
+      }
+      if (limit > 0 && res.size() >= limit) {
+        return res;
+      }
+      visited[base] = true;
+      queue.push_back (base);
+      res.push_back (usrs_[base]);
+    }
+  }
+  return res;
+}
+
+size_t ClassHierarchy::memoryUsage () const {
+  // Hash table nodes are counted as a key, a value and two pointers
+  size_t memory = sizeof (uint32_t) * (baseOffsets_.capacity() + bases_.capacity()
+                                       + pre_.capacity() + last_.capacity()
+                                       + order_.capacity())
+    + sizeof (std::pair<uint32_t, uint32_t>) * (crossEdges_.capacity() + edges_.capacity());
+  for (auto it = usrs_.begin() ; it != usrs_.end() ; ++it) {
+    memory += 2 * (sizeof (std::string) + it->capacity())  // + key in ids_
+      + sizeof (uint32_t) + 2 * sizeof (void*);
+  }
+  return memory;
+}
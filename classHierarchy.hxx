@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** @brief In-memory graph of class inheritance and method overriding
+ *
+ * Edges from a class to its bases, and from a method to the methods it
+ * overrides, are added one by one (typically by chunks read from the index
+ * database, see Storage::bases()), then the graph is frozen by finish()
+ * before being queried. Both relations are kept in the same graph: they never
+ * share any node.
+ *
+ * The graph is numbered by a depth-first traversal from its roots (symbols
+ * without any base), so that the descendants of a symbol along the spanning
+ * tree occupy a contiguous range of pre-order numbers. Descendants reached
+ * through multiple inheritance are found by following the remaining
+ * (non-tree) edges whose base lies in these ranges, which are sorted by
+ * pre-order number of the base. Subtree queries are thus a few range scans.
+ */
+class ClassHierarchy {
+public:
+  ClassHierarchy ();
+
+  /** @brief Add an inheritance or overriding edge
+   *
+   * Duplicate edges are merged by finish().
+   *
+   * @param usr   USR of the derived class (or overriding method)
+   * @param base  USR of the base class (or overridden method)
+   */
+  void add (const std::string & usr, const std::string & base);
+
+  /** @brief Number the graph and build adjacency tables
+   *
+   * This must be called once, after all edges have been added.
+   */
+  void finish ();
+
+  /** @brief Classes deriving from a class (or methods overriding a method),
+   *         transitively
+   *
+   * @param usr    USR of the class or method
+   * @param limit  maximum number of symbols (0 = unlimited)
+   * @param check  function called periodically, which may throw to abandon
+   *               the query
+   *
+   * @return the USRs of the descendants, in depth-first order
+   */
+  std::vector<std::string> derived (const std::string & usr, size_t limit,
+                                    std::function<void()> check = std::function<void()>()) const;
+
+  /** @brief Bases of a class (or methods overridden by a method), transitively
+   *
+   * Same as derived(), in the other direction. Bases are output breadth-first,
+   * closest first.
+   */
+  std::vector<std::string> bases (const std::string & usr, size_t limit,
+                                  std::function<void()> check = std::function<void()>()) const;
+
+  /** @brief Number of symbols in the graph
+   */
+  size_t size () const {
+    return usrs_.size();
+  }
+
+  /** @brief Number of distinct edges in the graph
+   */
+  size_t edges () const {
+    return bases_.size();
+  }
+
+  /** @brief Estimated memory usage, in bytes
+   */
+  size_t memoryUsage () const;
+
+private:
+  uint32_t intern_ (const std::string & usr);
+  void number_ (uint32_t root, std::vector<bool> & visited,
+                const std::vector<uint32_t> & derivedOffsets,
+                const std::vector<uint32_t> & derived);
+
+  std::vector<std::string> usrs_;                   // by id
+  std::unordered_map<std::string, uint32_t> ids_;   // by USR
+  std::vector<uint32_t> baseOffsets_;               // start of the bases of each id
+  std::vector<uint32_t> bases_;
+
+  // Depth-first numbering along the spanning tree
+  std::vector<uint32_t> pre_;    // pre-order number of each id
+  std::vector<uint32_t> last_;   // greatest pre-order number in the subtree of each id
+  std::vector<uint32_t> order_;  // id of each pre-order number
+
+  // Non-tree edges, as (pre-order number of the base, derived id), sorted
+  std::vector<std::pair<uint32_t, uint32_t> > crossEdges_;
+
+  // Edges (derived, base), only needed until finish()
+  std::vector<std::pair<uint32_t, uint32_t> > edges_;
+};
@@ -0,0 +1,117 @@
+#include "request/frame.hxx"
+#include "getopt++/getopt.hxx"
+#include <boost/asio.hpp>
+#include <json/json.h>
+#include <iostream>
+
+typedef boost::asio::local::stream_protocol::iostream Socket;
+
+// Send a single request using the legacy protocol, and copy the server
+// response verbatim to the standard output. As with the server, the request
+// ends with an empty line (or the end of the input stream).
+static int sendRequest (Socket & socket, std::istream & cin) {
+  std::string line;
+  while (std::getline (cin, line) && line != "") {
+    socket << line << std::endl;
+  }
+  socket << std::endl << std::flush;
+
+  std::cout << socket.rdbuf() << std::flush;
+  return 0;
+}
+
+// Send requests (one JSON document per line) using the framed protocol on a
+// single connection. Each response is printed in the same format as the
+// legacy protocol.
+static int sendBatch (Socket & socket, std::istream & cin) {
+  int status = 0;
+  int id = 0;
+  std::string line;
+  while (std::getline (cin, line)) {
+    if (line.find_first_not_of (" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    Json::Value request;
+    Json::Reader reader;
+    if (!reader.parse (line, request)) {
+      std::cerr << "Invalid request: " << line << std::endl
+                << reader.getFormattedErrorMessages();
+      status = 1;
+      continue;
+    }
+    request["id"] = ++id;
+    Request::writeFrame (socket, request);
+    socket.flush();
+
+    std::cout << "Server response:" << std::endl;
+    std::string payload;
+    while (Request::readFrame (socket, payload)) {
+      Json::Value response;
+      if (!reader.parse (payload, response)) {
+        std::cerr << "Invalid response frame" << std::endl;
+        return 1;
+      }
+      if (response["id"].asInt() != id) {
+        continue;
+      }
+      if (response.isMember ("data")) {
+        std::cout << response["data"].asString() << std::flush;
+      }
+      if (response.isMember ("error")) {
+        std::cerr << "Error: " << response["error"].asString() << std::endl;
+        status = 1;
+      }
+      if (response["end"].asBool()) {
+        break;
+      }
+    }
+
+    if (!socket) {
+      std::cerr << "Connection closed by server" << std::endl;
+      return 1;
+    }
+  }
+  return status;
+}
+
+int main (int argc, char **argv) {
+  Getopt options (argc, argv);
+  options.add ("help", 'h', 0,
+               "print this help message and exit");
+  options.add ("socket", 'S', 1,
+               "connect to the server listening on PATH (default: .ct.sock)", "PATH");
+  options.add ("batch", 'b', 0,
+               "read one JSON request per line and send them all over a single connection");
+
+  try {
+    options.get();
+  } catch (...) {
+    std::cerr << options.usage();
+    return 1;
+  }
+
+  if (options.getCount ("help") > 0) {
+    std::cerr << options.usage();
+    return 0;
+  }
+
+  std::string socketPath = ".ct.sock";
+  if (options.getCount ("socket") > 0) {
+    socketPath = options["socket"];
+  }
+
+  Socket socket;
+  socket.connect (boost::asio::local::stream_protocol::endpoint (socketPath));
+  if (!socket) {
+    std::cerr << "Cannot connect to `" << socketPath << "': "
+              << socket.error().message() << std::endl;
+    return 1;
+  }
+
+  if (options.getCount ("batch") > 0) {
+    return sendBatch (socket, std::cin);
+  } else {
+    return sendRequest (socket, std::cin);
+  }
+}
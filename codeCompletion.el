@@ -50,6 +50,8 @@
 ;;
 
 ;;; Code:
+(require 'json)
+
 ;;; The clang executable
 (defcustom clang "clang"
   "The location of the Clang compiler executable"
@@ -63,6 +65,20 @@ This variable will typically contain include paths, e.g., -I~/MyProject."
   :type '(repeat (string :tag "Argument" ""))
   :group 'clang-completion-mode)
 
+;;; The program sending requests to the clang-tags server
+(defcustom clang-completion-client "clang-tags-client"
+  "The location of the clang-tags client executable"
+  :type 'file
+  :group 'clang-completion-mode)
+
+;;; Time after which the server gives up on a completion request
+(defcustom clang-completion-deadline 1000
+  "Time (in milliseconds) after which completion requests are abandoned.
+Results arriving later would be obsolete anyway, since the user has
+kept on typing."
+  :type 'integer
+  :group 'clang-completion-mode)
+
 ;;; The prefix header to use with Clang code completion.
 (setq clang-completion-prefix-header "")
 
@@ -137,14 +153,8 @@ This variable will typically contain include paths, e.g., -I~/MyProject."
 
 (defun clang-complete ()
   (let* ((cc-file (buffer-file-name))
-         (cc-line (number-to-string (+ 1 (current-line))))
-         (cc-col  (number-to-string (+ 1 (current-column))))
-         (cc-command `("/home/francois/projets/git/clang-tags/src/clang-tags" "complete"
-                       ,cc-file ,cc-line ,cc-col))
          (cc-buffer-name (concat "*Clang Completion for " (buffer-name) "*")))
-    ;; Start the code-completion process.
-    (print cc-command)
-    (if (buffer-file-name)
+    (if cc-file
         (progn
           ;; If there is already a code-completion process, kill it first.
           (let ((cc-proc (get-process "Clang Code-Completion")))
@@ -155,11 +165,29 @@ This variable will typically contain include paths, e.g., -I~/MyProject."
           (setq clang-result-string "")
           (setq clang-completion-buffer cc-buffer-name)
 
-          (let ((cc-proc (apply 'start-process
-                                (append (list "Clang Code-Completion" cc-buffer-name)
-                                        cc-command))))
+          ;; Start the code-completion process, which sends the request to the
+          ;; clang-tags server.
+          (let* ((cc-request
+                  `((command   . "complete")
+                    (file      . ,(file-truename cc-file))
+                    (line      . ,(+ 1 (current-line)))
+                    (column    . ,(+ 1 (current-column)))
+                    ;; The (possibly unsaved) buffer contents
+                    (content   . ,(save-restriction
+                                    (widen)
+                                    (buffer-substring-no-properties (point-min) (point-max))))
+                    (deadline  . ,clang-completion-deadline)
+                    (sent      . ,(truncate (* 1000 (float-time))))
+                    (cancelKey . ,(concat "complete:" cc-file))))
+                 (default-directory (if (boundp 'ct/default-directory)
+                                        ct/default-directory
+                                      default-directory))
+                 (cc-proc (start-process "Clang Code-Completion" cc-buffer-name
+                                         clang-completion-client)))
             (set-process-filter cc-proc 'clang-completion-stash-filter)
             (set-process-sentinel cc-proc 'clang-completion-sentinel)
+            (process-send-string cc-proc (concat (json-encode cc-request) "\n\n"))
+            (process-send-eof cc-proc)
             )))))
 
 ;; Code-completion when one of the trigger characters is typed into
@@ -167,7 +195,6 @@ This variable will typically contain include paths, e.g., -I~/MyProject."
 (defun clang-complete-self-insert (arg)
   (interactive "p")
   (self-insert-command arg)
-  (save-buffer)
   (clang-complete))
 
 ;; When the user has typed a character that requires the filter to be
@@ -1,6 +1,255 @@
 #include "application.hxx"
-#include "json/json.h"
+#include "compilationDatabase.hxx"
+#include "util/util.hxx"
 #include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+CompilationDatabase::CompilationDatabase (std::istream & input)
+  : buf_ (input.rdbuf()),
+    started_ (false),
+    done_ (false),
+    line_ (1)
+{ }
+
+bool CompilationDatabase::next (Command & command) {
+  if (done_) {
+    return false;
+  }
+
+  skipWhitespace_();
+  if (!started_) {
+    expect_ ('[');
+    started_ = true;
+    skipWhitespace_();
+    if (peek_() == ']') {
+      get_();
+      done_ = true;
+      return false;
+    }
+  } else {
+    int c = get_();
+    if (c == ']') {
+      done_ = true;
+      return false;
+    }
+    if (c != ',') {
+      error_ ("expected `,' or `]'");
+    }
+    skipWhitespace_();
+  }
+
+  command.file.clear();
+  command.directory.clear();
+  command.arguments.clear();
+  std::string commandLine;
+
+  expect_ ('{');
+  skipWhitespace_();
+  if (peek_() == '}') {
+    get_();
+  } else {
+    while (true) {
+      skipWhitespace_();
+      const std::string key = string_();
+      skipWhitespace_();
+      expect_ (':');
+      skipWhitespace_();
+
+      if (key == "file") {
+        command.file = string_();
+      } else if (key == "directory") {
+        command.directory = string_();
+      } else if (key == "command") {
+        commandLine = string_();
+      } else if (key == "arguments") {
+        command.arguments = stringArray_();
+      } else {
+        skipValue_();
+      }
+
+      skipWhitespace_();
+      int c = get_();
+      if (c == '}') {
+        break;
+      }
+      if (c != ',') {
+        error_ ("expected `,' or `}'");
+      }
+    }
+  }
+
+  // "arguments" takes precedence over "command"
+  if (command.arguments.empty()) {
+    command.arguments = shellSplit (commandLine);
+  }
+
+  // Drop the compiler name
+  if (!command.arguments.empty()) {
+    command.arguments.erase (command.arguments.begin());
+  }
+
+  // File names may be relative to the working directory. They are
+  // normalized, so that they match the names of indexed files.
+  if (command.file != "" && command.file[0] != '/' && command.directory != "") {
+    command.file = command.directory + "/" + command.file;
+  }
+  if (command.file != "") {
+    command.file = normalizePath (command.file);
+  }
+
+  return true;
+}
+
+int CompilationDatabase::peek_ () {
+  return buf_->sgetc();
+}
+
+int CompilationDatabase::get_ () {
+  int c = buf_->sbumpc();
+  if (c == '\n') {
+    ++line_;
+  }
+  return c;
+}
+
+void CompilationDatabase::skipWhitespace_ () {
+  while (true) {
+    int c = peek_();
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+      return;
+    }
+    get_();
+  }
+}
+
+void CompilationDatabase::expect_ (char c) {
+  if (get_() != c) {
+    error_ (std::string ("expected `") + c + "'");
+  }
+}
+
+void CompilationDatabase::error_ (const std::string & message) {
+  std::ostringstream oss;
+  oss << "line " << line_ << ": " << message;
+  throw std::runtime_error (oss.str());
+}
+
+std::string CompilationDatabase::string_ () {
+  expect_ ('"');
+
+  std::string s;
+  while (true) {
+    int c = get_();
+    switch (c) {
+    case EOF:
+      error_ ("unterminated string");
+
+    case '"':
+      return s;
+
+    case '\\':
+      c = get_();
+      switch (c) {
+      case 'b': s += '\b'; break;
+      case 'f': s += '\f'; break;
+      case 'n': s += '\n'; break;
+      case 'r': s += '\r'; break;
+      case 't': s += '\t'; break;
+      case 'u': {
+        unsigned int codePoint = 0;
+        for (int i = 0 ; i < 4 ; ++i) {
+          c = get_();
+          codePoint *= 16;
+          if      (c >= '0' && c <= '9') codePoint += c - '0';
+          else if (c >= 'a' && c <= 'f') codePoint += c - 'a' + 10;
+          else if (c >= 'A' && c <= 'F') codePoint += c - 'A' + 10;
+          else error_ ("invalid unicode escape");
+        }
+
+        // UTF-8 encoding (surrogate pairs are not combined)
+        if (codePoint < 0x80) {
+          s += (char)codePoint;
+        } else if (codePoint < 0x800) {
+          s += (char)(0xC0 | (codePoint >> 6));
+          s += (char)(0x80 | (codePoint & 0x3F));
+        } else {
+          s += (char)(0xE0 | (codePoint >> 12));
+          s += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+          s += (char)(0x80 | (codePoint & 0x3F));
+        }
+        break;
+      }
+      case EOF:
+        error_ ("unterminated string");
+      default:
+        s += (char)c;
+      }
+      break;
+
+    default:
+      s += (char)c;
+    }
+  }
+}
+
+std::vector<std::string> CompilationDatabase::stringArray_ () {
+  std::vector<std::string> v;
+
+  expect_ ('[');
+  skipWhitespace_();
+  if (peek_() == ']') {
+    get_();
+    return v;
+  }
+
+  while (true) {
+    skipWhitespace_();
+    v.push_back (string_());
+    skipWhitespace_();
+    int c = get_();
+    if (c == ']') {
+      return v;
+    }
+    if (c != ',') {
+      error_ ("expected `,' or `]'");
+    }
+  }
+}
+
+void CompilationDatabase::skipValue_ () {
+  int c = peek_();
+  if (c == '"') {
+    string_();
+    return;
+  }
+
+  if (c == '[' || c == '{') {
+    // Skip nested structures, taking care of strings which may contain
+    // brackets
+    int depth = 0;
+    do {
+      c = peek_();
+      if (c == '"') {
+        string_();
+        continue;
+      }
+      get_();
+      if (c == '[' || c == '{') ++depth;
+      if (c == ']' || c == '}') --depth;
+      if (c == EOF) error_ ("unexpected end of file");
+    } while (depth > 0);
+    return;
+  }
+
+  // Numbers, true, false, null
+  while (c != ',' && c != '}' && c != ']' && c != EOF
+         && c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+    get_();
+    c = peek_();
+  }
+}
+
 
 void Application::compilationDatabase (CompilationDatabaseArgs & args,
                                        std::ostream & cout) {
@@ -8,32 +257,52 @@ void Application::compilationDatabase (CompilationDatabaseArgs & args,
   // changed it)
   chdir (cwd_);
 
-  Json::Value root;
-  Json::Reader reader;
-
   std::ifstream json (args.fileName);
-  bool ret = reader.parse (json, root);
-  if ( !ret ) {
-    cout  << "Failed to parse compilation database `" << args.fileName << "'\n"
-          << reader.getFormattedErrorMessages();
+  if (!json) {
+    cout << "Cannot open compilation database `" << args.fileName << "'" << std::endl;
+    return;
   }
 
-  auto transaction(storage_.beginTransaction());
+  Timer timer;
+  const auto stored = storage_.compileCommands();
 
-  for (unsigned int i=0 ; i<root.size() ; ++i) {
-    std::string fileName = root[i]["file"].asString();
-    std::string directory = root[i]["directory"].asString();
+  // Only keep entries which differ from the stored compilation commands
+  std::vector<Storage::CompileCommand> changed;
+  unsigned int count = 0;
+  try {
+    CompilationDatabase database (json);
+    CompilationDatabase::Command command;
+    for (unsigned int i = 0 ; database.next (command) ; ++i) {
+      // Only keep the requested slice of the database
+      if (args.shards > 1 && (int)(i % args.shards) != args.shard) {
+        continue;
+      }
+      ++count;
 
-    std::vector<std::string> clArgs;
-    std::istringstream command (root[i]["command"].asString());
-    std::string arg;
-    std::getline (command, arg, ' ');
-    do {
-      std::getline (command, arg, ' ');
-      clArgs.push_back (arg);
-    } while (! command.eof());
+      auto it = stored.find (command.file);
+      if (it != stored.end()
+          && it->second.directory == command.directory
+          && it->second.args == command.arguments) {
+        continue;
+      }
 
-    cout << "  " << fileName << std::endl;
-    storage_.setCompileCommand (fileName, directory, clArgs);
+      cout << "  " << command.file << std::endl;
+      Storage::CompileCommand compileCommand;
+      compileCommand.fileName  = command.file;
+      compileCommand.directory = command.directory;
+      compileCommand.args.swap (command.arguments);
+      changed.push_back (compileCommand);
+    }
+  } catch (std::runtime_error & e) {
+    cout << "Failed to parse compilation database `" << args.fileName << "'" << std::endl
+         << e.what() << std::endl;
+    return;
   }
+
+  storage_.setCompileCommands (changed);
+
+  const double elapsed = timer.get();
+  cout << count << " entries, " << changed.size() << " changed"
+       << "\t" << elapsed << "s. ("
+       << (elapsed > 0 ? count / elapsed : 0) << " entries/s)" << std::endl;
 }
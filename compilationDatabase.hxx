@@ -0,0 +1,54 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+/** @brief Streaming reader for JSON compilation databases
+ *
+ * Compilation database entries are read one at a time from the input stream,
+ * so that memory usage does not depend on the database size. Both the @c
+ * "command" (shell-quoted string) and @c "arguments" (array of strings) forms
+ * of entries are supported. Unknown keys are skipped.
+ *
+ * See http://clang.llvm.org/docs/JSONCompilationDatabase.html
+ */
+class CompilationDatabase {
+public:
+  /** @brief Compilation database entry */
+  struct Command {
+    std::string              file;       /**< @brief normalized source file name */
+    std::string              directory;  /**< @brief working directory */
+    std::vector<std::string> arguments;  /**< @brief arguments, without the compiler name */
+  };
+
+  /** @brief Constructor
+   *
+   * @param input  stream containing the JSON compilation database
+   */
+  CompilationDatabase (std::istream & input);
+
+  /** @brief Read the next entry
+   *
+   * @param command  where the entry will be stored
+   *
+   * @return @c false if there are no more entries
+   * @throw std::runtime_error in case of syntax error
+   */
+  bool next (Command & command);
+
+private:
+  int peek_ ();
+  int get_ ();
+  void skipWhitespace_ ();
+  void expect_ (char c);
+  void error_ (const std::string & message);
+  std::string string_ ();
+  std::vector<std::string> stringArray_ ();
+  void skipValue_ ();
+
+  std::streambuf * buf_;
+  bool started_;
+  bool done_;
+  unsigned int line_;
+};
@@ -1,7 +1,12 @@
 #include "application.hxx"
 
 #include <clang-c/Index.h>
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <ctime>
+#include <functional>
+#include <sstream>
 
 
 namespace LibClang {
@@ -178,57 +183,195 @@ void printCompletionString(LibClang::Completion completion, std::ostream & strea
   }
 }
 
-void printCompletionResult(LibClang::CompletionResult completionResult,
-                             std::ostream & stream) {
-  LibClang::Completion completion = completionResult.get();
-
-  stream << "COMPLETION";
-
-  // switch (completion.availability()){
-  // case CXAvailability_Available:
-  //   break;
-  // case CXAvailability_Deprecated:
-  //   stream << "(deprecated)";
-  //   break;
-  // case CXAvailability_NotAvailable:
-  //   stream << "(unavailable)";
-  //   break;
-  // case CXAvailability_NotAccessible:
-  //   stream << "(inaccessible)";
-  //   break;
-  // }
-  // stream << "(" << completion.priority() << ")";
-
-  stream << ": ";
-
+std::string typedText (LibClang::Completion completion) {
   int n = completion.size();
   for (int i = 0 ; i < n ; ++i) {
     LibClang::Chunk chunk = completion.chunk(i);
     if (chunk.kind() == CXCompletionChunk_TypedText) {
-      stream << chunk.text() << " : ";
-      break;
+      return chunk.text();
     }
   }
+  return "";
+}
 
-  printCompletionString(completion, stream);
+bool isIdentifier (char c) {
+  return isalnum ((unsigned char)c) || c == '_';
+}
 
-  stream << std::endl;
+// Rank a completion candidate against the typed prefix. Lower is better; -1
+// means that the candidate does not match.
+int fuzzyScore (const std::string & prefix, const std::string & text) {
+  if (text.compare (0, prefix.size(), prefix) == 0) {
+    return 0;
+  }
+
+  // Case-insensitive prefix, then case-insensitive subsequence (the fewer and
+  // shorter the gaps, the better)
+  int gaps = 0;
+  bool contiguous = true;
+  size_t j = 0;
+  for (size_t i = 0 ; i < prefix.size() ; ++i, ++j) {
+    const char c = tolower (prefix[i]);
+    size_t start = j;
+    while (j < text.size() && tolower (text[j]) != c) {
+      ++j;
+    }
+    if (j == text.size()) {
+      return -1;
+    }
+    if (j > start) {
+      contiguous = false;
+      gaps += 1 + (j - start);
+    }
+  }
+  return contiguous ? 1 : 2 + gaps;
 }
 
 void Application::complete (CompleteArgs & args, std::ostream & cout) {
-  LibClang::TranslationUnit & tu = translationUnit_ (args.fileName);
+  scheduler_.focus (args.fileName);
+
+  try {
+    updateBuffer_ (args.fileName, args.buffer);
+  } catch (std::runtime_error & e) {
+    cout << "Error: " << e.what() << std::endl;
+    return;
+  }
 
-  CXCodeCompleteResults * results
-    = clang_codeCompleteAt(tu.raw(),
-                           args.fileName.c_str(), args.line, args.column,
-                           0, 0,
-                           clang_defaultCodeCompleteOptions());
-  LibClang::CodeCompletions completions (results);
-  completions.sort();
+  // Lines and columns count from 1, as in clang
+  if (args.line < 1 || args.column < 1) {
+    cout << "Error: invalid completion location " << args.line << ":" << args.column
+         << std::endl;
+    return;
+  }
 
-  cout << std::endl;
+  // The completion context is identified by the start of the identifier
+  // being completed, and the contents preceding and following it: typing the
+  // identifier does not change it.
+  size_t start, before, after;
+  {
+    const std::string contents = contents_ (args.fileName);
+    size_t offset = 0;
+    for (int line = 1 ; line < args.line && offset < contents.size() ; ++offset) {
+      if (contents[offset] == '\n') {
+        ++line;
+      }
+    }
+    offset = std::min (offset + args.column - 1, contents.size());
 
-  int n = completions.size();
-  for (int i = 0 ; i != n ; ++i)
-    printCompletionResult (completions[i], cout);
+    start = offset;
+    while (start > 0 && isIdentifier (contents[start-1])) {
+      --start;
+    }
+    size_t end = offset;
+    while (end < contents.size() && isIdentifier (contents[end])) {
+      ++end;
+    }
+    std::hash<std::string> hash;
+    before = hash (contents.substr (0, start));
+    after  = hash (contents.substr (end));
+  }
+
+  // Results also depend on the other unsaved buffers and on the headers on
+  // disk. The cache is checked first: the translation unit is only reparsed
+  // on misses.
+  const unsigned int generation = generation_ - bufferChanges_[args.fileName];
+  CompletionContext_ & context = completions_[args.fileName];
+  if (!context.candidates.empty()
+      && context.start == start && context.before == before && context.after == after
+      && context.generation == generation
+      && tu_.contains (args.fileName)
+      && filesUnchanged_ (tu_.get (args.fileName), context.time, args.fileName)) {
+    ++completionHits_;
+  }
+  else {
+    ++completionMisses_;
+
+    const time_t now = time (NULL);
+    LibClang::TranslationUnit & tu = translationUnit_ (args.fileName);
+    cancellation_.check (/*force=*/true);
+    LibClang::UnsavedFiles unsaved = unsavedFiles_();
+    CXCodeCompleteResults * results
+      = clang_codeCompleteAt(tu.raw(),
+                             args.fileName.c_str(), args.line, args.column,
+                             unsaved.begin(), unsaved.size(),
+                             clang_defaultCodeCompleteOptions());
+    LibClang::CodeCompletions completions (results);
+    completions.sort();
+
+    // The context is only replaced once all candidates are known, so that a
+    // cancelled request leaves the previous one intact
+    int n = completions.size();
+    std::vector<Candidate_> candidates (n);
+    for (int i = 0 ; i != n ; ++i) {
+      cancellation_.check();
+      LibClang::CompletionResult result = completions[i];
+      LibClang::Completion completion = result.get();
+
+      Candidate_ & candidate = candidates[i];
+      candidate.typedText = typedText (completion);
+      candidate.kind      = result.kindStr();
+      candidate.priority  = completion.priority();
+
+      std::ostringstream text;
+      printCompletionString (completion, text);
+      candidate.text = text.str();
+    }
+
+    context.candidates.swap (candidates);
+    context.start      = start;
+    context.before     = before;
+    context.after      = after;
+    context.generation = generation;
+    context.time       = now;
+  }
+
+  // Filter and rank candidates
+  typedef std::pair<int, const Candidate_*> Ranked;
+  std::vector<Ranked> ranked;
+  ranked.reserve (context.candidates.size());
+  for (auto it = context.candidates.begin() ; it != context.candidates.end() ; ++it) {
+    cancellation_.check();
+    const int score = fuzzyScore (args.prefix, it->typedText);
+    if (score >= 0) {
+      ranked.push_back (Ranked (score, &(*it)));
+    }
+  }
+
+  const size_t count = (args.limit > 0 && (size_t)args.limit < ranked.size())
+    ? args.limit
+    : ranked.size();
+  if (args.prefix != "") {
+    // Best score first, then most likely candidates according to clang
+    std::partial_sort (ranked.begin(), ranked.begin() + count, ranked.end(),
+                       [] (const Ranked & a, const Ranked & b) {
+                         if (a.first != b.first)
+                           return a.first < b.first;
+                         if (a.second->priority != b.second->priority)
+                           return a.second->priority < b.second->priority;
+                         return a.second->typedText.size() < b.second->typedText.size();
+                       });
+  }
+
+  Json::FastWriter writer;
+  if (!args.json) {
+    cout << std::endl;
+  }
+  for (size_t i = 0 ; i < count ; ++i) {
+    const Candidate_ & candidate = *(ranked[i].second);
+    if (args.json) {
+      Json::Value json;
+      json["typedText"] = candidate.typedText;
+      json["text"]      = candidate.text;
+      json["kind"]      = candidate.kind;
+      json["priority"]  = candidate.priority;
+      json["score"]     = ranked[i].first;
+      cout << writer.write (json);
+    } else {
+      cout << "COMPLETION: ";
+      if (candidate.typedText != "") {
+        cout << candidate.typedText << " : ";
+      }
+      cout << candidate.text << std::endl;
+    }
+  }
 }
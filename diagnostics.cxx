@@ -0,0 +1,80 @@
+#include "application.hxx"
+
+namespace {
+  std::string severity (CXDiagnosticSeverity severity) {
+    switch (severity) {
+    case CXDiagnostic_Note:    return "note";
+    case CXDiagnostic_Warning: return "warning";
+    case CXDiagnostic_Error:   return "error";
+    case CXDiagnostic_Fatal:   return "fatal";
+    default:                   return "ignored";
+    }
+  }
+
+  Json::Value range (const LibClang::SourceLocation::Position & begin,
+                     const LibClang::SourceLocation::Position & end) {
+    Json::Value json;
+    json["line1"]   = begin.line;
+    json["col1"]    = begin.column;
+    json["offset1"] = begin.offset;
+    json["line2"]   = end.line;
+    json["col2"]    = end.column;
+    json["offset2"] = end.offset;
+    return json;
+  }
+}
+
+void Application::storeDiagnostics_ (const std::string & fileName,
+                                     LibClang::TranslationUnit & tu,
+                                     bool persistent) {
+  const std::vector<LibClang::Diagnostic> diagnostics = tu.diagnostics();
+
+  std::vector<Storage::Diagnostic> stored;
+  for (auto it = diagnostics.begin() ; it != diagnostics.end() ; ++it) {
+    Storage::Diagnostic diag;
+    diag.file     = it->location.file;
+    diag.severity = severity (it->severity);
+    diag.line1    = it->begin.line;
+    diag.col1     = it->begin.column;
+    diag.offset1  = it->begin.offset;
+    diag.line2    = it->end.line;
+    diag.col2     = it->end.column;
+    diag.offset2  = it->end.offset;
+    diag.message  = it->message;
+    diag.fixIts   = Json::Value (Json::arrayValue);
+    for (auto fixIt = it->fixIts.begin() ; fixIt != it->fixIts.end() ; ++fixIt) {
+      Json::Value json = range (fixIt->begin, fixIt->end);
+      json["replacement"] = fixIt->replacement;
+      diag.fixIts.append (json);
+    }
+    stored.push_back (diag);
+  }
+
+  // Diagnostics of unsaved buffers would be stale as soon as the buffers are
+  // saved or discarded: they are not written to the index
+  if (!persistent) {
+    bufferDiagnostics_[fileName].swap (stored);
+    return;
+  }
+  bufferDiagnostics_.erase (fileName);
+  storage_.setDiagnostics (fileName, stored);
+}
+
+void Application::diagnostics (DiagnosticsArgs & args, std::ostream & cout) {
+  Json::FastWriter writer;
+  std::set<std::string> buffered;
+  for (auto it = bufferDiagnostics_.begin() ; it != bufferDiagnostics_.end() ; ++it) {
+    buffered.insert (it->first);
+    for (auto diag = it->second.begin() ; diag != it->second.end() ; ++diag) {
+      if (args.fileName.empty() || diag->file == args.fileName) {
+        cout << writer.write (diag->json());
+      }
+    }
+  }
+
+  storage_.diagnostics (args.fileName, buffered,
+                        [&] (const Storage::Diagnostic & diag) {
+                          cancellation_.check();
+                          cout << writer.write (diag.json());
+                        });
+}
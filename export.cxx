@@ -0,0 +1,20 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+void Application::exportSnapshot (ExportArgs & args, std::ostream & cout) {
+  // Change back to the original WD (in case `index` or `update` would have
+  // changed it)
+  chdir (cwd_);
+
+  cout << std::endl
+       << "-- Exporting index snapshot to `" << args.fileName << "'" << std::endl;
+  Timer timer;
+
+  try {
+    const std::string root = Snapshot::write (storage_, args.fileName, args.root);
+    cout << "  root: " << root << std::endl
+         << timer.get() << "s." << std::endl;
+  } catch (std::runtime_error & e) {
+    cout << "Error: " << e.what() << std::endl;
+  }
+}
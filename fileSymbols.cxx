@@ -0,0 +1,90 @@
+#include "application.hxx"
+
+#include <map>
+
+void Application::fileSymbols (FileSymbolsArgs & args, std::ostream & cout) {
+  Json::FastWriter writer;
+
+  Json::Value request;
+  request["command"] = "fileSymbols";
+  request["file"]    = args.fileName;
+  request["begin"]   = args.begin;
+  request["end"]     = args.end;
+  const std::string key = writer.write (request);
+
+  std::string output;
+  if (results_.get (key, storage_, output)) {
+    cout << output;
+    return;
+  }
+  const unsigned long generation = storage_.generation();
+  ResultCache::Dependencies dependencies;
+  dependencies.files.insert (args.fileName);
+
+  // Strings are output once in tables, and referred to by index
+  Json::Value kinds (Json::arrayValue);
+  Json::Value definitions (Json::arrayValue);
+  std::map<std::string, int> kindIndex;
+  std::map<std::string, int> definitionIndex;
+
+  // Each symbol takes 4 integers: offset (relative to the previous symbol),
+  // length, kind index and definition index (-1 if unknown)
+  Json::Value symbols (Json::arrayValue);
+  int offset = 0;
+
+  auto add = [&] (const Storage::RefDef & refDef) {
+    cancellation_.check();
+    const Storage::Reference & ref = refDef.ref;
+    const Storage::Definition & def = refDef.def;
+
+    auto kind = kindIndex.find (ref.kind);
+    if (kind == kindIndex.end()) {
+      kind = kindIndex.insert (std::make_pair (ref.kind, (int)kinds.size())).first;
+      kinds.append (ref.kind);
+    }
+
+    // Definitions may appear, disappear or move in other files
+    dependencies.usrs.insert (def.usr);
+
+    int definition = -1;
+    if (def.file != "") {
+      auto it = definitionIndex.find (def.usr);
+      if (it == definitionIndex.end()) {
+        it = definitionIndex.insert (std::make_pair (def.usr, (int)definitions.size())).first;
+        Json::Value json;
+        json["usr"]      = def.usr;
+        json["file"]     = def.file;
+        json["line"]     = def.line1;
+        json["col"]      = def.col1;
+        json["kind"]     = def.kind;
+        json["spelling"] = def.spelling;
+        definitions.append (json);
+      }
+      definition = it->second;
+    }
+
+    symbols.append (ref.offset1 - offset);
+    symbols.append (ref.offset2 - ref.offset1);
+    symbols.append (kind->second);
+    symbols.append (definition);
+    offset = ref.offset1;
+  };
+
+  if (snapshot_) {
+    snapshot_->fileSymbols (args.fileName, args.begin, args.end, add);
+  } else {
+    storage_.fileSymbols (args.fileName, args.begin, args.end, add);
+  }
+
+  // Clients can keep results as long as the index generation does not change
+  Json::Value json;
+  json["file"]        = args.fileName;
+  json["generation"]  = (Json::UInt64)generation;
+  json["kinds"]       = kinds;
+  json["definitions"] = definitions;
+  json["symbols"]     = symbols;
+
+  output = writer.write (json);
+  cout << output;
+  results_.insert (key, output, dependencies, generation);
+}
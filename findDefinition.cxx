@@ -4,8 +4,12 @@
 
 #include "application.hxx"
 
+#include <sys/stat.h>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <cstdlib>
+#include <ctime>
 
 void outputRefDef (const Storage::RefDef & refDef, std::ostream & cout)
 {
@@ -60,26 +64,37 @@ void displayCursor (LibClang::Cursor cursor, std::ostream & cout)
   outputRefDef (refDef, cout);
 }
 
+// Visit the cursors whose extent contains the target location, from the
+// outermost to the innermost one, without descending into unrelated parts of
+// the AST (and in particular into included files).
 class FindDefinition : public LibClang::Visitor<FindDefinition>
 {
 public:
   FindDefinition (const LibClang::SourceLocation & targetLocation,
+                  Request::Cancellation & cancellation,
                   std::ostream & cout)
     : targetLocation_ (targetLocation),
+      cancellation_ (cancellation),
       cout_ (cout)
   {}
 
   CXChildVisitResult visit (LibClang::Cursor cursor,
                             LibClang::Cursor parent)
   {
-    const LibClang::SourceLocation location (cursor.location());
+    if (cancellation_.cancelled()) {
+      return CXChildVisit_Break;
+    }
+
+    if (!cursor.spans (targetLocation_)) {
+      return CXChildVisit_Continue;
+    }
 
     // Skip unexposed cursor kinds
     if (cursor.isUnexposed()) {
       return CXChildVisit_Recurse;
     }
 
-    if (location == targetLocation_) {
+    if (cursor.location() == targetLocation_) {
       displayCursor (cursor, cout_);
     }
 
@@ -88,32 +103,48 @@ public:
 
 private:
   const LibClang::SourceLocation & targetLocation_;
+  Request::Cancellation & cancellation_;
   std::ostream & cout_;
 };
 
-void Application::findDefinitionFromIndex_ (FindDefinitionArgs & args, std::ostream & cout) {
-  const auto refDefs = storage_.findDefinition (args.fileName, args.offset);
-  if(refDefs.size() == 0)
-  {
-      return;
+bool Application::findDefinitionFromIndex_ (FindDefinitionArgs & args, std::ostream & cout) {
+  Json::Value request;
+  request["command"]      = "find";
+  request["file"]         = args.fileName;
+  request["offset"]       = args.offset;
+  request["mostSpecific"] = args.mostSpecific;
+  const std::string key = Json::FastWriter().write (request);
+
+  std::string cached;
+  if (results_.get (key, storage_, cached)) {
+    cout << cached;
+    return cached != "";
   }
+  const unsigned long generation = storage_.generation();
+  ResultCache::Dependencies dependencies;
+  dependencies.files.insert (args.fileName);
+
+  const auto refDefs = snapshot_
+    ? snapshot_->findDefinition (args.fileName, args.offset)
+    : storage_.findDefinition (args.fileName, args.offset);
   auto refDef = refDefs.begin();
-  const auto end = args.mostSpecific
+  const auto end = (args.mostSpecific && refDef != refDefs.end())
     ? refDef + 1
     : refDefs.end();
 
+  std::ostringstream output;
   for ( ; refDef != end ; ++refDef ) {
-    outputRefDef (*refDef, cout);
+    outputRefDef (*refDef, output);
+    dependencies.usrs.insert (refDef->def.usr);
   }
+
+  cout << output.str();
+  results_.insert (key, output.str(), dependencies, generation);
+  return !refDefs.empty();
 }
 
 void Application::findDefinitionFromSource_ (FindDefinitionArgs & args, std::ostream & cout) {
-  std::string directory;
-  std::vector<std::string> clArgs;
-  storage_.getCompileCommand (args.fileName, directory, clArgs);
-
-  LibClang::Index index;
-  LibClang::TranslationUnit tu = index.parse (clArgs);
+  LibClang::TranslationUnit & tu = translationUnit_ (args.fileName);
 
   // Print clang diagnostics if requested
   if (args.diagnostics) {
@@ -130,13 +161,95 @@ void Application::findDefinitionFromSource_ (FindDefinitionArgs & args, std::ost
   }
   else {
     LibClang::SourceLocation target = cursor.location();
-    FindDefinition findDef (target, cout);
+    FindDefinition findDef (target, cancellation_, cout);
     findDef.visitChildren (tu.cursor());
+    cancellation_.check();
+  }
+}
+
+// Seconds during which a file is trusted to be up to date, before its
+// includes are stat'ed again
+static const time_t STALE_CHECK_DELAY = 1;
+
+time_t latestMtime (const std::vector<std::string> & files) {
+  time_t latest = 0;
+  for (auto file = files.begin() ; file != files.end() ; ++file) {
+    struct stat fileStat;
+    if (stat (file->c_str(), &fileStat) == 0) {
+      latest = std::max (latest, fileStat.st_mtime);
+    }
+  }
+  return latest;
+}
+
+bool Application::dirty_ (const std::string & fileName) {
+  // The index is exact as long as neither the file nor its includes changed
+  // since they were indexed. A snapshot is never re-indexed.
+  if (snapshot_) {
+    return false;
   }
+  if (buffers_.count (fileName) > 0
+      || std::find (staleFiles_.begin(), staleFiles_.end(), fileName) != staleFiles_.end()) {
+    return true;
+  }
+
+  // The index is only queried again once it changed, or the file or one of
+  // its includes changed. Includes are stat'ed at most once per
+  // STALE_CHECK_DELAY.
+  struct stat fileStat;
+  const time_t mtime = (stat (fileName.c_str(), &fileStat) == 0) ? fileStat.st_mtime : 0;
+  const time_t now = time (NULL);
+  auto check = staleChecks_.find (fileName);
+  if (check != staleChecks_.end()
+      && check->second.generation == storage_.generation()
+      && check->second.mtime == mtime) {
+    StaleCheck_ & checked = check->second;
+    if (checked.stale || now - checked.time < STALE_CHECK_DELAY) {
+      return checked.stale;
+    }
+    checked.time = now;
+    if (latestMtime (checked.includes) == checked.includesMtime) {
+      return false;
+    }
+  }
+
+  StaleCheck_ & checked = staleChecks_[fileName];
+  checked.generation    = storage_.generation();
+  checked.mtime         = mtime;
+  checked.includes      = storage_.includedFiles (fileName);
+  checked.includesMtime = latestMtime (checked.includes);
+  checked.time          = now;
+  checked.stale         = storage_.nextFileFor (fileName) != "";
+  return checked.stale;
 }
 
 void Application::findDefinition (FindDefinitionArgs & args, std::ostream & cout) {
-  if (args.fromIndex) {
+  scheduler_.focus (args.fileName);
+
+  try {
+    updateBuffer_ (args.fileName, args.buffer);
+  } catch (std::runtime_error & e) {
+    cout << "Error: " << e.what() << std::endl;
+    return;
+  }
+
+  if (args.hybrid) {
+    const bool dirty = dirty_ (args.fileName);
+    if (!dirty && findDefinitionFromIndex_ (args, cout)) {
+      ++hybridFromIndex_;
+      return;
+    }
+
+    ++hybridFromSource_;
+    findDefinitionFromSource_ (args, cout);
+
+    // Bring the index up to date while the server is idle
+    if (dirty && std::find (staleFiles_.begin(), staleFiles_.end(), args.fileName)
+                 == staleFiles_.end()) {
+      staleFiles_.push_back (args.fileName);
+    }
+  }
+  else if (args.fromIndex) {
     // Request references from the index database
     findDefinitionFromIndex_ (args, cout);
   }
@@ -1,27 +1,216 @@
 #include "application.hxx"
-#include "sourceFile.hxx"
+
+#include <algorithm>
+#include <fnmatch.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+  // References are mostly grouped by file: keep the lines of the last file
+  // read, instead of re-reading the file for each reference
+  class LineCache {
+  public:
+    const std::string & line (const std::string & fileName, int lineno) {
+      if (fileName != fileName_) {
+        fileName_ = fileName;
+        lines_.clear();
+        std::ifstream file (fileName.c_str());
+        std::string line;
+        while (std::getline (file, line)) {
+          lines_.push_back (line);
+        }
+      }
+
+      static const std::string empty;
+      return (lineno >= 1 && lineno <= (int)lines_.size())
+        ? lines_[lineno-1]
+        : empty;
+    }
+
+  private:
+    std::string fileName_;
+    std::vector<std::string> lines_;
+  };
+}
 
 void Application::grep (const GrepArgs & args, std::ostream & cout) {
   Json::FastWriter writer;
 
-  const auto refs = storage_.grep (args.usr);
-  auto ref = refs.begin ();
-  const auto end = refs.end ();
-  for ( ; ref != end ; ++ref ) {
-    Json::Value json = ref->json();
-    SourceFile file (ref->file);
-    json["lineContents"] = file.line (ref->line1);
-    cout << writer.write (json);
-  }
-
-  if(args.find_overridens)
-  {
-      const auto overridenRefDefs = storage_.findOverridenDefinition(args.usr);
-      for (auto it = overridenRefDefs.begin() ; it != overridenRefDefs.end(); it++) {
-          Json::Value json = it->json();
-          SourceFile file (it->file);
-          json["lineContents"] = file.line (it->line1);
-          cout << writer.write (json);
+  Json::Value request;
+  request["command"]        = "grep";
+  request["usr"]            = args.usr;
+  request["findOverridens"] = args.find_overridens;
+  request["kind"]           = args.kind;
+  request["declOnly"]       = args.declOnly;
+  request["path"]           = args.path;
+  request["cursor"]         = args.cursor;
+  request["limit"]          = args.limit;
+  request["countOnly"]      = args.countOnly;
+  const std::string key = writer.write (request);
+
+  std::string cached;
+  if (results_.get (key, storage_, cached)) {
+    cout << cached;
+    return;
+  }
+
+  // Results only change when tags for one of these USRs are added or removed
+  const unsigned long generation = storage_.generation();
+  ResultCache::Dependencies dependencies;
+  dependencies.usrs.insert (args.usr);
+
+  // Results are streamed, and kept for the cache unless they get too large
+  std::string output;
+  bool cacheable = true;
+  auto write = [&] (const Json::Value & json) {
+    const std::string line = writer.write (json);
+    cout << line;
+    if (cacheable) {
+      output += line;
+      if (output.size() > maxCachedResult_) {
+        cacheable = false;
+        output.clear();
+      }
+    }
+  };
+
+  Storage::GrepQuery query;
+  query.usr      = args.usr;
+  query.kind     = args.kind;
+  query.declOnly = args.declOnly;
+  query.path     = args.path;
+  query.after    = args.cursor;
+  query.limit    = args.limit;
+
+  std::vector<Storage::Reference> overridens;
+  if (args.find_overridens) {
+    overridens = snapshot_
+      ? snapshot_->findOverridenDefinition (args.usr)
+      : storage_.findOverridenDefinition (args.usr);
+    for (auto it = overridens.begin() ; it != overridens.end() ; ++it) {
+      dependencies.files.insert (it->file);
+    }
+  }
+
+  // Overridden definitions come after all references. Cursors in their list
+  // are negative: -(i+1) for the i-th one.
+  const bool inOverridens = args.cursor < 0;
+  const size_t firstOverriden = inOverridens ? -args.cursor : 0;
+
+  // Lite indices only hold declarations: other references are found by
+  // parsing the translation units which may use the symbol
+  std::vector<Storage::Reference> resolved;
+  const bool lite = !args.declOnly && !snapshot_ && lite_();
+  if (lite) {
+    resolved = resolveReferences_ (args.usr, dependencies);
+    const std::string pathPattern = query.pathPattern();
+    auto filtered = [&] (const Storage::Reference & ref) {
+      return (query.kind != "" && ref.kind != query.kind)
+        ||   (query.path != "" && fnmatch (pathPattern.c_str(), ref.file.c_str(), 0) != 0);
+    };
+    resolved.erase (std::remove_if (resolved.begin(), resolved.end(), filtered),
+                    resolved.end());
+  }
+
+  if (args.countOnly) {
+    int count = inOverridens ? 0
+      :         lite         ? std::max ((int)resolved.size() - std::max (query.after, 0), 0)
+      :         snapshot_    ? snapshot_->grepCount (query)
+      :                        storage_.grepCount (query);
+    count += overridens.size() - std::min (firstOverriden, overridens.size());
+
+    Json::Value json;
+    json["count"]      = count;
+    json["generation"] = (Json::UInt64)generation;
+    write (json);
+    results_.insert (key, output, dependencies, generation);
+    return;
+  }
+
+  LineCache lines;
+  int count = 0;
+  int cursor = 0;
+  auto outputRef = [&] (const Storage::Reference & ref, int refCursor) {
+    cancellation_.check();
+    Json::Value json = ref.json();
+    json["lineContents"] = lines.line (ref.file, ref.line1);
+    write (json);
+
+    // Stream results to the client as they come
+    if (++count % 64 == 0) {
+      cout << std::flush;
+    }
+    cursor = refCursor;
+    return true;
+  };
+  if (inOverridens) {
+    // All references were output in previous pages
+  } else if (lite) {
+    // Pagination cursors are positions in the list of resolved references
+    for (size_t i = query.after ; i < resolved.size() ; ++i) {
+      if (query.limit > 0 && count >= query.limit) {
+        break;
       }
+      outputRef (resolved[i], i + 1);
+    }
+  } else if (snapshot_) {
+    snapshot_->grep (query, outputRef);
+  } else {
+    storage_.grep (query, outputRef);
+  }
+
+  // Overridden definitions fill the rest of the page
+  for (size_t i = firstOverriden ; i < overridens.size() ; ++i) {
+    if (args.limit > 0 && count >= args.limit) {
+      break;
+    }
+    outputRef (overridens[i], -(int)(i + 1));
+  }
+
+  const bool last = cursor < 0 && (size_t)-cursor == overridens.size();
+  if (args.limit > 0 && count >= args.limit && !last) {
+    // Tell the client where the next page starts
+    Json::Value json;
+    json["next"]       = cursor;
+    json["generation"] = (Json::UInt64)generation;
+    write (json);
+  }
+
+  if (cacheable) {
+    results_.insert (key, output, dependencies, generation);
+  }
+}
+
+std::string Application::usrAt_ (const std::string & fileName, int offset) {
+  scheduler_.focus (fileName);
+
+  std::string usr;
+  if (dirty_ (fileName)) {
+    LibClang::TranslationUnit & tu = translationUnit_ (fileName);
+    const LibClang::Cursor cursor (tu, fileName, offset);
+    const LibClang::Cursor def = cursor.referenced();
+    if (!def.isNull()) {
+      usr = def.USR();
+    }
+  } else {
+    // Most specific definition first
+    const auto refDefs = snapshot_
+      ? snapshot_->findDefinition (fileName, offset)
+      : storage_.findDefinition (fileName, offset);
+    if (!refDefs.empty()) {
+      usr = refDefs.front().def.usr;
+    }
   }
+  return usr;
+}
+
+void Application::references (ReferencesArgs & args, std::ostream & cout) {
+  const std::string usr = usrAt_ (args.fileName, args.offset);
+  if (usr == "") {
+    return;
+  }
+
+  args.grep.usr = usr;
+  grep (args.grep, cout);
 }
@@ -0,0 +1,64 @@
+#include "application.hxx"
+
+int Application::scanHierarchy_ (int cursor, ClassHierarchy & graph) {
+  return storage_.bases (
+    cursor, hierarchyChunk_,
+    [&graph] (const std::string & usr, const std::string & base) {
+      graph.add (usr, base);
+    });
+}
+
+bool Application::indexHierarchy_ () {
+  return hierarchy_.update (storage_.generation());
+}
+
+void Application::hierarchy (HierarchyArgs & args, std::ostream & cout) {
+  const std::string usr = args.usr != ""
+    ? args.usr
+    : usrAt_ (args.fileName, args.offset);
+  if (usr == "") {
+    return;
+  }
+
+  const ClassHierarchy * graph;
+  if (snapshot_) {
+    // Snapshots never change: their class hierarchy is built once
+    if (!snapshotHierarchy_) {
+      std::unique_ptr<ClassHierarchy> snapshotHierarchy (new ClassHierarchy);
+      snapshot_->bases ([&snapshotHierarchy] (const std::string & usr,
+                                              const std::string & base) {
+                          snapshotHierarchy->add (usr, base);
+                        });
+      snapshotHierarchy->finish();
+      snapshotHierarchy_ = std::move (snapshotHierarchy);
+    }
+    graph = snapshotHierarchy_.get();
+  } else {
+    // The first request has to wait for the whole graph to be built
+    graph = &hierarchy_.get (storage_.generation(),
+                             [this] () { cancellation_.check (/*force=*/true); });
+  }
+
+  auto check = [this] () { cancellation_.check(); };
+  const auto usrs = args.bases
+    ? graph->bases (usr, args.limit, check)
+    : graph->derived (usr, args.limit, check);
+
+  Json::FastWriter writer;
+  for (auto it = usrs.begin() ; it != usrs.end() ; ++it) {
+    cancellation_.check();
+
+    // Symbols without any indexed declaration are output without a location
+    Storage::Definition def;
+    Json::Value json;
+    const bool found = snapshot_
+      ? snapshot_->definition (*it, def)
+      : storage_.definition (*it, def);
+    if (found) {
+      json = def.json();
+    } else {
+      json["usr"] = *it;
+    }
+    cout << writer.write (json);
+  }
+}
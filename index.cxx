@@ -8,25 +8,35 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 class Indexer : public LibClang::Visitor<Indexer> {
 public:
   Indexer (const std::string & fileName,
            const std::vector<std::string> & exclude,
+           bool lite,
            Storage & storage,
            std::ostream & cout)
     : sourceFile_ (fileName),
       exclude_    (exclude),
+      lite_       (lite),
       storage_    (storage),
       cout_       (cout)
   {
-    needsUpdate_[fileName] = storage.beginFile (fileName);
+    needsUpdate_[fileName] = beginFile_ (fileName);
     storage_.addInclude (fileName, fileName);
   }
 
   CXChildVisitResult visit (LibClang::Cursor cursor,
                             LibClang::Cursor parent)
   {
+    if (isFunction_ (cursor.kind()) && cursor.isDefinition()) {
+      const LibClang::SourceLocation::Position begin = cursor.location().expansionLocation();
+      const LibClang::SourceLocation::Position end   = cursor.end().expansionLocation();
+      leaveFunctions_ (begin.file, begin.offset);
+      functions_.push_back (Function_ {cursor.USR(), end.file, end.offset});
+    }
+
     const LibClang::Cursor cursorDef (cursor.referenced());
 
     // Skip non-reference cursors
@@ -58,25 +68,93 @@ public:
 
     if (needsUpdate_.count(fileName) == 0) {
       cout_ << "    " << fileName << std::endl;
-      needsUpdate_[fileName] = storage_.beginFile (fileName);
+      needsUpdate_[fileName] = beginFile_ (fileName);
       storage_.addInclude (fileName, sourceFile_);
     }
 
+    // Lite indices only hold declarations and base classes
+    if (lite_ && !cursor.isDeclaration()
+        && cursor.kind() != CXCursor_CXXBaseSpecifier) {
+      return CXChildVisit_Recurse;
+    }
+
     if (needsUpdate_[fileName]) {
       const LibClang::SourceLocation::Position end = cursor.end().expansionLocation();
       
+      const std::vector<std::string> overriden = cursor.getAllOverridenMethods();
       storage_.addTag (usr, cursor.kindStr(), cursor.spelling(), fileName,
                        begin.line, begin.column, begin.offset,
                        end.line,   end.column,   end.offset,
-                       cursor.isDeclaration(), cursor.isVirtual(), cursor.getAllOverridenMethods());
+                       cursor.isDeclaration(), cursor.isVirtual(), overriden);
+
+      if (cursor.kind() == CXCursor_CXXBaseSpecifier) {
+        // The parent of a base specifier is the derived class
+        const std::string derived = parent.USR();
+        if (derived != "") {
+          storage_.addBase (derived, usr, fileName);
+        }
+      } else if (cursor.isDeclaration()) {
+        for (auto it = overriden.begin() ; it != overriden.end() ; ++it) {
+          storage_.addBase (usr, *it, fileName);
+        }
+      }
+
+      if (cursor.kind() == CXCursor_CallExpr) {
+        leaveFunctions_ (fileName, begin.offset);
+        if (!functions_.empty()) {
+          storage_.addCall (functions_.back().usr, usr, fileName, begin.offset);
+        }
+      }
     }
 
     return CXChildVisit_Recurse;
   }
 
 private:
+  // Start (re-)indexing a file if it changed, along with its contents
+  bool beginFile_ (const std::string & fileName) {
+    if (!storage_.beginFile (fileName)) {
+      return false;
+    }
+
+    std::ifstream file (fileName.c_str());
+    if (file) {
+      std::ostringstream contents;
+      contents << file.rdbuf();
+      storage_.setFileTrigrams (fileName, TextIndex::trigrams (contents.str()));
+    }
+    return true;
+  }
+
+  static bool isFunction_ (CXCursorKind kind) {
+    return kind == CXCursor_FunctionDecl
+      || kind == CXCursor_CXXMethod
+      || kind == CXCursor_Constructor
+      || kind == CXCursor_Destructor
+      || kind == CXCursor_ConversionFunction
+      || kind == CXCursor_FunctionTemplate;
+  }
+
+  // Forget enclosing functions which do not contain a given position. Cursors
+  // are visited in order, so that these can never contain later cursors.
+  void leaveFunctions_ (const std::string & fileName, unsigned int offset) {
+    while (!functions_.empty()
+           && (functions_.back().file != fileName || functions_.back().end < offset)) {
+      functions_.pop_back();
+    }
+  }
+
+  // Function definitions enclosing the current cursor, innermost last
+  struct Function_ {
+    std::string  usr;
+    std::string  file;
+    unsigned int end;
+  };
+  std::vector<Function_>           functions_;
+
   const std::string              & sourceFile_;
   const std::vector<std::string> & exclude_;
+  bool                             lite_;
   Storage                        & storage_;
   std::map<std::string, bool>      needsUpdate_;
   std::ostream                   & cout_;
@@ -88,6 +166,7 @@ void Application::index (IndexArgs & args, std::ostream & cout) {
   cout << std::endl
        << "-- Indexing project" << std::endl;
   storage_.setOption ("exclude", args.exclude);
+  storage_.setOption ("lite", args.lite ? "true" : "false");
   storage_.cleanIndex();
 
   updateIndex_ (args, cout);
@@ -97,6 +176,7 @@ void Application::update (IndexArgs & args, std::ostream & cout) {
   cout << std::endl
        << "-- Updating index" << std::endl;
   args.exclude = storage_.getOption ("exclude", Storage::Vector());
+  args.lite    = lite_();
 
   updateIndex_ (args, cout);
 }
@@ -104,34 +184,95 @@ void Application::update (IndexArgs & args, std::ostream & cout) {
 void Application::updateIndex_ (IndexArgs & args, std::ostream & cout) {
   Timer totalTimer;
 
-  {
-    auto transaction(storage_.beginTransaction());
-    std::string fileName;
-    while ((fileName = storage_.nextFile()) != "") {
-      cout << fileName << ":" << std::endl
-           << "  parsing..." << std::flush;
-      Timer timer;
-
-      LibClang::TranslationUnit tu = translationUnit_(fileName);
-
-      cout << "\t" << timer.get() << "s." << std::endl;
-      timer.reset();
-
-      // Print clang diagnostics if requested
-      if (args.diagnostics) {
-        for (unsigned int N = tu.numDiagnostics(),
-               i = 0 ; i < N ; ++i) {
-          cout << tu.diagnostic (i) << std::endl << std::endl;
-        }
-      }
+  std::string fileName;
+  while (true) {
+    // Let interactive requests run between files; they may also change the
+    // set of focused files
+    scheduler_.yield();
 
-      cout << "  indexing..." << std::endl;
-      LibClang::Cursor top (tu);
-      Indexer indexer (fileName, args.exclude, storage_, cout);
-      indexer.visitChildren (top);
-      cout << "  indexing...\t" << timer.get() << "s." << std::endl;
+    // Files recently used in the editor are indexed first
+    const std::vector<std::string> focused (scheduler_.focused().begin(),
+                                            scheduler_.focused().end());
+    fileName = storage_.nextFile (focused);
+    if (fileName == "") {
+      break;
     }
+
+    // Only stop between files, so that no file is left partially indexed.
+    // Each file is indexed in its own transaction, which is rolled back on
+    // errors.
+    cancellation_.check (/*force=*/true);
+
+    auto transaction (storage_.beginTransaction());
+    indexFile_ (fileName, args, cout);
   }
 
   cout << totalTimer.get() << "s." << std::endl;
 }
+
+void Application::indexFile_ (const std::string & fileName, IndexArgs & args,
+                              std::ostream & cout) {
+  cout << fileName << ":" << std::endl
+       << "  parsing..." << std::flush;
+  Timer timer;
+
+  // Only saved contents are indexed. Lite translation units lack function
+  // bodies: they are not kept for editor requests.
+  LibClang::TranslationUnit tu = args.lite
+    ? parseLite_ (fileName)
+    : translationUnit_(fileName, /*withBuffers=*/false);
+
+  cout << "\t" << timer.get() << "s." << std::endl;
+  timer.reset();
+
+  // Print clang diagnostics if requested
+  if (args.diagnostics) {
+    for (unsigned int N = tu.numDiagnostics(),
+           i = 0 ; i < N ; ++i) {
+      cout << tu.diagnostic (i) << std::endl << std::endl;
+    }
+  }
+
+  cout << "  indexing..." << std::endl;
+  LibClang::Cursor top (tu);
+  Indexer indexer (fileName, args.exclude, args.lite, storage_, cout);
+  indexer.visitChildren (top);
+  cout << "  indexing...\t" << timer.get() << "s." << std::endl;
+}
+
+bool Application::indexStale_ () {
+  while (!staleFiles_.empty()) {
+    const std::string fileName = staleFiles_.front();
+    staleFiles_.pop_front();
+
+    // The file may have been re-indexed in the meantime
+    const std::string sourceName = storage_.nextFileFor (fileName);
+    if (sourceName == "") {
+      continue;
+    }
+
+    IndexArgs args;
+    try {
+      args.exclude = storage_.getOption ("exclude", Storage::Vector());
+    } catch (std::runtime_error & e) {
+      // The project was never indexed
+      staleFiles_.clear();
+      return false;
+    }
+    args.diagnostics = false;
+    args.lite = lite_();
+
+    // The transaction is rolled back on errors; the file will be queued
+    // again by the next request finding it out of date
+    try {
+      std::ostream null (0);
+      auto transaction (storage_.beginTransaction());
+      indexFile_ (sourceName, args, null);
+      ++staleIndexed_;
+    } catch (std::exception & e) {
+      std::cerr << "Could not re-index `" << sourceName << "': " << e.what() << std::endl;
+    }
+    return true;
+  }
+  return false;
+}
@@ -1,8 +1,18 @@
 #include "cursor.hxx"
 #include "translationUnit.hxx"
 #include "sourceLocation.hxx"
+#include "config.h"
 
 namespace LibClang {
+  static void expansionOffset (CXSourceLocation location,
+                               CXFile & file, unsigned int & offset) {
+#ifdef HAVE_CLANG_GETEXPANSIONLOCATION
+    clang_getExpansionLocation (location, &file, 0, 0, &offset);
+#else
+    clang_getInstantiationLocation (location, &file, 0, 0, &offset);
+#endif
+  }
+
   Cursor::Cursor (CXCursor raw)
     : cursor_ (raw)
   { }
@@ -61,10 +71,18 @@ namespace LibClang {
     return clang_isDeclaration(clang_getCursorKind(raw()));
   }
 
+  bool Cursor::isDefinition () const {
+    return clang_isCursorDefinition (raw());
+  }
+
   Cursor Cursor::referenced () const {
     return clang_getCursorReferenced (raw());
   }
 
+  CXCursorKind Cursor::kind () const {
+    return clang_getCursorKind (raw());
+  }
+
   std::string Cursor::kindStr () const {
     CXCursorKind kind = clang_getCursorKind (raw());
     CXString kindSpelling = clang_getCursorKindSpelling (kind);
@@ -96,4 +114,19 @@ namespace LibClang {
     return clang_getRangeEnd (extent);
   }
 
+  bool Cursor::spans (const SourceLocation & location) const {
+    CXFile file;
+    unsigned int offset;
+    expansionOffset (location.raw(), file, offset);
+
+    const CXSourceRange extent = clang_getCursorExtent (raw());
+    CXFile beginFile, endFile;
+    unsigned int begin, end;
+    expansionOffset (clang_getRangeStart (extent), beginFile, begin);
+    expansionOffset (clang_getRangeEnd (extent),   endFile,   end);
+
+    return file != 0 && beginFile == file && endFile == file
+      && begin <= offset && offset <= end;
+  }
+
 }
@@ -74,6 +74,14 @@ namespace LibClang {
      */
     bool isDeclaration () const;
     
+    /** @brief Determine whether the cursor represents a definition
+     *
+     * For example, a function declaration is a definition if it has a body.
+     *
+     * @return true if the cursor represents a definition
+     */
+    bool isDefinition () const;
+
     /** @brief Determine whether the cursor represents a virtual call or not 
      *
      * @return true if the cursor represents a virtual call
@@ -90,6 +98,12 @@ namespace LibClang {
      */
     Cursor referenced () const;
 
+    /** @brief Get the kind of cursor
+     *
+     * @return the cursor kind, as a libclang enumeration value
+     */
+    CXCursorKind kind () const;
+
     /** @brief Get the kind of cursor
      *
      * Retrieve the kind of entity represented by the cursor, as a
@@ -140,6 +154,19 @@ namespace LibClang {
      */
     SourceLocation end () const;
 
+    /** @brief Determine whether the cursor extent contains a source location
+     *
+     * Positions are compared after macro expansion, so that this method can
+     * be used to prune the traversal of an AST when looking for the cursors
+     * at a given location.
+     *
+     * @param location  the SourceLocation to look for
+     *
+     * @return true if @c location lies between the first and last characters
+     *         of the cursor
+     */
+    bool spans (const SourceLocation & location) const;
+
     std::vector<std::string> getAllOverridenMethods() const;
 
   private:
@@ -23,6 +23,22 @@ namespace LibClang {
     return parse (args_c.size(), &(args_c[0]));
   }
 
+  TranslationUnit Index::parse (const std::vector<std::string> & args,
+                                UnsavedFiles & unsaved,
+                                unsigned int options) const {
+    std::vector<const char*> args_c;
+    auto i   = args.begin();
+    auto end = args.end();
+    for ( ; i != end ; ++i) {
+      args_c.push_back (i->c_str());
+    }
+
+    return clang_parseTranslationUnit (raw(), 0,
+                                       &(args_c[0]), args_c.size(),
+                                       unsaved.begin(), unsaved.size(),
+                                       options);
+  }
+
   const CXIndex & Index::raw () const {
     return index_->index_;
   }
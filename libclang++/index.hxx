@@ -9,8 +9,9 @@ namespace LibClang {
       @{
   */
 
-  // Forward declaration
+  // Forward declarations
   class TranslationUnit;
+  class UnsavedFiles;
 
 
   /** @brief Set of translation units
@@ -46,6 +47,23 @@ namespace LibClang {
      */
     TranslationUnit parse (const std::vector<std::string> & args) const;
 
+    /** @brief Create a translation unit from a command-line and unsaved buffers
+     *
+     * Same as above, but source files contents are read from the set of
+     * in-memory buffers in @em unsaved when available.
+     *
+     * @param args     A vector of command-line arguments
+     * @param unsaved  A set of unsaved contents for the source files
+     * @param options  A bitmask of @c CXTranslationUnit_Flags, for example
+     *                 @c clang_defaultEditingTranslationUnitOptions() for
+     *                 translation units used for code completion
+     *
+     * @return The corresponfing TranslationUnit object
+     */
+    TranslationUnit parse (const std::vector<std::string> & args,
+                           UnsavedFiles & unsaved,
+                           unsigned int options = CXTranslationUnit_None) const;
+
   private:
     const CXIndex & raw() const;
     struct Index_ {
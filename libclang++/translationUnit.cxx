@@ -45,6 +45,61 @@ namespace LibClang {
     return res;
   }
 
+  std::vector<Diagnostic> TranslationUnit::diagnostics () {
+    std::vector<Diagnostic> res;
+    for (unsigned int N = numDiagnostics(), i = 0 ; i < N ; ++i) {
+      CXDiagnostic diagnostic = clang_getDiagnostic (raw(), i);
+      Diagnostic diag;
+      diag.severity = clang_getDiagnosticSeverity (diagnostic);
+      if (diag.severity == CXDiagnostic_Ignored) {
+        clang_disposeDiagnostic (diagnostic);
+        continue;
+      }
+
+      CXString message = clang_getDiagnosticSpelling (diagnostic);
+      diag.message = clang_getCString (message);
+      clang_disposeString (message);
+
+      diag.location = SourceLocation (clang_getDiagnosticLocation (diagnostic))
+        .expansionLocation();
+      diag.begin = diag.end = diag.location;
+      if (clang_getDiagnosticNumRanges (diagnostic) > 0) {
+        CXSourceRange range = clang_getDiagnosticRange (diagnostic, 0);
+        diag.begin = SourceLocation (clang_getRangeStart (range)).expansionLocation();
+        diag.end   = SourceLocation (clang_getRangeEnd (range)).expansionLocation();
+      }
+
+      for (unsigned int M = clang_getDiagnosticNumFixIts (diagnostic),
+             j = 0 ; j < M ; ++j) {
+        CXSourceRange range;
+        CXString replacement = clang_getDiagnosticFixIt (diagnostic, j, &range);
+        Diagnostic::FixIt fixIt;
+        fixIt.begin       = SourceLocation (clang_getRangeStart (range)).expansionLocation();
+        fixIt.end         = SourceLocation (clang_getRangeEnd (range)).expansionLocation();
+        fixIt.replacement = clang_getCString (replacement);
+        clang_disposeString (replacement);
+        diag.fixIts.push_back (fixIt);
+      }
+
+      clang_disposeDiagnostic (diagnostic);
+      res.push_back (diag);
+    }
+    return res;
+  }
+
+  static void addInclusion (CXFile file, CXSourceLocation *, unsigned, CXClientData data) {
+    std::vector<std::string> & files = *((std::vector<std::string>*)data);
+    CXString fileName = clang_getFileName (file);
+    files.push_back (clang_getCString (fileName));
+    clang_disposeString (fileName);
+  }
+
+  std::vector<std::string> TranslationUnit::files () const {
+    std::vector<std::string> files;
+    clang_getInclusions (raw(), addInclusion, &files);
+    return files;
+  }
+
   unsigned long TranslationUnit::memoryUsage () const {
     CXTUResourceUsage usage = clang_getCXTUResourceUsage (raw());
     unsigned long total = 0;
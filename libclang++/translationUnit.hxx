@@ -2,8 +2,11 @@
 
 #include <clang-c/Index.h>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "unsavedFiles.hxx"
+#include "sourceLocation.hxx"
 
 namespace LibClang {
   /** @addtogroup libclang
@@ -12,9 +15,29 @@ namespace LibClang {
 
   // Forward declarations
   class Index;
-  class SourceLocation;
   class Cursor;
 
+  /** @brief Diagnostic message emitted by the compiler
+   *
+   * Positions are given after macro expansion. Diagnostics which are not
+   * associated to any file have empty file names.
+   */
+  struct Diagnostic {
+    /** @brief Suggested replacement of a source range */
+    struct FixIt {
+      SourceLocation::Position begin;
+      SourceLocation::Position end;
+      std::string              replacement;
+    };
+
+    CXDiagnosticSeverity     severity;
+    std::string              message;
+    SourceLocation::Position location;
+    SourceLocation::Position begin;  /**< @brief first highlighted range (or location) */
+    SourceLocation::Position end;
+    std::vector<FixIt>       fixIts;
+  };
+
   /** @brief Translation unit
    *
    * This class is a proxy for libclang's \c CXTranslationUnit type and should
@@ -85,6 +108,25 @@ namespace LibClang {
      */
     std::string diagnostic (unsigned int i);
 
+    /** @brief Get all diagnostics for the translation unit
+     *
+     * Unlike diagnostic(), this provides the location, range and fix-its of
+     * each diagnostic, so that they can be stored and displayed later.
+     * Ignored diagnostics are skipped.
+     *
+     * @return A vector of Diagnostic structures
+     */
+    std::vector<Diagnostic> diagnostics ();
+
+    /** @brief Get the names of all files used by the translation unit
+     *
+     * This includes the main source file and all (transitively) included
+     * files.
+     *
+     * @return A vector of file names
+     */
+    std::vector<std::string> files () const;
+
     /** @brief Get the memory usage of the translation unit.
      *
      * @return The memory usage (in bytes) of the translation unit.
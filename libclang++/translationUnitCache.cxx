@@ -1,4 +1,5 @@
 #include "translationUnitCache.hxx"
+#include <algorithm>
 
 namespace LibClang {
   TranslationUnitCache::TranslationUnitCache (unsigned long memoryLimit)
@@ -20,23 +21,35 @@ namespace LibClang {
     // translation unit.
     while (memoryUsage_ > memoryLimit_ && !lruFiles_.empty()) {
       auto it = tunits_.find(lruFiles_.front());
-      memoryUsage_ -= it->second.first.memoryUsage();
+      memoryUsage_ -= it->second.tu.memoryUsage();
       tunits_.erase(it);
       lruFiles_.pop_front();
     }
 
     // Add in our new translation unit. Even if the memory usage of this single
     // translation unit exceeds the memory limit, we will always insert it.
-    auto it = lruFiles_.emplace(lruFiles_.end(), fileName);
-    tunits_.emplace(fileName, std::make_pair(tu, it));
+    Entry_ entry = {tu, lruFiles_.emplace(lruFiles_.end(), fileName), 1};
+    tunits_.emplace(fileName, entry);
   }
 
   TranslationUnit & TranslationUnitCache::get (const std::string & fileName) {
     auto & entry = tunits_.find(fileName)->second;
 
     // Move this file to the end of the least-recently-used list.
-    lruFiles_.splice(lruFiles_.end(), lruFiles_, entry.second);
+    lruFiles_.splice(lruFiles_.end(), lruFiles_, entry.lru);
+    ++entry.hits;
 
-    return entry.first;
+    return entry.tu;
+  }
+
+  std::vector<std::string> TranslationUnitCache::hotSet () const {
+    // Most recently used files first; the stable sort keeps this order among
+    // files accessed the same number of times.
+    std::vector<std::string> files (lruFiles_.rbegin(), lruFiles_.rend());
+    std::stable_sort (files.begin(), files.end(),
+                      [this] (const std::string & a, const std::string & b) {
+                        return tunits_.find(a)->second.hits > tunits_.find(b)->second.hits;
+                      });
+    return files;
   }
 }
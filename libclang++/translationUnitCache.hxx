@@ -3,6 +3,8 @@
 #include "translationUnit.hxx"
 #include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace LibClang {
   /** @addtogroup libclang
@@ -43,13 +45,38 @@ namespace LibClang {
      */
     TranslationUnit & get (const std::string & fileName);
 
+    /** @brief List cached files, hottest first.
+     *
+     * Files are ordered by number of accesses since they entered the cache,
+     * and then by recency of their last access.
+     */
+    std::vector<std::string> hotSet () const;
+
+    /** @brief Number of cached translation units.
+     */
+    size_t size () const { return tunits_.size(); }
+
+    /** @brief Estimated memory usage (in bytes) of the cached translation units.
+     */
+    unsigned long memoryUsage () const { return memoryUsage_; }
+
+    /** @brief Maximum memory usage (in bytes) of the cache.
+     */
+    unsigned long memoryLimit () const { return memoryLimit_; }
+
   private:
     const unsigned long memoryLimit_;
     unsigned long memoryUsage_;
 
     typedef std::list<std::string> LRUFileList;
     LRUFileList lruFiles_;
-    std::map<std::string, std::pair<TranslationUnit, LRUFileList::iterator>> tunits_;
+
+    struct Entry_ {
+      TranslationUnit        tu;
+      LRUFileList::iterator  lru;
+      unsigned long          hits;
+    };
+    std::map<std::string, Entry_> tunits_;
   };
 
   /** @} */
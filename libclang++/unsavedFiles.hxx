@@ -23,26 +23,25 @@ namespace LibClang {
      */
     void add (const std::string sourcePath, const std::string bufferPath)
     {
-      const int bufsize = 4096;
-      char *buf = new char[bufsize];
-
       std::ostringstream contents;
       std::ifstream buffer (bufferPath);
-      do {
-        buffer.get (buf, bufsize, 0);
-        contents << buf;
-      } while (! buffer.eof());
+      contents << buffer.rdbuf();
 
-      delete[] buf;
+      addBuffer (sourcePath, contents.str());
+    }
 
+    /** @brief Store updated content for a source file
+     *
+     * Add an unsaved file to the list, associating it with updated contents
+     * provided in memory.
+     *
+     * @param sourcePath  path to the source file
+     * @param contents    up-to-date contents
+     */
+    void addBuffer (const std::string & sourcePath, const std::string & contents)
+    {
       sourcePath_.push_back (sourcePath);
-      contents_.push_back (contents.str());
-      unsavedFile_.resize (sourcePath_.size());
-
-      CXUnsavedFile & unsavedFile = unsavedFile_.back();
-      unsavedFile.Filename = sourcePath_.back().c_str();
-      unsavedFile.Contents = contents_.back().c_str();
-      unsavedFile.Length   = contents_.back().size();
+      contents_.push_back (contents);
     }
 
     /** @brief Get the size of the unsaved files set
@@ -55,9 +54,24 @@ namespace LibClang {
 
     /** @brief Get a C-like array of unsaved files
      *
-     * @return C pointer to the first unsaved file
+     * The array remains valid until the set is modified.
+     *
+     * @return C pointer to the first unsaved file, or @c NULL if the set is
+     *         empty
      */
     CXUnsavedFile * begin () {
+      if (sourcePath_.empty()) {
+        return 0;
+      }
+
+      // Strings may have moved since they were added: build the array now
+      unsavedFile_.resize (sourcePath_.size());
+      for (size_t i = 0 ; i < sourcePath_.size() ; ++i) {
+        CXUnsavedFile & unsavedFile = unsavedFile_[i];
+        unsavedFile.Filename = sourcePath_[i].c_str();
+        unsavedFile.Contents = contents_[i].data();
+        unsavedFile.Length   = contents_[i].size();
+      }
       return &(unsavedFile_[0]);
     }
 
@@ -0,0 +1,208 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+namespace {
+  // Collect all references to a given symbol in a translation unit
+  class ReferenceCollector : public LibClang::Visitor<ReferenceCollector> {
+  public:
+    ReferenceCollector (const std::string & usr,
+                        const std::vector<std::string> & exclude,
+                        std::vector<Storage::Reference> & refs)
+      : usr_     (usr),
+        exclude_ (exclude),
+        refs_    (refs)
+    { }
+
+    CXChildVisitResult visit (LibClang::Cursor cursor,
+                              LibClang::Cursor parent)
+    {
+      const LibClang::Cursor cursorDef (cursor.referenced());
+      if (cursorDef.isNull() || cursorDef.USR() != usr_) {
+        return CXChildVisit_Recurse;
+      }
+
+      const LibClang::SourceLocation::Position begin = cursor.location().expansionLocation();
+      const String fileName = begin.file;
+      if (fileName == "") {
+        return CXChildVisit_Recurse;
+      }
+      for (auto it = exclude_.begin() ; it != exclude_.end() ; ++it) {
+        if (fileName.startsWith (*it)) {
+          return CXChildVisit_Recurse;
+        }
+      }
+
+      const LibClang::SourceLocation::Position end = cursor.end().expansionLocation();
+      Storage::Reference ref;
+      ref.file     = fileName;
+      ref.line1    = begin.line;
+      ref.line2    = end.line;
+      ref.col1     = begin.column;
+      ref.col2     = end.column;
+      ref.offset1  = begin.offset;
+      ref.offset2  = end.offset;
+      ref.kind     = cursor.kindStr();
+      ref.spelling = cursor.spelling();
+      refs_.push_back (ref);
+      return CXChildVisit_Recurse;
+    }
+
+  private:
+    const std::string              & usr_;
+    const std::vector<std::string> & exclude_;
+    std::vector<Storage::Reference> & refs_;
+  };
+
+  struct Job {
+    std::string                     fileName;
+    std::string                     directory;
+    std::vector<std::string>        args;
+    std::vector<Storage::Reference> refs;
+  };
+
+  bool before (const Storage::Reference & a, const Storage::Reference & b) {
+    return std::tie (a.file, a.offset1, a.offset2) < std::tie (b.file, b.offset1, b.offset2);
+  }
+
+  bool same (const Storage::Reference & a, const Storage::Reference & b) {
+    return std::tie (a.file, a.offset1, a.offset2) == std::tie (b.file, b.offset1, b.offset2);
+  }
+}
+
+bool Application::lite_ () {
+  try {
+    return storage_.getOption ("lite") == "true";
+  } catch (std::runtime_error & e) {
+    // Indexed by an older version
+    return false;
+  }
+}
+
+LibClang::TranslationUnit Application::parseLite_ (const std::string & fileName) {
+  std::string directory;
+  std::vector<std::string> clArgs;
+  storage_.getCompileCommand (fileName, directory, clArgs);
+  chdir (directory.c_str());
+
+  LibClang::UnsavedFiles unsaved;
+  return index_.parse (clArgs, unsaved,
+                       CXTranslationUnit_DetailedPreprocessingRecord
+                       | CXTranslationUnit_SkipFunctionBodies);
+}
+
+std::vector<Storage::Reference>
+Application::resolveReferences_ (const std::string & usr,
+                                 ResultCache::Dependencies & dependencies) {
+  Json::FastWriter writer;
+  Json::Value request;
+  request["command"] = "resolveReferences";
+  request["usr"]     = usr;
+  const std::string key = writer.write (request);
+
+  // Results depend on the contents of all candidate translation units,
+  // headers included, and on the include graph which tells which translation
+  // units are candidates
+  const unsigned long generation = storage_.generation();
+  const std::vector<std::string> sources = storage_.includingSources (usr);
+  dependencies.usrs.insert (usr);
+  dependencies.includes = true;
+  for (auto it = sources.begin() ; it != sources.end() ; ++it) {
+    const std::vector<std::string> files = storage_.includedFiles (*it);
+    dependencies.files.insert (files.begin(), files.end());
+  }
+
+  std::vector<Storage::Reference> refs;
+  std::string cached;
+  if (results_.get (key, storage_, cached)) {
+    std::istringstream in (cached);
+    std::string line;
+    Json::Reader reader;
+    while (std::getline (in, line)) {
+      Json::Value json;
+      reader.parse (line, json);
+      Storage::Reference ref;
+      ref.file     = json["file"].asString();
+      ref.line1    = json["line1"].asInt();
+      ref.line2    = json["line2"].asInt();
+      ref.col1     = json["col1"].asInt();
+      ref.col2     = json["col2"].asInt();
+      ref.offset1  = json["offset1"].asInt();
+      ref.offset2  = json["offset2"].asInt();
+      ref.kind     = json["kind"].asString();
+      ref.spelling = json["spelling"].asString();
+      refs.push_back (ref);
+    }
+    return refs;
+  }
+
+  // The database is only accessed from this thread
+  std::vector<Job> jobs;
+  for (auto it = sources.begin() ; it != sources.end() ; ++it) {
+    Job job;
+    job.fileName = *it;
+    try {
+      storage_.getCompileCommand (*it, job.directory, job.args);
+    } catch (std::runtime_error & e) {
+      continue;
+    }
+    jobs.push_back (job);
+  }
+  std::vector<std::string> exclude;
+  try {
+    exclude = storage_.getOption ("exclude", Storage::Vector());
+  } catch (std::runtime_error & e) {
+    // No excluded path
+  }
+
+  // Parsing can not be interrupted: give up now if the request is obsolete
+  cancellation_.check (/*force=*/true);
+
+  // Translation units are parsed in parallel, each thread with its own index.
+  // The working directory is process-wide: it is given to clang instead.
+  std::atomic<size_t> next (0);
+  auto work = [&] () {
+    LibClang::Index index;
+    LibClang::UnsavedFiles unsaved;
+    for (size_t i = next++ ; i < jobs.size() ; i = next++) {
+      Job & job = jobs[i];
+      job.args.push_back ("-working-directory");
+      job.args.push_back (job.directory);
+      LibClang::TranslationUnit tu = index.parse (job.args, unsaved,
+                                                  CXTranslationUnit_DetailedPreprocessingRecord);
+      ReferenceCollector collector (usr, exclude, job.refs);
+      collector.visitChildren (tu.cursor());
+    }
+  };
+  const size_t threads = std::min<size_t> (jobs.size(),
+                                            std::max (1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> workers;
+  for (size_t i = 1 ; i < threads ; ++i) {
+    workers.push_back (std::thread (work));
+  }
+  work();
+  for (auto it = workers.begin() ; it != workers.end() ; ++it) {
+    it->join();
+  }
+
+  // Headers are seen by several translation units
+  for (auto it = jobs.begin() ; it != jobs.end() ; ++it) {
+    refs.insert (refs.end(), it->refs.begin(), it->refs.end());
+  }
+  std::sort (refs.begin(), refs.end(), before);
+  refs.erase (std::unique (refs.begin(), refs.end(), same), refs.end());
+
+  std::string output;
+  for (auto it = refs.begin() ; it != refs.end() ; ++it) {
+    output += writer.write (it->json());
+  }
+  results_.insert (key, output, dependencies, generation);
+  ++liteResolved_;
+  liteParsed_ += jobs.size();
+  return refs;
+}
@@ -3,6 +3,7 @@
 #include "request/request.hxx"
 #include "getopt++/getopt.hxx"
 #include <boost/asio.hpp>
+#include <poll.h>
 
 class CompilationDatabaseCommand : public Request::CommandParser {
 public:
@@ -11,16 +12,25 @@ public:
       application_ (application)
   {
     prompt_ = "load> ";
+    priority_ = Request::BACKGROUND;
     defaults();
 
     using Request::key;
     add (key ("database", args_.fileName)
          ->metavar ("FILEPATH")
          ->description ("Load compilation commands from a JSON compilation database"));
+    add (key ("shard", args_.shard)
+         ->metavar ("I")
+         ->description ("Only load the I-th slice of the database (counting from 0)"));
+    add (key ("shards", args_.shards)
+         ->metavar ("N")
+         ->description ("Number of slices the database is split into"));
   }
 
   void defaults () {
     args_.fileName = "compile_commands.json";
+    args_.shard = 0;
+    args_.shards = 1;
   }
 
   void run (std::ostream & cout) {
@@ -40,6 +50,7 @@ public:
       application_ (application)
   {
     prompt_ = "update> ";
+    priority_ = Request::BACKGROUND;
     defaults();
 
     using Request::key;
@@ -50,6 +61,7 @@ public:
 
   void defaults () {
     args_.diagnostics = true;
+    args_.lite = false;
   }
 
   void run (std::ostream & cout) {
@@ -69,12 +81,16 @@ public:
   {
     setDescription ("Index the source code base");
     prompt_ = "index> ";
+    priority_ = Request::BACKGROUND;
 
     defaults ();
     using Request::key;
     add (key ("exclude", args_.exclude)
          ->metavar ("PATH")
          ->description ("Exclude path"));
+    add (key ("lite", args_.lite)
+         ->metavar ("true|false")
+         ->description ("Only index declarations; find references on demand"));
   }
 
   void defaults () {
@@ -88,10 +104,48 @@ public:
 };
 
 
-class FindCommand : public Request::CommandParser {
+// Base class for commands accepting the contents of an unsaved editor buffer
+class BufferCommand : public Request::CommandParser {
+public:
+  BufferCommand (const std::string & name, const std::string & description)
+    : Request::CommandParser (name, description)
+  { }
+
+protected:
+  void addBufferKeys (Application::BufferArgs & args) {
+    using Request::key;
+    add (key ("content", args.content)
+         ->metavar ("STRING")
+         ->description ("Unsaved contents of the source file"));
+    add (key ("bufferPath", args.bufferPath)
+         ->metavar ("FILEPATH")
+         ->description ("File holding the unsaved contents of the source file"));
+    add (key ("edits", args.edits)
+         ->metavar ("EDITS")
+         ->description ("Edits to apply to the previous buffer contents"
+                        " ([{\"offset\": N, \"length\": N, \"text\": STRING}...])"));
+    add (key ("version", args.version)
+         ->metavar ("N")
+         ->description ("Version of the unsaved buffer"));
+    add (key ("baseVersion", args.baseVersion)
+         ->metavar ("N")
+         ->description ("Version of the buffer edits apply to"));
+  }
+
+  void bufferDefaults (Application::BufferArgs & args) {
+    args.content     = Json::Value();
+    args.bufferPath  = "";
+    args.edits       = Json::Value();
+    args.version     = 0;
+    args.baseVersion = 0;
+  }
+};
+
+
+class FindCommand : public BufferCommand {
 public:
   FindCommand (const std::string & name, Application & application)
-    : Request::CommandParser (name, "Find the definition of a symbol"),
+    : BufferCommand (name, "Find the definition of a symbol"),
       application_ (application)
   {
     prompt_ = "find> ";
@@ -113,6 +167,11 @@ public:
     add (key ("fromIndex", args_.fromIndex)
          ->metavar ("true|false")
          ->description ("Search in the index (faster but potentially out-of-date)"));
+    add (key ("hybrid", args_.hybrid)
+         ->metavar ("true|false")
+         ->description ("Search in the index, unless the file changed since it was indexed"
+                        " (overrides fromIndex)"));
+    addBufferKeys (args_.buffer);
   }
 
   void defaults () {
@@ -121,6 +180,8 @@ public:
     args_.mostSpecific = false;
     args_.diagnostics = true;
     args_.fromIndex = true;
+    args_.hybrid = false;
+    bufferDefaults (args_.buffer);
   }
 
   void run (std::ostream & cout) {
@@ -133,10 +194,54 @@ private:
 };
 
 
-class GrepCommand : public Request::CommandParser {
+class GrepBaseCommand : public Request::CommandParser {
+public:
+  GrepBaseCommand (const std::string & name, const std::string & description)
+    : Request::CommandParser (name, description)
+  { }
+
+protected:
+  void addGrepKeys (Application::GrepArgs & args) {
+    using Request::key;
+    add (key ("findOverridens", args.find_overridens)
+         ->metavar ("true|false")
+         ->description ("Force grep overriden methods"));
+    add (key ("kind", args.kind)
+         ->metavar ("KIND")
+         ->description ("Only output references of this kind (e.g. CallExpr)"));
+    add (key ("declOnly", args.declOnly)
+         ->metavar ("true|false")
+         ->description ("Only output declarations"));
+    add (key ("path", args.path)
+         ->metavar ("PATH")
+         ->description ("Only output references in files matching this prefix or glob pattern"));
+    add (key ("limit", args.limit)
+         ->metavar ("N")
+         ->description ("Output at most N references, followed by the cursor of the next page"));
+    add (key ("cursor", args.cursor)
+         ->metavar ("CURSOR")
+         ->description ("Start after the given cursor, as returned by a previous request"));
+    add (key ("countOnly", args.countOnly)
+         ->metavar ("true|false")
+         ->description ("Only output the number of references"));
+  }
+
+  void grepDefaults (Application::GrepArgs & args) {
+    args.find_overridens = false;
+    args.kind = "";
+    args.declOnly = false;
+    args.path = "";
+    args.cursor = 0;
+    args.limit = 0;
+    args.countOnly = false;
+  }
+};
+
+
+class GrepCommand : public GrepBaseCommand {
 public:
   GrepCommand (const std::string & name, Application & application)
-    : Request::CommandParser (name, "Find all references to a definition"),
+    : GrepBaseCommand (name, "Find all references to a definition"),
       application_ (application)
   {
     prompt_ = "grep> ";
@@ -146,14 +251,12 @@ public:
     add (key ("usr", args_.usr)
          ->metavar ("USR")
          ->description ("Unified Symbol Resolution for the symbol"));
-    add (key ("findOverridens", args_.find_overridens)
-         ->metavar ("true|false")
-         ->description ("Force grep overriden methods"));
+    addGrepKeys (args_);
   }
 
   void defaults () {
     args_.usr = "c:@F@main";
-    args_.find_overridens = false;
+    grepDefaults (args_);
   }
 
   void run (std::ostream & cout) {
@@ -166,10 +269,290 @@ private:
 };
 
 
-class CompleteCommand : public Request::CommandParser {
+class ReferencesCommand : public GrepBaseCommand {
+public:
+  ReferencesCommand (const std::string & name, Application & application)
+    : GrepBaseCommand (name, "Find all references to the symbol at a given location"),
+      application_ (application)
+  {
+    prompt_ = "references> ";
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name"));
+    add (key ("offset", args_.offset)
+         ->metavar ("OFFSET")
+         ->description ("Offset in bytes"));
+    addGrepKeys (args_.grep);
+  }
+
+  void defaults () {
+    args_.fileName = "";
+    args_.offset = 0;
+    grepDefaults (args_.grep);
+  }
+
+  void run (std::ostream & cout) {
+    application_.references (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::ReferencesArgs args_;
+};
+
+
+class FileSymbolsCommand : public Request::CommandParser {
+public:
+  FileSymbolsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "List all symbols in a file"),
+      application_ (application)
+  {
+    prompt_ = "fileSymbols> ";
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name"));
+    add (key ("begin", args_.begin)
+         ->metavar ("OFFSET")
+         ->description ("Only list symbols starting at or after this offset"));
+    add (key ("end", args_.end)
+         ->metavar ("OFFSET")
+         ->description ("Only list symbols starting before this offset (-1 for the end of file)"));
+  }
+
+  void defaults () {
+    args_.fileName = "";
+    args_.begin = 0;
+    args_.end = -1;
+  }
+
+  void run (std::ostream & cout) {
+    application_.fileSymbols (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::FileSymbolsArgs args_;
+};
+
+
+class SymbolsCommand : public Request::CommandParser {
+public:
+  SymbolsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Search declared symbols by name"),
+      application_ (application)
+  {
+    prompt_ = "symbols> ";
+    defaults();
+
+    using Request::key;
+    add (key ("query", args_.query)
+         ->metavar ("STRING")
+         ->description ("Name, prefix, substring or abbreviation of the symbol (case-insensitive)"));
+    add (key ("kind", args_.kind)
+         ->metavar ("KIND")
+         ->description ("Only output symbols of this kind (e.g. FunctionDecl)"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Maximum number of symbols (0 for no limit)"));
+  }
+
+  void defaults () {
+    args_.query = "";
+    args_.kind = "";
+    args_.limit = 50;
+  }
+
+  void run (std::ostream & cout) {
+    application_.symbols (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::SymbolsArgs args_;
+};
+
+
+class TextSearchCommand : public Request::CommandParser {
+public:
+  TextSearchCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Search file contents"),
+      application_ (application)
+  {
+    prompt_ = "textSearch> ";
+    defaults();
+
+    using Request::key;
+    add (key ("pattern", args_.pattern)
+         ->metavar ("STRING")
+         ->description ("Text to look for"));
+    add (key ("regex", args_.regex)
+         ->metavar ("true|false")
+         ->description ("Interpret the pattern as an ECMAScript regular expression"));
+    add (key ("ignoreCase", args_.ignoreCase)
+         ->metavar ("true|false")
+         ->description ("Ignore case distinctions"));
+    add (key ("path", args_.path)
+         ->metavar ("PATH")
+         ->description ("Only search files matching this prefix or glob pattern"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Output at most N matching lines (0 for no limit)"));
+  }
+
+  void defaults () {
+    args_.pattern = "";
+    args_.regex = false;
+    args_.ignoreCase = false;
+    args_.path = "";
+    args_.limit = 0;
+  }
+
+  void run (std::ostream & cout) {
+    application_.textSearch (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::TextSearchArgs args_;
+};
+
+
+class CallGraphCommand : public Request::CommandParser {
+public:
+  CallGraphCommand (const std::string & name, Application & application,
+                    bool callers)
+    : Request::CommandParser (name, callers
+                              ? "Find the functions calling a function"
+                              : "Find the functions called by a function"),
+      application_ (application),
+      callers_ (callers)
+  {
+    defaults();
+
+    using Request::key;
+    add (key ("usr", args_.usr)
+         ->metavar ("USR")
+         ->description ("Unified Symbol Resolution for the function"));
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name of a reference to the function (if no USR is given)"));
+    add (key ("offset", args_.offset)
+         ->metavar ("OFFSET")
+         ->description ("Offset in bytes of the reference"));
+    add (key ("depth", args_.depth)
+         ->metavar ("N")
+         ->description ("Follow calls transitively, up to N levels"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Output at most N functions (0 for no limit)"));
+  }
+
+  void defaults () {
+    args_.usr = "";
+    args_.fileName = "";
+    args_.offset = 0;
+    args_.depth = 1;
+    args_.limit = 1000;
+  }
+
+  void run (std::ostream & cout) {
+    if (callers_) {
+      application_.callers (args_, cout);
+    } else {
+      application_.callees (args_, cout);
+    }
+  }
+
+private:
+  Application & application_;
+  bool callers_;
+  Application::CallGraphArgs args_;
+};
+
+
+class HierarchyCommand : public Request::CommandParser {
+public:
+  HierarchyCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Find derived classes or overriding methods"),
+      application_ (application)
+  {
+    defaults();
+
+    using Request::key;
+    add (key ("usr", args_.usr)
+         ->metavar ("USR")
+         ->description ("Unified Symbol Resolution for the class or method"));
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name of a reference to the symbol (if no USR is given)"));
+    add (key ("offset", args_.offset)
+         ->metavar ("OFFSET")
+         ->description ("Offset in bytes of the reference"));
+    add (key ("bases", args_.bases)
+         ->metavar ("true|false")
+         ->description ("Find base classes or overridden methods instead"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Output at most N symbols (0 for no limit)"));
+  }
+
+  void defaults () {
+    args_.usr = "";
+    args_.fileName = "";
+    args_.offset = 0;
+    args_.bases = false;
+    args_.limit = 1000;
+  }
+
+  void run (std::ostream & cout) {
+    application_.hierarchy (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::HierarchyArgs args_;
+};
+
+
+class DiagnosticsCommand : public Request::CommandParser {
+public:
+  DiagnosticsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "List stored compilation diagnostics"),
+      application_ (application)
+  {
+    priority_ = Request::FOCUSED;
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Only list diagnostics in this file (all files if empty)"));
+  }
+
+  void defaults () {
+    args_.fileName = "";
+  }
+
+  void run (std::ostream & cout) {
+    application_.diagnostics (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::DiagnosticsArgs args_;
+};
+
+
+class CompleteCommand : public BufferCommand {
 public:
   CompleteCommand (const std::string & name, Application & application)
-    : Request::CommandParser (name, "Complete the code at point"),
+    : BufferCommand (name, "Complete the code at point"),
       application_ (application)
   {
     prompt_ = "complete> ";
@@ -181,16 +564,31 @@ public:
          ->description ("Source file name"));
     add (key ("line", args_.line)
          ->metavar ("LINE_NO")
-         ->description ("Line number (counting from 0)"));
+         ->description ("Line number (counting from 1)"));
     add (key ("column", args_.column)
          ->metavar ("COLUMN_NO")
-         ->description ("Column number (counting from 0)"));
+         ->description ("Column number (counting from 1)"));
+    add (key ("prefix", args_.prefix)
+         ->metavar ("STRING")
+         ->description ("Text typed since the completion location, used to"
+                        " filter and rank completions"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Maximum number of completions (0 for no limit)"));
+    add (key ("json", args_.json)
+         ->metavar ("true|false")
+         ->description ("Output completions as JSON objects"));
+    addBufferKeys (args_.buffer);
   }
 
   void defaults () {
     args_.fileName = "";
     args_.line = 0;
     args_.column = 0;
+    args_.prefix = "";
+    args_.limit = 0;
+    args_.json = false;
+    bufferDefaults (args_.buffer);
   }
 
   void run (std::ostream & cout) {
@@ -202,6 +600,117 @@ private:
   Application::CompleteArgs args_;
 };
 
+class ExportCommand : public Request::CommandParser {
+public:
+  ExportCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Export a read-only snapshot of the index"),
+      application_ (application)
+  {
+    prompt_ = "export> ";
+    priority_ = Request::BACKGROUND;
+    defaults();
+
+    using Request::key;
+    add (key ("output", args_.fileName)
+         ->metavar ("FILEPATH")
+         ->description ("Snapshot file to create"));
+    add (key ("root", args_.root)
+         ->metavar ("DIR")
+         ->description ("Store file names relative to DIR"
+                        " (default: common directory of all source files)"));
+  }
+
+  void defaults () {
+    args_.fileName = ".ct.snapshot";
+    args_.root = "";
+  }
+
+  void run (std::ostream & cout) {
+    application_.exportSnapshot (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::ExportArgs args_;
+};
+
+class MergeCommand : public Request::CommandParser {
+public:
+  MergeCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Merge shard index databases into the index"),
+      application_ (application)
+  {
+    prompt_ = "merge> ";
+    priority_ = Request::BACKGROUND;
+    defaults();
+
+    using Request::key;
+    add (key ("databases", args_.databases)
+         ->metavar ("FILEPATH")
+         ->description ("Shard database to merge"));
+  }
+
+  void defaults () {
+    args_.databases.clear();
+  }
+
+  void run (std::ostream & cout) {
+    application_.merge (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::MergeArgs args_;
+};
+
+class WarmCommand : public BufferCommand {
+public:
+  WarmCommand (const std::string & name, Application & application)
+    : BufferCommand (name, "Parse a source file in advance, for faster completion"),
+      application_ (application)
+  {
+    prompt_ = "warm> ";
+    priority_ = Request::FOCUSED;
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name"));
+    addBufferKeys (args_.buffer);
+  }
+
+  void defaults () {
+    args_.fileName = "";
+    bufferDefaults (args_.buffer);
+  }
+
+  void run (std::ostream & cout) {
+    application_.warm (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::WarmArgs args_;
+};
+
+class StatsCommand : public Request::CommandParser {
+public:
+  StatsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Display server statistics"),
+      application_ (application)
+  {
+    prompt_ = "stats> ";
+  }
+
+  void run (std::ostream & cout) {
+    application_.stats (cout);
+  }
+
+private:
+  Application & application_;
+};
+
 struct ExitCommand : public Request::CommandParser {
   ExitCommand (const std::string & name)
     : Request::CommandParser (name, "Shutdown server")
@@ -211,7 +720,7 @@ struct ExitCommand : public Request::CommandParser {
 
   void run (std::ostream & cout) {
     cout << "Exiting..." << std::endl;
-    throw std::runtime_error ("shutdown requested");
+    throw Request::Shutdown();
   }
 };
 
@@ -224,6 +733,13 @@ int main (int argc, char **argv) {
                "read a request from the standard input and exit");
   options.add ("cachesize", 'l', 1,
                "specify the maximum size of the translation unit cache (in MB)");
+  options.add ("snapshot", 'S', 1,
+               "serve index queries from a read-only snapshot", "FILE");
+  options.add ("snapshot-root", 'R', 1,
+               "resolve snapshot file names relative to DIR"
+               " (default: common directory of the local sources)", "DIR");
+  options.add ("record", 'r', 1,
+               "append all incoming requests to FILE", "FILE");
 
   try {
     options.get();
@@ -252,20 +768,59 @@ int main (int argc, char **argv) {
   cacheLimit *= 1024 * 1024;
 
   Storage storage;
-  Application app (storage, cacheLimit);
+  Request::Cancellation cancellation;
+  Request::Scheduler scheduler;
+  Application app (storage, cacheLimit, cancellation, scheduler);
+  if (options.getCount ("snapshot") > 0) {
+    try {
+      app.loadSnapshot (options["snapshot"], options["snapshot-root"]);
+    } catch (std::runtime_error & e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
   Request::Parser p ("Clang-tags server\n");
   p .add (new CompilationDatabaseCommand ("load", app))
     .add (new IndexCommand ("index", app))
     .add (new UpdateCommand ("update", app))
     .add (new FindCommand ("find", app))
     .add (new GrepCommand ("grep", app))
+    .add (new ReferencesCommand ("references", app))
+    .add (new FileSymbolsCommand ("fileSymbols", app))
+    .add (new SymbolsCommand ("symbols", app))
+    .add (new TextSearchCommand ("textSearch", app))
+    .add (new CallGraphCommand ("callers", app, /*callers=*/true))
+    .add (new CallGraphCommand ("callees", app, /*callers=*/false))
+    .add (new HierarchyCommand ("hierarchy", app))
+    .add (new DiagnosticsCommand ("diagnostics", app))
     .add (new CompleteCommand ("complete", app))
+    .add (new ExportCommand ("export", app))
+    .add (new MergeCommand ("merge", app))
+    .add (new WarmCommand ("warm", app))
+    .add (new StatsCommand ("stats", app))
     .add (new ExitCommand ("exit"))
-    .prompt ("clang-dde> ");
+    .prompt ("clang-dde> ")
+    .cancellation (cancellation)
+    .scheduler (scheduler);
+  std::unique_ptr<Request::Recorder> recorder;
+  if (options.getCount ("record") > 0) {
+    try {
+      recorder.reset (new Request::Recorder (options["record"]));
+    } catch (std::runtime_error & e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    p.recorder (*recorder);
+  }
+  scheduler.onIdle ([&app] () { return app.idle(); });
 
 
   if (options.getCount ("stdin") > 0) {
-    p.parseJson (std::cin, std::cout);
+    // Wait for the request before starting idle-time work
+    std::cin.peek();
+    p.connect (std::cin, std::cout, /*verbose=*/false);
+    p.serve();
   }
   else {
     const std::string pidPath (".ct.pid");
@@ -278,18 +833,59 @@ int main (int argc, char **argv) {
     const std::string socketPath (".ct.sock");
     try
       {
+        typedef boost::asio::local::stream_protocol::iostream Socket;
         boost::asio::io_service io_service;
         boost::asio::local::stream_protocol::endpoint endpoint (socketPath);
         boost::asio::local::stream_protocol::acceptor acceptor (io_service, endpoint);
-        for (;;)
-          {
-            boost::asio::local::stream_protocol::iostream socket;
-            boost::system::error_code err;
-            acceptor.accept(*socket.rdbuf(), err);
-            if (!err) {
-              p.parseJson (socket, socket, /*verbose=*/true);
-            }
+
+        // All connections are served together: requests are read as soon as
+        // they arrive, and queued by priority whatever their connection
+        std::list<std::unique_ptr<Socket> > connections;
+        auto readable = [] (Socket & socket) {
+          if (socket.rdbuf()->in_avail() > 0) {
+            return true;
           }
+          // Also true at the end of the stream
+          pollfd pending;
+          pending.fd     = socket.socket().native_handle();
+          pending.events = POLLIN;
+          return poll (&pending, 1, 0) > 0;
+        };
+        auto accept = [&] () {
+          std::unique_ptr<Socket> socket (new Socket);
+          boost::system::error_code err;
+          acceptor.accept (*socket->rdbuf(), err);
+          if (err) {
+            return;
+          }
+          Socket * s = socket.get();
+          connections.push_back (std::move (socket));
+          p.connect (*s, *s, /*verbose=*/true,
+                     [&readable, s] () { return readable (*s); },
+                     [&connections, s] () {
+                       connections.remove_if ([s] (const std::unique_ptr<Socket> & c) {
+                           return c.get() == s;
+                         });
+                     });
+        };
+
+        p.serve ([&] (bool wait) {
+            std::vector<pollfd> pending (1 + connections.size());
+            pending[0].fd     = acceptor.native_handle();
+            pending[0].events = POLLIN;
+            size_t i = 1;
+            for (auto it = connections.begin() ; it != connections.end() ; ++it, ++i) {
+              pending[i].fd     = (*it)->socket().native_handle();
+              pending[i].events = POLLIN;
+            }
+            if (poll (pending.data(), pending.size(), wait ? -1 : 0) <= 0) {
+              return false;
+            }
+            if (pending[0].revents & POLLIN) {
+              accept();
+            }
+            return true;
+          });
       }
     catch (std::exception& e)
       {
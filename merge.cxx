@@ -0,0 +1,30 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+void Application::merge (MergeArgs & args, std::ostream & cout) {
+  // Change back to the original WD (in case `index` or `update` would have
+  // changed it)
+  chdir (cwd_);
+
+  cout << std::endl
+       << "-- Merging index databases" << std::endl;
+  Timer totalTimer;
+
+  auto it  = args.databases.begin();
+  auto end = args.databases.end();
+  for ( ; it != end ; ++it) {
+    cout << *it << ":" << std::flush;
+    Timer timer;
+
+    try {
+      const Storage::MergeStats stats = storage_.merge (*it);
+      cout << "\t" << stats.files << " files ("
+           << stats.updatedFiles << " updated)"
+           << "\t" << timer.get() << "s." << std::endl;
+    } catch (std::runtime_error & e) {
+      cout << std::endl << "Error: " << e.what() << std::endl;
+    }
+  }
+
+  cout << totalTimer.get() << "s." << std::endl;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Request {
+  /** @addtogroup request
+      @{
+  */
+
+  /** @brief Cooperative cancellation of running requests
+   *
+   * A request can be given a deadline, and can be superseded by a newer
+   * request (see Parser::serve). Long-running commands periodically call
+   * cancelled() or check() at points where it is safe to stop, so that
+   * obsolete work is abandoned as soon as possible.
+   *
+   * Checks are cheap: unless forced, the clock and the supersession callback
+   * are only queried once every few calls.
+   */
+  class Cancellation {
+  public:
+    /** @brief Exception thrown by check() when the current request has been
+     *         cancelled
+     */
+    struct Cancelled : public std::runtime_error {
+      /** @brief Constructor
+       *
+       * @param expired  @c true if the request deadline expired, @c false if
+       *                 it was superseded by a newer request
+       */
+      Cancelled (bool expired)
+        : std::runtime_error (expired ? "deadline expired" : "request cancelled"),
+          expired (expired)
+      { }
+
+      /** @brief @c true if the request deadline expired */
+      const bool expired;
+    };
+
+    /** @brief Counts of abandoned requests */
+    struct Stats {
+      unsigned int cancelled;  /**< @brief requests superseded by newer ones */
+      unsigned int expired;    /**< @brief requests whose deadline expired */
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    Cancellation () {
+      stats_.cancelled = 0;
+      stats_.expired   = 0;
+    }
+
+    /** @brief Start monitoring a request
+     *
+     * Requests may be nested (for example when interactive requests are
+     * processed while a background request yields, see Scheduler): only the
+     * innermost request is monitored until it ends.
+     *
+     * @param deadline    point in time after which the request is abandoned;
+     *                    a default-constructed time point means no deadline
+     * @param superseded  callback returning @c true when a newer request makes
+     *                    the current one obsolete (may be empty)
+     */
+    void begin (Clock::time_point deadline = Clock::time_point(),
+                std::function<bool()> superseded = std::function<bool()>()) {
+      Request_ request;
+      request.deadline   = deadline;
+      request.superseded = superseded;
+      request.reason     = NONE;
+      request.calls      = 0;
+      requests_.push_back (request);
+    }
+
+    /** @brief Stop monitoring the current request, and update statistics
+     */
+    void end () {
+      if (requests_.empty()) {
+        return;
+      }
+      const Reason reason = requests_.back().reason;
+      if (reason == CANCELLED) ++stats_.cancelled;
+      if (reason == EXPIRED)   ++stats_.expired;
+      requests_.pop_back();
+    }
+
+    /** @brief Record a request which was abandoned before being started
+     *
+     * @param expired  @c true if its deadline expired, @c false if it was
+     *                 superseded
+     */
+    void drop (bool expired) {
+      if (expired) ++stats_.expired;
+      else         ++stats_.cancelled;
+    }
+
+    /** @brief Check whether the current request should be abandoned
+     *
+     * @param force  if @c true, always query the clock and the supersession
+     *               callback; this is meant to be used between expensive steps
+     *
+     * @return @c true if the request was cancelled or its deadline expired
+     */
+    bool cancelled (bool force = false) {
+      if (requests_.empty()) {
+        return false;
+      }
+      Request_ & request = requests_.back();
+      if (request.reason != NONE) {
+        return true;
+      }
+      if (!force && ++request.calls % checkInterval_ != 0) {
+        return false;
+      }
+      return poll_ (request);
+    }
+
+    /** @brief Abandon the current request if it should be
+     *
+     * @param force  same as for cancelled()
+     *
+     * @throw Cancelled
+     */
+    void check (bool force = false) {
+      if (cancelled (force)) {
+        throw Cancelled (requests_.back().reason == EXPIRED);
+      }
+    }
+
+    /** @brief Get statistics about abandoned requests
+     */
+    const Stats & stats () const {
+      return stats_;
+    }
+
+  private:
+    enum Reason { NONE, CANCELLED, EXPIRED };
+    enum { checkInterval_ = 64 };
+
+    struct Request_ {
+      Clock::time_point deadline;
+      std::function<bool()> superseded;
+      Reason reason;
+      unsigned int calls;
+    };
+
+    static bool poll_ (Request_ & request) {
+      if (request.deadline != Clock::time_point() && Clock::now() > request.deadline) {
+        request.reason = EXPIRED;
+      } else if (request.superseded && request.superseded()) {
+        request.reason = CANCELLED;
+      }
+      return request.reason != NONE;
+    }
+
+    std::vector<Request_> requests_;
+    Stats stats_;
+  };
+
+  /** @} */
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <chrono>
+
+namespace Request {
+  /** @addtogroup request
+      @{
+  */
+
+  /** @brief Default maximum size of a frame payload, in bytes
+   *
+   * Payloads are small, except for the unsaved buffer contents sent with
+   * some requests.
+   */
+  const size_t maxFrameSize = 64 * 1024 * 1024;
+
+  /** @brief Read a length-prefixed frame
+   *
+   * A frame is made of a 4-byte, big-endian payload length followed by the
+   * payload itself.
+   *
+   * Larger frames than @c maxSize are rejected without being read: the
+   * stream can then not be read any further, and is left with only its
+   * failbit set (its eofbit is not).
+   *
+   * @param cin      input stream
+   * @param payload  where the frame payload will be stored
+   * @param maxSize  maximum payload size
+   *
+   * @return @c false if the end of the stream was reached, or the frame was
+   *         rejected
+   */
+  inline bool readFrame (std::istream & cin, std::string & payload,
+                         size_t maxSize = maxFrameSize) {
+    unsigned char prefix[4];
+    if (!cin.read (reinterpret_cast<char*> (prefix), 4)) {
+      return false;
+    }
+
+    const size_t size = (size_t(prefix[0]) << 24) | (size_t(prefix[1]) << 16)
+                      | (size_t(prefix[2]) << 8)  |  size_t(prefix[3]);
+    if (size > maxSize) {
+      cin.setstate (std::ios::failbit);
+      return false;
+    }
+    payload.resize (size);
+    if (size > 0 && !cin.read (&payload[0], size)) {
+      return false;
+    }
+    return true;
+  }
+
+  /** @brief Write a length-prefixed frame
+   *
+   * @param cout     output stream
+   * @param payload  frame payload
+   *
+   * @sa readFrame()
+   */
+  inline void writeFrame (std::ostream & cout, const std::string & payload) {
+    const size_t size = payload.size();
+    const char prefix[4] = {char((size >> 24) & 0xff), char((size >> 16) & 0xff),
+                            char((size >> 8) & 0xff),  char(size & 0xff)};
+    cout.write (prefix, 4);
+    cout.write (payload.data(), size);
+  }
+
+  /** @brief Write a JSON value as a frame
+   *
+   * @param cout  output stream
+   * @param json  JSON value
+   */
+  inline void writeFrame (std::ostream & cout, const Json::Value & json) {
+    std::string payload = Json::FastWriter().write (json);
+    // Strip the trailing newline added by FastWriter
+    if (!payload.empty() && payload[payload.size()-1] == '\n') {
+      payload.resize (payload.size() - 1);
+    }
+    writeFrame (cout, payload);
+  }
+
+  /** @brief Output stream buffer splitting a response into data frames
+   *
+   * Text written to this buffer is sent as <tt>{"id": ID, "data": TEXT}</tt>
+   * frames on the underlying stream. Flushes are coalesced, so that
+   * line-by-line output does not produce one frame per line, while still
+   * streaming partial results to the client.
+   */
+  class FrameStreamBuf : public std::streambuf {
+  public:
+    /** @brief Constructor
+     *
+     * @param cout  stream where frames are written
+     * @param id    request id, copied to every frame
+     */
+    FrameStreamBuf (std::ostream & cout, const Json::Value & id)
+      : cout_ (cout),
+        id_ (id),
+        lastFrame_ (std::chrono::steady_clock::now())
+    { }
+
+    /** @brief Send all buffered data
+     */
+    void flushFrame () {
+      if (buffer_.empty()) {
+        return;
+      }
+
+      Json::Value frame;
+      frame["id"]   = id_;
+      frame["data"] = buffer_;
+      writeFrame (cout_, frame);
+      cout_.flush();
+
+      buffer_.clear();
+      lastFrame_ = std::chrono::steady_clock::now();
+    }
+
+  protected:
+    virtual int_type overflow (int_type c) {
+      if (c != traits_type::eof()) {
+        buffer_ += traits_type::to_char_type (c);
+        if (buffer_.size() >= maxSize_) {
+          flushFrame();
+        }
+      }
+      return traits_type::not_eof (c);
+    }
+
+    virtual std::streamsize xsputn (const char * s, std::streamsize n) {
+      buffer_.append (s, n);
+      if (buffer_.size() >= maxSize_) {
+        flushFrame();
+      }
+      return n;
+    }
+
+    virtual int sync () {
+      using namespace std::chrono;
+      if (duration_cast<milliseconds> (steady_clock::now() - lastFrame_).count() >= delayMs_) {
+        flushFrame();
+      }
+      return 0;
+    }
+
+  private:
+    enum { maxSize_ = 16384, delayMs_ = 20 };
+
+    std::ostream & cout_;
+    const Json::Value id_;
+    std::string buffer_;
+    std::chrono::steady_clock::time_point lastFrame_;
+  };
+
+  /** @} */
+}
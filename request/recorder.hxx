@@ -0,0 +1,82 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace Request {
+  /** @addtogroup request
+      @{
+  */
+
+  /** @brief Log of incoming requests
+   *
+   * When set on a Parser (see Parser::recorder()), every request is appended
+   * to the log as soon as it is received, before being run. Each request takes
+   * one line, holding a compact JSON object:
+   * @verbatim
+   {"t":1476873600123,"client":3,"request":{"command":"find", ...}}
+   @endverbatim
+   * where @c t is the reception time, in milliseconds since the epoch, and @c
+   * client identifies the connection the request was received on. Since the
+   * legacy protocol handles one request per connection, only requests sent
+   * over a persistent connection share a client id.
+   *
+   * Such logs can be replayed against a server with @c bench/ct-replay.
+   */
+  class Recorder {
+  public:
+    /** @brief Constructor
+     *
+     * @param fileName  log file name; requests are appended to an existing log
+     */
+    Recorder (const std::string & fileName)
+      : log_ (fileName.c_str(), std::ios::app),
+        clients_ (0)
+    {
+      if (!log_) {
+        throw std::runtime_error ("Could not open request log: " + fileName);
+      }
+    }
+
+    /** @brief Register a new client connection
+     *
+     * @return the client id, to be given to record()
+     */
+    unsigned int connect () {
+      return ++clients_;
+    }
+
+    /** @brief Append a request to the log
+     *
+     * The log is flushed after each request, so that it stays usable if the
+     * server is killed.
+     *
+     * @param client   client id returned by connect()
+     * @param request  JSON request
+     */
+    void record (unsigned int client, const Json::Value & request) {
+      typedef std::chrono::system_clock Clock;
+      const auto now = std::chrono::duration_cast<std::chrono::milliseconds>
+        (Clock::now().time_since_epoch());
+
+      Json::Value entry;
+      entry["t"]       = (Json::UInt64)now.count();
+      entry["client"]  = client;
+      entry["request"] = request;
+
+      // FastWriter output is a single line
+      log_ << writer_.write (entry) << std::flush;
+    }
+
+  private:
+    std::ofstream    log_;
+    Json::FastWriter writer_;
+    unsigned int     clients_;
+  };
+
+  /** @} */
+}
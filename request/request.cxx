@@ -11,4 +11,9 @@ namespace Request {
                               destination) {
     destination = json.asString();
   }
+
+  template <>
+  void setValue<Json::Value> (const Json::Value & json, Json::Value & destination) {
+    destination = json;
+  }
 }
@@ -1,9 +1,17 @@
 #include <json/json.h>
+#include "frame.hxx"
+#include "cancellation.hxx"
+#include "scheduler.hxx"
+#include "recorder.hxx"
 
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <list>
 #include <map>
+#include <deque>
+#include <functional>
 #include <vector>
 
 /** @defgroup request Request
@@ -50,6 +58,29 @@ command displaying help messages :
   help COMMAND
   @endverbatim
 
+JSON requests can be transported in one of two ways:
+- the legacy protocol handles one request per connection: the request is
+  terminated by an empty line, and the response is unframed text starting with
+  a "Server response:" line (see Parser::parseJson).
+- the framed protocol allows persistent connections and several requests in
+  flight (see Parser::parseFrames). Each message is a length-prefixed frame
+  (4-byte big-endian length + JSON payload). Requests carry an @c "id" key,
+  which is copied in all response frames:
+  @verbatim
+  -> {"id": 1, "command": "repeat", "times": 5, "input": "foo"}
+  <- {"id": 1, "data": "foo\nfoo\n"}
+  <- {"id": 1, "data": "foo\nfoo\nfoo\n"}
+  <- {"id": 1, "end": true}
+  @endverbatim
+  A response is made of any number of @c "data" frames, streaming partial
+  results, followed by one @c "end" frame. Responses to different requests may
+  be interleaved or arrive out of order; clients must use the @c "id" key to
+  match them with requests.
+
+A server can serve several connections at once, whatever their protocol (see
+Parser::connect() and Parser::serve()): requests are queued as soon as they
+arrive, and run in turn.
+
 See @ref test_request.cxx for an example showing how to use this module. Here
 is a example interactive session for an application defining the @c "repeat" command as above:
 
@@ -250,6 +281,11 @@ namespace Request {
     iss >> std::boolalpha >> destination;
   }
 
+  // Specializations, defined in request.cxx
+  template <> void setValue<bool>        (const Json::Value & json, bool & destination);
+  template <> void setValue<std::string> (const Json::Value & json, std::string & destination);
+  template <> void setValue<Json::Value> (const Json::Value & json, Json::Value & destination);
+
   /** @brief Scalar key parser
    *
    * Parses a key and stores a single value in a destination variable.
@@ -347,6 +383,20 @@ namespace Request {
   };
 
 
+  /** @brief Exception thrown by commands to stop serving requests
+   *
+   * Unlike other errors, it is never caught by the parser, not even in
+   * requests run while a background request yields (see Scheduler::yield()).
+   *
+   * @ingroup request
+   */
+  struct Shutdown : public std::runtime_error {
+    Shutdown ()
+      : std::runtime_error ("shutdown requested")
+    { }
+  };
+
+
   /** @brief Base class for command parsers
    *
    * Parses the keys associated to a command, and run it.
@@ -366,6 +416,7 @@ namespace Request {
      */
     CommandParser (std::string name, std::string description = "")
       : prompt_ (name + "> "),
+        priority_ (INTERACTIVE),
         description_ (description),
         name_ (name)
     { }
@@ -494,6 +545,13 @@ namespace Request {
      */
     std::string prompt_;
 
+    /** @brief Priority class of the command
+     *
+     * Defaults to Request::INTERACTIVE. Long-running commands should use
+     * Request::BACKGROUND, and call Scheduler::yield() between steps.
+     */
+    Priority priority_;
+
   private:
     /** @brief Display a detailed help about the command
      *
@@ -554,7 +612,10 @@ namespace Request {
      */
     Parser (std::string description = "")
       : description_ (description),
-        echo_ (false)
+        echo_ (false),
+        cancellation_ (0),
+        scheduler_ (0),
+        recorder_ (0)
     { }
 
     ~Parser () {
@@ -594,6 +655,49 @@ namespace Request {
       return *this;
     }
 
+    /** @brief Set the cancellation monitor
+     *
+     * When set, requests deadlines and supersession are monitored through
+     * this object, which commands can query to abandon obsolete work.
+     *
+     * @param c  cancellation monitor, which must outlive the parser
+     *
+     * @return the parser itself
+     */
+    Parser & cancellation (Cancellation & c) {
+      cancellation_ = &c;
+      return *this;
+    }
+
+    /** @brief Set the scheduler
+     *
+     * When set, queued framed requests are run by order of priority, and
+     * background requests can let interactive and focused requests run by
+     * calling Scheduler::yield().
+     *
+     * @param s  scheduler, which must outlive the parser
+     *
+     * @return the parser itself
+     */
+    Parser & scheduler (Scheduler & s) {
+      scheduler_ = &s;
+      return *this;
+    }
+
+    /** @brief Set the request recorder
+     *
+     * When set, all JSON requests are appended to the recorder log as they
+     * are received. Each connection is considered as a new client.
+     *
+     * @param r  recorder, which must outlive the parser
+     *
+     * @return the parser itself
+     */
+    Parser & recorder (Recorder & r) {
+      recorder_ = &r;
+      return *this;
+    }
+
     /** @brief Add a command parser
      *
      * @param command  pointer to a command parser
@@ -618,7 +722,10 @@ namespace Request {
            << "  " << std::setw(20) << std::left << "help"
            << " Display this help" << std::endl
            << "  " << std::setw(20) << std::left << "help COMMAND"
-           << " Display help about COMMAND" << std::endl;
+           << " Display help about COMMAND" << std::endl
+           << "  " << std::setw(20) << std::left << "pipeline"
+           << " Run JSON requests in turn, feeding each one with the output of the previous"
+           << std::endl;
 
       auto it = commands_.begin();
       auto end = commands_.end();
@@ -679,54 +786,683 @@ namespace Request {
 
     /** @brief Parse a stream of JSON requests and run the associated commands
      *
-     * JSON requests must be separated by blank lines.
+     * JSON requests must be separated by blank lines. Only the first request
+     * is handled: the legacy protocol handles one request per connection.
      *
      * @param cin      input stream where requests are read
      * @param cout     output stream where results are printed
      * @param verbose  if @c true, output progress information
      */
     void parseJson (std::istream & cin, std::ostream & cout, bool verbose=false) {
-      if (verbose)
+      connect_ (cin, cout, verbose, std::function<bool()>(), std::function<void()>(),
+                JSON);
+      serve();
+    }
+
+    /** @brief Parse a stream of framed JSON requests and run the associated
+     *         commands
+     *
+     * Requests are read from length-prefixed frames until the end of the input
+     * stream is reached. The output of each command is streamed as @c "data"
+     * frames, followed by an @c "end" frame. If a command throws an exception,
+     * the @c "end" frame holds an @c "error" key, and the exception is
+     * propagated to the caller.
+     *
+     * Requests may carry the following optional keys:
+     * - @c "deadline": number of milliseconds after which the request is
+     *   abandoned;
+     * - @c "sent": time at which the client sent the request, in milliseconds
+     *   since the epoch; when given, the deadline counts from then instead of
+     *   from the time the request is read;
+     * - @c "cancelKey": requests sharing the same key supersede one
+     *   another, whatever their connection. Queued requests are dropped when a
+     *   newer request with the same key has been received, and running
+     *   requests are cancelled as soon as such a request arrives.
+     *
+     * Abandoned requests are answered with an @c "end" frame holding a @c
+     * "cancelled" or @c "expired" key.
+     *
+     * When a scheduler is set, queued requests are run by order of priority
+     * class, and interactive and focused requests can run while a background
+     * request yields.
+     *
+     * @param cin       input stream where requests are read
+     * @param cout      output stream where response frames are written
+     * @param verbose   if @c true, output progress information
+     * @param readable  function returning @c true if data can be read from @c
+     *                  cin without blocking; defaults to checking the stream
+     *                  buffer
+     *
+     * @sa readFrame(), writeFrame(), cancellation()
+     */
+    void parseFrames (std::istream & cin, std::ostream & cout, bool verbose=false,
+                      std::function<bool()> readable = std::function<bool()>()) {
+      connect_ (cin, cout, verbose, readable, std::function<void()>(), FRAMED);
+      serve();
+    }
+
+    /** @brief Start serving a client connection
+     *
+     * The protocol used by the client is detected from the first byte it
+     * sends: framed requests start with a length prefix, whose first byte is 0
+     * for all practical request sizes, whereas legacy JSON requests start with
+     * a printable character (see parseFrames() and parseJson()).
+     *
+     * Requests are read by serve(), along with those of all other connections.
+     *
+     * @param cin       input stream where requests are read
+     * @param cout      output stream where responses are written
+     * @param verbose   if @c true, output progress information
+     * @param readable  function returning @c true if data (or the end of the
+     *                  stream) can be read from @c cin without blocking;
+     *                  defaults to checking the stream buffer
+     * @param close     function called once the input stream ended and all
+     *                  requests of the connection have been answered; the
+     *                  streams are not used afterwards (may be empty)
+     */
+    void connect (std::istream & cin, std::ostream & cout, bool verbose,
+                  std::function<bool()> readable = std::function<bool()>(),
+                  std::function<void()> close = std::function<void()>()) {
+      connect_ (cin, cout, verbose, readable, close, UNKNOWN);
+    }
+
+    /** @brief Serve the requests of all connected clients
+     *
+     * Requests are queued as soon as they can be read, whatever the connection
+     * they come from. When a scheduler is set, they are run by order of
+     * priority class, and idle-time work is performed while no request is
+     * pending. New clients are also connected while a background request
+     * yields, so that their interactive requests can run first.
+     *
+     * @param poll  function connecting new clients (see connect()) and
+     *              checking for input on open connections; if its argument
+     *              is @c true, it waits until some input is available. It
+     *              returns @c true when new input may be available. Without a
+     *              poll function, this method returns as soon as all
+     *              connections are closed.
+     */
+    void serve (std::function<bool(bool wait)> poll = std::function<bool(bool)>()) {
+      poll_ = poll;
+      while (true) {
+        receiveAvailable_();
+        close_();
+        if (!poll_ && sessions_.empty()) {
+          break;
+        }
+
+        if (queue_.empty()) {
+          // Use idle time before waiting for the next request
+          while (scheduler_ && !readable_() && !(poll_ && poll_ (false))
+                 && scheduler_->idle()) { }
+          wait_();
+          continue;
+        }
+        process_ (next_ (BACKGROUND));
+      }
+    }
+
+    /** @brief Run the command associated to a JSON request
+     *
+     * A @c "pipeline" request runs each request of its @c "steps" array in
+     * turn. Only the output of the last step is printed. In every other step,
+     * string values of the form <tt>"$field.subfield"</tt> are replaced by the
+     * corresponding value in the first JSON object output by the previous
+     * step; the pipeline stops if there is no such value.
+     *
+     * @snippet test_request.cxx Pipeline
+     *
+     * @param json  JSON request
+     * @param cout  output stream where results are printed
+     */
+    void run (const Json::Value & json, std::ostream & cout) {
+      std::string command = json["command"].asString();
+      if (command == "pipeline") {
+        runPipeline_ (json["steps"], cout);
+        return;
+      }
+
+      CommandMap::const_iterator it = commands_.find (command);
+      if (it != commands_.end()) {
+        it->second->parseJson (json, cout);
+      } else {
+        cout << "Unknown command: `" << command << "'" << std::endl;
+      }
+    }
+
+  private:
+    enum Protocol_ { UNKNOWN, FRAMED, JSON };
+
+    struct Session_;
+
+    struct Pending_ {
+      Json::Value json;
+      Cancellation::Clock::time_point received;
+      Session_ * session;
+    };
+
+    struct Session_ {
+      Session_ (std::istream & cin, std::ostream & cout, bool verbose,
+                std::function<bool()> readable, std::function<void()> close,
+                Protocol_ protocol)
+        : cin (cin), cout (cout), verbose (verbose), readable (readable),
+          close (close), protocol (protocol), eof (false), requests (0),
+          client (0)
+      { }
+
+      std::istream & cin;
+      std::ostream & cout;
+      const bool verbose;
+      std::function<bool()> readable;
+      std::function<void()> close;
+      Protocol_ protocol;
+      bool eof;
+      unsigned int requests;  // queued or running
+      unsigned int client;    // id given by the recorder
+    };
+
+    void runPipeline_ (const Json::Value & steps, std::ostream & cout) {
+      // Indexing other JSON values would abort on assertions
+      if (!steps.isArray()) {
+        cout << "Pipeline: `steps' should be an array of requests" << std::endl;
+        return;
+      }
+
+      Json::Value previous;
+      for (unsigned int i = 0 ; i < steps.size() ; ++i) {
+        Json::Value step = steps[i];
+        if (!step.isObject()) {
+          cout << "Pipeline: step " << i << " is not a request" << std::endl;
+          return;
+        }
+        if (i > 0 && !substitute_ (step, previous, cout)) {
+          return;
+        }
+
+        if (i + 1 == steps.size()) {
+          run (step, cout);
+          return;
+        }
+
+        std::ostringstream output;
+        run (step, output);
+        previous = firstObject_ (output.str());
+      }
+    }
+
+    // Replace "$path" values in a request with values from the previous step
+    static bool substitute_ (Json::Value & step, const Json::Value & previous,
+                             std::ostream & cout) {
+      const Json::Value::Members members = step.getMemberNames();
+      for (auto it = members.begin() ; it != members.end() ; ++it) {
+        Json::Value & arg = step[*it];
+        if (!arg.isString() || arg.asString().compare (0, 1, "$") != 0) {
+          continue;
+        }
+
+        const std::string path = arg.asString();
+        Json::Value value = previous;
+        std::istringstream fields (path.substr (1));
+        std::string field;
+        while (value.isObject() && std::getline (fields, field, '.')) {
+          value = value[field];
+        }
+        if (value.isNull() || value.isObject() || !fields.eof()) {
+          cout << "Pipeline: no value for `" << path << "'" << std::endl;
+          return false;
+        }
+        arg = value;
+      }
+      return true;
+    }
+
+    static Json::Value firstObject_ (const std::string & output) {
+      std::istringstream lines (output);
+      std::string line;
+      Json::Reader reader;
+      while (std::getline (lines, line)) {
+        Json::Value json;
+        if (reader.parse (line, json, /*collectComments=*/false) && json.isObject()) {
+          return json;
+        }
+      }
+      return Json::Value();
+    }
+
+    void connect_ (std::istream & cin, std::ostream & cout, bool verbose,
+                   std::function<bool()> readable, std::function<void()> close,
+                   Protocol_ protocol) {
+      if (!readable) {
+        readable = [&cin] () { return cin.rdbuf()->in_avail() > 0; };
+      }
+      sessions_.emplace_back (cin, cout, verbose, readable, close, protocol);
+      if (recorder_)
+        sessions_.back().client = recorder_->connect();
+    }
+
+    // Read one request and queue it. This blocks until a whole request has
+    // been read, or the end of the stream is reached.
+    void receive_ (Session_ & session) {
+      if (session.protocol == UNKNOWN) {
+        const int first = session.cin.peek();
+        if (first == std::char_traits<char>::eof()) {
+          session.eof = true;
+          return;
+        }
+        session.protocol = (first == 0) ? FRAMED : JSON;
+      }
+
+      Pending_ request;
+      if (session.protocol == JSON) {
+        // Legacy clients send only one request per connection
+        session.eof = true;
+        if (!readJson_ (session, request.json)) {
+          return;
+        }
+      } else if (!readFrame_ (session, request.json)) {
+        return;
+      }
+      request.received = received_ (request.json);
+      request.session  = &session;
+
+      if (recorder_)
+        recorder_->record (session.client, request.json);
+
+      ++session.requests;
+      queue_.push_back (request);
+      updateQueued_();
+    }
+
+    bool readJson_ (Session_ & session, Json::Value & json) {
+      if (session.verbose)
         std::cerr << "Receiving client request:" << std::endl;
 
       std::stringstream request;
       while (true) {
         std::string line;
-        std::getline (cin, line);
+        std::getline (session.cin, line);
         if (line == "")
           break;
 
-        if (verbose)
+        if (session.verbose)
           std::cerr << line << std::endl;
 
         request << line << std::endl;
       }
 
-      Json::Value json;
-      request >> json;
+      Json::Reader reader;
+      if (!reader.parse (request, json)) {
+        session.cout << "Server response:" << std::endl
+                     << reader.getFormattedErrorMessages() << std::flush;
+        return false;
+      }
+      return true;
+    }
+
+    bool readFrame_ (Session_ & session, Json::Value & json) {
+      std::string payload;
+      if (!readFrame (session.cin, payload)) {
+        session.eof = true;
+        if (!session.cin.eof()) {
+          // The frame was too large: the rest of the stream can not be read
+          Json::Value end;
+          end["end"]   = true;
+          end["error"] = "Request frame too large";
+          writeFrame (session.cout, end);
+          session.cout.flush();
+        }
+        return false;
+      }
+
+      Json::Reader reader;
+      if (!reader.parse (payload, json)) {
+        Json::Value end;
+        end["end"]   = true;
+        end["error"] = reader.getFormattedErrorMessages();
+        writeFrame (session.cout, end);
+        session.cout.flush();
+        return false;
+      }
+
+      if (session.verbose)
+        std::cerr << "Receiving client request:" << std::endl
+                  << payload << std::endl;
+      return true;
+    }
+
+    // Queue all requests which can be read without blocking
+    void receiveAvailable_ () {
+      for (auto it = sessions_.begin() ; it != sessions_.end() ; ++it) {
+        while (!it->eof && it->readable()) {
+          receive_ (*it);
+        }
+      }
+    }
+
+    bool readable_ () const {
+      for (auto it = sessions_.begin() ; it != sessions_.end() ; ++it) {
+        if (!it->eof && it->readable()) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Wait until a request can be read
+    void wait_ () {
+      if (readable_()) {
+        return;
+      }
+      if (poll_) {
+        poll_ (/*wait=*/true);
+        return;
+      }
+
+      // Without a poll function, only blocking reads can tell when input is
+      // available
+      for (auto it = sessions_.begin() ; it != sessions_.end() ; ++it) {
+        if (!it->eof) {
+          receive_ (*it);
+          return;
+        }
+      }
+    }
+
+    // Close connections whose input ended and whose requests were all
+    // answered
+    void close_ () {
+      auto it = sessions_.begin();
+      while (it != sessions_.end()) {
+        if (it->eof && it->requests == 0) {
+          if (it->close)
+            it->close();
+          it = sessions_.erase (it);
+        } else {
+          ++it;
+        }
+      }
+    }
+
+    Priority priority_ (const Json::Value & json) const {
+      // A pipeline is as urgent as its least urgent step
+      if (json["command"].asString() == "pipeline") {
+        Priority priority = INTERACTIVE;
+        const Json::Value & steps = json["steps"];
+        for (unsigned int i = 0 ; i < steps.size() ; ++i) {
+          priority = std::max (priority, priority_ (steps[i]));
+        }
+        return priority;
+      }
+
+      CommandMap::const_iterator it = commands_.find (json["command"].asString());
+      if (it != commands_.end()) {
+        return it->second->priority_;
+      }
+      return INTERACTIVE;
+    }
+
+    // Remove from the queue the oldest request among those of the highest
+    // priority, not less urgent than maxPriority. The queue must not be empty.
+    Pending_ next_ (Priority maxPriority) {
+      auto best = queue_.end();
+      Priority bestPriority = maxPriority;
+      for (auto it = queue_.begin() ; it != queue_.end() ; ++it) {
+        const Priority priority = scheduler_ ? priority_ (it->json) : INTERACTIVE;
+        if (priority <= maxPriority
+            && (best == queue_.end() || priority < bestPriority)) {
+          best = it;
+          bestPriority = priority;
+        }
+      }
+
+      const Pending_ request = *best;
+      queue_.erase (best);
+      updateQueued_();
+      return request;
+    }
+
+    bool hasPending_ (Priority maxPriority) const {
+      for (auto it = queue_.begin() ; it != queue_.end() ; ++it) {
+        if (priority_ (it->json) <= maxPriority) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void updateQueued_ () {
+      if (!scheduler_) {
+        return;
+      }
+      unsigned int queued[3] = {0, 0, 0};
+      for (auto it = queue_.begin() ; it != queue_.end() ; ++it) {
+        ++queued[priority_ (it->json)];
+      }
+      scheduler_->setQueued (INTERACTIVE, queued[INTERACTIVE]);
+      scheduler_->setQueued (FOCUSED,     queued[FOCUSED]);
+      scheduler_->setQueued (BACKGROUND,  queued[BACKGROUND]);
+    }
+
+    // Connect new clients, and queue all requests which can be read without
+    // blocking
+    void receivePending_ () {
+      if (poll_)
+        poll_ (/*wait=*/false);
+      receiveAvailable_();
+    }
 
-      if (verbose)
+    // Run pending interactive and focused requests, from any connection,
+    // while a background request yields. Their errors have already been
+    // answered, and must not abort the background request; shutdown requests
+    // do.
+    void runPreempting_ () {
+      receivePending_();
+      while (hasPending_ (FOCUSED)) {
+        scheduler_->preempted();
+        try {
+          process_ (next_ (FOCUSED));
+        } catch (Shutdown & e) {
+          throw;
+        } catch (std::exception & e) {
+          std::cerr << "Error in preempting request: " << e.what() << std::endl;
+        }
+        // Legacy clients wait for their connection to be closed
+        close_();
+        receivePending_();
+      }
+    }
+
+    // Run a request and send its response
+    void process_ (const Pending_ & request) {
+      Session_ & session = *request.session;
+      try {
+        if (session.protocol == JSON) {
+          processJson_ (session, request);
+        } else {
+          processFrame_ (session, request);
+        }
+      } catch (...) {
+        --session.requests;
+        throw;
+      }
+      --session.requests;
+    }
+
+    // Legacy protocol: the response is written as plain text
+    void processJson_ (Session_ & session, const Pending_ & request) {
+      std::ostream & cout = session.cout;
+      const Json::Value & json = request.json;
+
+      if (session.verbose)
         std::cerr << "Processing request... ";
       cout << "Server response:" << std::endl << std::flush;
 
-      std::string command = json["command"].asString();
-      CommandMap::const_iterator it = commands_.find (command);
-      if (it != commands_.end()) {
-        it->second->parseJson (json, cout);
-      } else {
-        cout << "Unknown command: `" << command << "'" << std::endl;
+      const Cancellation::Clock::time_point deadline = deadline_ (request);
+      bool expired;
+      if (obsolete_ (json, deadline, expired)) {
+        cout << "Cancelled: " << (expired ? "deadline expired" : "request cancelled")
+             << std::endl;
+        return;
+      }
+
+      try {
+        runMonitored_ (json, deadline, cout);
+      } catch (Cancellation::Cancelled & e) {
+        cout << "Cancelled: " << e.what() << std::endl;
+      } catch (...) {
+        cout.flush();
+        throw;
       }
+      cout.flush();
 
-      if (verbose)
+      if (session.verbose)
         std::cerr << "done." << std::endl << std::endl;
     }
 
-  private:
+    // Framed protocol: the output is streamed as data frames, followed by an
+    // end frame
+    void processFrame_ (Session_ & session, const Pending_ & request) {
+      std::ostream & cout = session.cout;
+      const Json::Value & json = request.json;
+
+      const Json::Value id = json["id"];
+      Json::Value end;
+      end["id"]  = id;
+      end["end"] = true;
+
+      // Drop obsolete requests without running them
+      const Cancellation::Clock::time_point deadline = deadline_ (request);
+      bool expired;
+      if (obsolete_ (json, deadline, expired)) {
+        end[expired ? "expired" : "cancelled"] = true;
+        writeFrame (cout, end);
+        cout.flush();
+        return;
+      }
+
+      if (session.verbose)
+        std::cerr << "Processing request " << id << "... ";
+
+      FrameStreamBuf buffer (cout, id);
+      std::ostream output (&buffer);
+      try {
+        runMonitored_ (json, deadline, output);
+      } catch (Cancellation::Cancelled & e) {
+        end[e.expired ? "expired" : "cancelled"] = true;
+      } catch (std::exception & e) {
+        output.flush();
+        buffer.flushFrame();
+        end["error"] = e.what();
+        writeFrame (cout, end);
+        cout.flush();
+        throw;
+      }
+      output.flush();
+      buffer.flushFrame();
+      writeFrame (cout, end);
+      cout.flush();
+
+      if (session.verbose)
+        std::cerr << "done." << std::endl << std::endl;
+    }
+
+    // Tell whether a request should be dropped without being run
+    bool obsolete_ (const Json::Value & json, Cancellation::Clock::time_point deadline,
+                    bool & expired) {
+      expired = deadline != Cancellation::Clock::time_point()
+        && Cancellation::Clock::now() > deadline;
+      if (!expired && !superseded_ (json)) {
+        return false;
+      }
+      if (cancellation_)
+        cancellation_->drop (expired);
+      return true;
+    }
+
+    // Run a request, monitoring its cancellation. Background requests may let
+    // other requests run when they yield.
+    void runMonitored_ (const Json::Value & json, Cancellation::Clock::time_point deadline,
+                        std::ostream & cout) {
+      if (cancellation_) {
+        cancellation_->begin (deadline, [this, &json] () {
+            receivePending_();
+            return superseded_ (json);
+          });
+      }
+      const bool background = scheduler_ && priority_ (json) == BACKGROUND;
+      if (background) {
+        scheduler_->onYield ([this] () {
+            runPreempting_();
+          });
+      }
+
+      try {
+        run (json, cout);
+      } catch (...) {
+        if (background)
+          scheduler_->onYield (std::function<void()>());
+        if (cancellation_)
+          cancellation_->end();
+        throw;
+      }
+      if (background)
+        scheduler_->onYield (std::function<void()>());
+      if (cancellation_)
+        cancellation_->end();
+    }
+
+    // Requests may tell when they were sent (in milliseconds since the epoch),
+    // so that their deadline also covers the time spent waiting to be read
+    static Cancellation::Clock::time_point received_ (const Json::Value & json) {
+      const Cancellation::Clock::time_point now = Cancellation::Clock::now();
+      const Json::Value & sent = json["sent"];
+      if (!sent.isNumeric()) {
+        return now;
+      }
+
+      typedef std::chrono::system_clock SystemClock;
+      const SystemClock::time_point sentTime
+        (std::chrono::milliseconds ((long long)sent.asDouble()));
+      const SystemClock::duration lag = SystemClock::now() - sentTime;
+      if (lag <= SystemClock::duration::zero()) {
+        return now;
+      }
+      return now - std::chrono::duration_cast<Cancellation::Clock::duration> (lag);
+    }
+
+    Cancellation::Clock::time_point deadline_ (const Pending_ & request) const {
+      const Json::Value & deadline = request.json["deadline"];
+      if (!deadline.isNumeric() || deadline.asInt() <= 0) {
+        return Cancellation::Clock::time_point();
+      }
+      return request.received + std::chrono::milliseconds (deadline.asInt());
+    }
+
+    // A request is superseded by any newer request with the same cancelKey,
+    // from any connection
+    bool superseded_ (const Json::Value & json) const {
+      const std::string key = json["cancelKey"].asString();
+      if (key == "") {
+        return false;
+      }
+      for (auto it = queue_.begin() ; it != queue_.end() ; ++it) {
+        if (it->json["cancelKey"].asString() == key) {
+          return true;
+        }
+      }
+      return false;
+    }
+
     typedef std::map<std::string, CommandParser*> CommandMap;
     CommandMap  commands_;
     std::string description_;
     std::string prompt_;
     bool        echo_;
+    Cancellation * cancellation_;
+    Scheduler    * scheduler_;
+    Recorder     * recorder_;
+    std::list<Session_> sessions_;
+    std::deque<Pending_> queue_;
+    std::function<bool(bool)> poll_;
   };
 
   /** @brief Helper function to create @ref KeyParserBase "key parsers"
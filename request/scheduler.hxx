@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+
+namespace Request {
+  /** @addtogroup request
+      @{
+  */
+
+  /** @brief Priority classes, from most to least urgent
+   */
+  enum Priority {
+    INTERACTIVE = 0,  /**< @brief editor requests (find, complete...) */
+    FOCUSED     = 1,  /**< @brief work on files recently used in the editor (warm...) */
+    BACKGROUND  = 2   /**< @brief bulk work (indexing...) */
+  };
+
+  /** @brief Cooperative scheduling of requests by priority
+   *
+   * Pending requests are run by order of priority (see Parser::serve).
+   * Long-running background requests call yield() between steps, which lets
+   * pending interactive and focused requests run before the background work
+   * resumes.
+   *
+   * The scheduler also keeps track of the files recently queried by
+   * interactive requests, so that background work can handle them first, and
+   * runs idle-time work while no request is pending.
+   */
+  class Scheduler {
+  public:
+    /** @brief Scheduling statistics */
+    struct Stats {
+      unsigned int queued[3];   /**< @brief queued requests, per priority class */
+      unsigned int yields;      /**< @brief calls to yield() which ran other requests */
+      unsigned int preempted;   /**< @brief requests run while a background request yielded */
+    };
+
+    Scheduler () {
+      std::fill (stats_.queued, stats_.queued+3, 0);
+      stats_.yields    = 0;
+      stats_.preempted = 0;
+    }
+
+    /** @brief Let pending interactive and focused requests run
+     *
+     * This is meant to be called by background requests, between steps where
+     * it is safe to run other requests. In particular, no transaction should
+     * be open: requests run meanwhile may write to the index themselves.
+     * Pending requests may come from any client connection. Errors in these
+     * requests are answered to their clients, and do not propagate to the
+     * caller, except Request::Shutdown.
+     */
+    void yield () {
+      if (!yield_) {
+        return;
+      }
+      const unsigned int preempted = stats_.preempted;
+      yield_();
+      if (stats_.preempted > preempted) {
+        ++stats_.yields;
+      }
+    }
+
+    /** @brief Set the function called by yield()
+     *
+     * @param fun  function running pending preempting requests, or an empty
+     *             function to disable yielding
+     */
+    void onYield (std::function<void()> fun) {
+      yield_ = fun;
+    }
+
+    /** @brief Perform one step of idle-time work
+     *
+     * This is meant to be called when no request is pending, repeatedly until
+     * a request arrives or there is nothing left to do.
+     *
+     * @return @c true if some work was done
+     */
+    bool idle () {
+      return idle_ && idle_();
+    }
+
+    /** @brief Set the function called by idle()
+     *
+     * @param fun  function performing a short step of background work, and
+     *             returning @c false when there is nothing to do
+     */
+    void onIdle (std::function<bool()> fun) {
+      idle_ = fun;
+    }
+
+    /** @brief Update the number of queued requests in a priority class
+     */
+    void setQueued (Priority priority, unsigned int count) {
+      stats_.queued[priority] = count;
+    }
+
+    /** @brief Record a request run while a background request yielded
+     */
+    void preempted () {
+      ++stats_.preempted;
+    }
+
+    /** @brief Record a file queried by an interactive request
+     *
+     * @param fileName  full path to the file
+     */
+    void focus (const std::string & fileName) {
+      auto it = std::find (focused_.begin(), focused_.end(), fileName);
+      if (it != focused_.end()) {
+        focused_.erase (it);
+      }
+      focused_.push_front (fileName);
+      if (focused_.size() > maxFocused_) {
+        focused_.pop_back();
+      }
+    }
+
+    /** @brief Get recently focused files, most recent first
+     */
+    const std::deque<std::string> & focused () const {
+      return focused_;
+    }
+
+    /** @brief Get scheduling statistics
+     */
+    const Stats & stats () const {
+      return stats_;
+    }
+
+  private:
+    enum { maxFocused_ = 16 };
+
+    std::function<void()> yield_;
+    std::function<bool()> idle_;
+    std::deque<std::string> focused_;
+    Stats stats_;
+  };
+
+  /** @} */
+}
@@ -4,6 +4,8 @@
  * application handling requests.
  */
 #include "request/request.hxx"
+#include <cstdio>
+#include <fstream>
 #include <sstream>
 
 //! [CommandParser]
@@ -52,6 +54,46 @@ private:
 //! [CommandParser]
 
 
+//! [Background]
+/** @brief Example background command */
+class Steps : public CommandParser {
+public:
+  /** @brief Constructor
+   *  @param name       command name
+   *  @param scheduler  scheduler, used to let interactive requests run
+   */
+  Steps (std::string name, Request::Scheduler & scheduler)
+    : CommandParser (name, "run a long background task"),
+      scheduler_ (scheduler)
+  {
+    // Interactive requests run first
+    priority_ = Request::BACKGROUND;
+    defaults ();
+
+    add (key ("steps", steps_)
+         ->metavar ("N")
+         ->description ("number of steps"));
+  }
+
+  void defaults () {
+    steps_ = 2;
+  }
+
+  void run (std::ostream & cout) {
+    for (int i=0 ; i<steps_ ; ++i) {
+      // Let pending interactive requests run between steps
+      scheduler_.yield();
+      cout << "step " << i << std::endl;
+    }
+  }
+
+private:
+  Request::Scheduler & scheduler_;
+  int steps_;
+};
+//! [Background]
+
+
 int main () {
   //![Parser]
   using Request::Parser;
@@ -59,8 +101,10 @@ int main () {
 
 
   // Create the command parser
+  Request::Scheduler scheduler;
   Parser p ("Example application");
   p .add (new Repeat ("repeat"))
+    .add (new Steps ("steps", scheduler))
     .prompt ("Command> ")
     .echo ();
 
@@ -84,5 +128,131 @@ int main () {
   //![Parser]
 
 
+  //![Frames]
+  // Send framed JSON requests, as a persistent client would
+  std::stringstream frames;
+  Json::Value request;
+  request["id"]      = 0;
+  request["command"] = "steps";
+  Request::writeFrame (frames, request);
+
+  request["id"]      = 1;
+  request["command"] = "repeat";
+  request["times"]   = 3;
+  request["input"]   = "bar";
+  Request::writeFrame (frames, request);
+
+  request["id"]      = 2;
+  request["command"] = "unknown";
+  Request::writeFrame (frames, request);
+
+  // Requests sharing a cancellation key supersede one another: request 3 is
+  // dropped because request 4 is already queued when it gets processed
+  request["command"]   = "repeat";
+  request["cancelKey"] = "key";
+  request["id"]        = 3;
+  Request::writeFrame (frames, request);
+  request["id"]        = 4;
+  Request::writeFrame (frames, request);
+
+  // Handle requests and decode response frames. Since a scheduler is set, the
+  // background request 0 runs after all interactive requests.
+  std::stringstream responses;
+  Request::Cancellation cancellation;
+  p.cancellation (cancellation)
+   .scheduler (scheduler);
+  p.parseFrames (frames, responses);
+
+  std::string payload;
+  while (Request::readFrame (responses, payload)) {
+    std::cout << payload << std::endl;
+  }
+  std::cout << "Cancelled requests: " << cancellation.stats().cancelled << std::endl;
+
+  // Frames larger than Request::maxFrameSize are rejected without reading
+  // their payload, which ends the session
+  std::stringstream large;
+  large.write ("\xff\xff\xff\xff", 4);
+  std::stringstream largeResponses;
+  p.parseFrames (large, largeResponses);
+  while (Request::readFrame (largeResponses, payload)) {
+    std::cout << payload << std::endl;
+  }
+
+  // Several connections are served together: the request of the second
+  // connection runs first, since it is more urgent
+  std::stringstream first, second, shared;
+  request = Json::Value();
+  request["id"]      = 5;
+  request["command"] = "steps";
+  Request::writeFrame (first, request);
+  request["id"]      = 6;
+  request["command"] = "repeat";
+  request["times"]   = 1;
+  request["input"]   = "second";
+  Request::writeFrame (second, request);
+  p.connect (first, shared, /*verbose=*/false);
+  p.connect (second, shared, /*verbose=*/false);
+  p.serve();
+  while (Request::readFrame (shared, payload)) {
+    std::cout << payload << std::endl;
+  }
+  //![Frames]
+
+
+  //![Pipeline]
+  // The first step outputs a JSON object, whose "text" field is fed to the
+  // second step
+  Json::Value pipeline;
+  pipeline["command"] = "pipeline";
+  pipeline["steps"][0]["command"] = "repeat";
+  pipeline["steps"][0]["times"]   = 1;
+  pipeline["steps"][0]["input"]   = "{\"text\": \"baz\"}";
+  pipeline["steps"][1]["command"] = "repeat";
+  pipeline["steps"][1]["input"]   = "$text";
+  p.run (pipeline, std::cout);
+
+  // Malformed pipelines are reported as errors
+  pipeline["steps"][1] = "repeat";
+  p.run (pipeline, std::cout);
+  pipeline["steps"] = "repeat";
+  p.run (pipeline, std::cout);
+  //![Pipeline]
+
+
+  //![Recorder]
+  // Record incoming requests, one line per request, tagged with their
+  // reception time and client connection
+  const std::string logName = "test_request.log";
+  std::remove (logName.c_str());
+  Request::Recorder recorder (logName);
+  p.recorder (recorder);
+
+  std::stringstream recorded;
+  request = Json::Value();
+  request["command"] = "repeat";
+  request["times"]   = 1;
+  request["input"]   = "recorded";
+  for (int id = 1 ; id <= 2 ; ++id) {
+    request["id"] = id;
+    Request::writeFrame (recorded, request);
+  }
+  std::stringstream recordedResponses;
+  p.parseFrames (recorded, recordedResponses);
+
+  std::ifstream log (logName.c_str());
+  std::string line;
+  while (std::getline (log, line)) {
+    Json::Value entry;
+    Json::Reader().parse (line, entry);
+    std::cout << "client " << entry["client"].asUInt()
+              << ": " << entry["request"]["command"].asString()
+              << " #" << entry["request"]["id"].asInt() << std::endl;
+  }
+  log.close();
+  std::remove (logName.c_str());
+  //![Recorder]
+
+
   return 0;
 }
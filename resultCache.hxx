@@ -0,0 +1,175 @@
+#pragma once
+
+#include "storage.hxx"
+
+#include <algorithm>
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/** @brief Memory-limited cache of index query results
+ *
+ * Results are stored as the text output by a request, keyed by a normalized
+ * form of the request. Each entry records the index generation at which it
+ * was computed, along with the files and USRs it depends on. An entry is
+ * valid as long as none of its dependencies changed in the index since then
+ * (see Storage::generation()). Entries may also depend on the include graph
+ * as a whole (see Storage::includesGeneration()).
+ *
+ * Results larger than a given size are not stored. When the memory limit is
+ * exceeded, the least recently used entries are discarded.
+ */
+class ResultCache {
+public:
+  /** @brief Files and USRs whose tags a result depends on */
+  struct Dependencies {
+    std::set<std::string> files;
+    std::set<std::string> usrs;
+    bool                  includes;  /**< @brief depends on the include graph */
+
+    Dependencies ()
+      : includes (false)
+    { }
+  };
+
+  /** @brief Cache statistics */
+  struct Stats {
+    unsigned int  hits;
+    unsigned int  misses;
+    unsigned int  invalidated;  /**< @brief entries found out of date */
+    unsigned int  entries;
+    unsigned long memory;       /**< @brief estimated memory usage, in bytes */
+  };
+
+  /** @brief Constructor
+   *
+   * @param memoryLimit  maximum memory usage of the cache (in bytes)
+   * @param entryLimit   maximum memory usage of a single entry (in bytes)
+   */
+  ResultCache (unsigned long memoryLimit, unsigned long entryLimit)
+    : memoryLimit_ (memoryLimit),
+      entryLimit_ (std::min (entryLimit, memoryLimit))
+  {
+    stats_.hits        = 0;
+    stats_.misses      = 0;
+    stats_.invalidated = 0;
+    stats_.entries     = 0;
+    stats_.memory      = 0;
+  }
+
+  /** @brief Look up a valid result
+   *
+   * @param key      normalized request
+   * @param storage  index storage, used to check the validity of the entry
+   * @param output   where the cached result is copied
+   *
+   * @return @c true if a valid result was found
+   */
+  bool get (const std::string & key, const Storage & storage, std::string & output) {
+    auto it = entries_.find (key);
+    if (it == entries_.end()) {
+      ++stats_.misses;
+      return false;
+    }
+
+    if (!valid_ (it->second, storage)) {
+      ++stats_.invalidated;
+      ++stats_.misses;
+      erase_ (it);
+      return false;
+    }
+
+    ++stats_.hits;
+    lru_.splice (lru_.end(), lru_, it->second.lru);
+    output = it->second.output;
+    return true;
+  }
+
+  /** @brief Store a result
+   *
+   * @param key           normalized request
+   * @param output        request output
+   * @param dependencies  files and USRs the output depends on
+   * @param generation    index generation at which the output was computed
+   */
+  void insert (const std::string & key, const std::string & output,
+               const Dependencies & dependencies, unsigned long generation) {
+    auto it = entries_.find (key);
+    if (it != entries_.end()) {
+      erase_ (it);
+    }
+
+    Entry_ entry;
+    entry.output       = output;
+    entry.dependencies = dependencies;
+    entry.generation   = generation;
+    entry.memory       = key.size() + output.size();
+    for (auto file = dependencies.files.begin() ; file != dependencies.files.end() ; ++file) {
+      entry.memory += file->size();
+    }
+    for (auto usr = dependencies.usrs.begin() ; usr != dependencies.usrs.end() ; ++usr) {
+      entry.memory += usr->size();
+    }
+
+    // Large results would evict many smaller ones
+    if (entry.memory > entryLimit_) {
+      return;
+    }
+    while (stats_.memory + entry.memory > memoryLimit_ && !lru_.empty()) {
+      erase_ (entries_.find (lru_.front()));
+    }
+
+    entry.lru = lru_.insert (lru_.end(), key);
+    stats_.memory += entry.memory;
+    ++stats_.entries;
+    entries_.insert (std::make_pair (key, entry));
+  }
+
+  /** @brief Get cache statistics
+   */
+  const Stats & stats () const {
+    return stats_;
+  }
+
+private:
+  struct Entry_ {
+    std::string                      output;
+    Dependencies                     dependencies;
+    unsigned long                    generation;
+    unsigned long                    memory;
+    std::list<std::string>::iterator lru;
+  };
+  typedef std::unordered_map<std::string, Entry_> EntryMap_;
+
+  static bool valid_ (const Entry_ & entry, const Storage & storage) {
+    const Dependencies & dependencies = entry.dependencies;
+    if (dependencies.includes && storage.includesGeneration() > entry.generation) {
+      return false;
+    }
+    for (auto file = dependencies.files.begin() ; file != dependencies.files.end() ; ++file) {
+      if (storage.fileGeneration (*file) > entry.generation) {
+        return false;
+      }
+    }
+    for (auto usr = dependencies.usrs.begin() ; usr != dependencies.usrs.end() ; ++usr) {
+      if (storage.usrGeneration (*usr) > entry.generation) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void erase_ (EntryMap_::iterator it) {
+    stats_.memory -= it->second.memory;
+    --stats_.entries;
+    lru_.erase (it->second.lru);
+    entries_.erase (it);
+  }
+
+  const unsigned long memoryLimit_;
+  const unsigned long entryLimit_;
+  EntryMap_ entries_;
+  std::list<std::string> lru_;
+  Stats stats_;
+};
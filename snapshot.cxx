@@ -0,0 +1,852 @@
+#include "snapshot.hxx"
+#include "util/util.hxx"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
+
+static const char MAGIC[8] = {'C', 'T', 'S', 'N', 'A', 'P', 0, 0};
+
+struct Snapshot::Header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t fileCount;
+  uint32_t symbolCount;
+  uint32_t refCount;
+  uint32_t includeCount;
+  uint32_t callCount;
+  uint32_t baseCount;
+  uint32_t root;
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+  uint64_t filesOffset;
+  uint64_t symbolsOffset;
+  uint64_t refsOffset;
+  uint64_t symbolRefsOffset;
+  uint64_t includesOffset;
+  uint64_t callsOffset;
+  uint64_t basesOffset;
+};
+
+struct Snapshot::FileEntry {
+  uint32_t name;
+  uint32_t refBegin;
+  uint32_t refEnd;
+  uint32_t includeBegin;
+  uint32_t includeEnd;
+};
+
+struct Snapshot::SymbolEntry {
+  uint32_t usr;
+  uint32_t spelling;
+  uint32_t kind;
+  uint32_t refBegin;
+  uint32_t refEnd;
+};
+
+struct Snapshot::RefEntry {
+  enum { DECLARATION = 1, VIRTUAL = 2 };
+  uint32_t file;
+  uint32_t symbol;
+  uint32_t kind;
+  uint32_t spelling;
+  uint32_t line1;
+  uint32_t col1;
+  uint32_t offset1;
+  uint32_t line2;
+  uint32_t col2;
+  uint32_t offset2;
+  uint32_t flags;
+};
+
+struct Snapshot::IncludeEntry {
+  uint32_t source;
+  uint32_t included;
+};
+
+struct Snapshot::EdgeEntry {
+  uint32_t from;
+  uint32_t to;
+};
+
+
+namespace {
+  /* Deduplicated pool of NUL-terminated strings */
+  class StringPool {
+  public:
+    uint32_t add (const std::string & s) {
+      auto it = index_.find (s);
+      if (it != index_.end()) {
+        return it->second;
+      }
+
+      uint32_t offset = data_.size();
+      data_.append (s);
+      data_.push_back ('\0');
+      index_[s] = offset;
+      return offset;
+    }
+
+    const std::string & data () const {
+      return data_;
+    }
+
+  private:
+    std::string data_;
+    std::unordered_map<std::string, uint32_t> index_;
+  };
+
+  /* Longest common directory of a set of absolute paths */
+  std::string commonDirectory (const std::vector<std::string> & paths) {
+    if (paths.empty()) {
+      return "";
+    }
+
+    std::string prefix = paths[0].substr (0, paths[0].rfind ('/'));
+    for (auto it = paths.begin() ; it != paths.end() ; ++it) {
+      while (prefix != ""
+             && (it->compare (0, prefix.size(), prefix) != 0
+                 || (*it)[prefix.size()] != '/')) {
+        prefix = prefix.substr (0, prefix.rfind ('/'));
+      }
+    }
+    return prefix;
+  }
+
+  uint64_t align (uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+  }
+
+  /* Whether a section of COUNT entries of SIZE bytes, starting at OFFSET,
+     lies within a file of FILESIZE bytes (without overflowing) */
+  bool inFile (uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize) {
+    return offset <= fileSize
+      && offset % 4 == 0
+      && count <= (fileSize - offset) / size;
+  }
+
+  template <typename T>
+  void writeSection (std::ofstream & out, const std::vector<T> & v, uint64_t offset) {
+    out.seekp (offset);
+    if (!v.empty()) {
+      out.write (reinterpret_cast<const char*> (&v[0]), v.size() * sizeof(T));
+    }
+  }
+}
+
+
+std::string Snapshot::sourceRoot (Storage & storage) {
+  return commonDirectory (storage.sourceFiles());
+}
+
+std::string Snapshot::write (Storage & storage,
+                             const std::string & fileName,
+                             const std::string & rootDir) {
+  std::string root = rootDir;
+  if (root == "") {
+    root = sourceRoot (storage);
+  } else {
+    char * canonicalPath = realpath (root.c_str(), NULL);
+    if (canonicalPath == NULL) {
+      throw std::runtime_error ("Cannot resolve snapshot root `" + root + "'");
+    }
+    root = canonicalPath;
+    free (canonicalPath);
+  }
+
+  StringPool strings;
+  Header header;
+  std::memset (&header, 0, sizeof(header));
+  std::memcpy (header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.root = strings.add (root);
+
+  // Files, sorted by (root-relative) name
+  std::vector<Storage::File> dbFiles = storage.files();
+  for (auto it = dbFiles.begin() ; it != dbFiles.end() ; ++it) {
+    if (root != "" && String(it->name).startsWith (root + "/")) {
+      it->name = it->name.substr (root.size() + 1);
+    }
+  }
+  std::sort (dbFiles.begin(), dbFiles.end(),
+             [](const Storage::File & a, const Storage::File & b) {
+               return a.name < b.name;
+             });
+
+  std::map<int, uint32_t> fileIndex;
+  std::vector<FileEntry> files (dbFiles.size());
+  for (uint32_t i = 0 ; i < dbFiles.size() ; ++i) {
+    fileIndex[dbFiles[i].id] = i;
+    files[i].name = strings.add (dbFiles[i].name);
+  }
+
+  // References, grouped by file and sorted by offset. Symbols get temporary
+  // ids, which are remapped once all USRs are known.
+  std::unordered_map<std::string, uint32_t> symbolIds;
+  std::vector<SymbolEntry> symbols;
+  auto symbolId = [&] (const std::string & usr,
+                       const std::string & kind, const std::string & spelling) {
+    auto symbol = symbolIds.find (usr);
+    if (symbol == symbolIds.end()) {
+      symbol = symbolIds.insert (std::make_pair (usr, symbols.size())).first;
+      SymbolEntry entry;
+      entry.usr      = strings.add (usr);
+      entry.spelling = strings.add (spelling);
+      entry.kind     = strings.add (kind);
+      entry.refBegin = entry.refEnd = 0;
+      symbols.push_back (entry);
+    }
+    return symbol->second;
+  };
+
+  std::vector<RefEntry> refs;
+  for (uint32_t i = 0 ; i < dbFiles.size() ; ++i) {
+    files[i].refBegin = refs.size();
+
+    const std::vector<Storage::Tag> tags = storage.fileTags (dbFiles[i].id);
+    for (auto tag = tags.begin() ; tag != tags.end() ; ++tag) {
+      RefEntry ref;
+      ref.file     = i;
+      ref.symbol   = symbolId (tag->usr, tag->kind, tag->spelling);
+      ref.kind     = strings.add (tag->kind);
+      ref.spelling = strings.add (tag->spelling);
+      ref.line1    = tag->line1;
+      ref.col1     = tag->col1;
+      ref.offset1  = tag->offset1;
+      ref.line2    = tag->line2;
+      ref.col2     = tag->col2;
+      ref.offset2  = tag->offset2;
+      ref.flags    = (tag->isDecl    ? RefEntry::DECLARATION : 0)
+                   | (tag->isVirtual ? RefEntry::VIRTUAL     : 0);
+      refs.push_back (ref);
+    }
+
+    files[i].refEnd = refs.size();
+  }
+
+  // Call graph and class hierarchy. Their symbols may not have any reference
+  // (e.g. when they are declared in excluded paths).
+  std::vector<EdgeEntry> calls;
+  std::vector<EdgeEntry> bases;
+  {
+    enum { chunk = 100000 };
+    auto addEdge = [&] (std::vector<EdgeEntry> & edges,
+                        const std::string & from, const std::string & to) {
+      EdgeEntry edge;
+      edge.from = symbolId (from, "", "");
+      edge.to   = symbolId (to,   "", "");
+      edges.push_back (edge);
+    };
+    for (int cursor = 0 ; cursor != -1 ; ) {
+      cursor = storage.calls (cursor, chunk,
+                              [&] (const std::string & caller, const std::string & callee) {
+                                addEdge (calls, caller, callee);
+                              });
+    }
+    for (int cursor = 0 ; cursor != -1 ; ) {
+      cursor = storage.bases (cursor, chunk,
+                              [&] (const std::string & usr, const std::string & base) {
+                                addEdge (bases, usr, base);
+                              });
+    }
+  }
+
+  // Sort symbols by USR and remap references
+  std::vector<uint32_t> order (symbols.size());
+  for (uint32_t i = 0 ; i < order.size() ; ++i) {
+    order[i] = i;
+  }
+  const std::string & pool = strings.data();
+  std::sort (order.begin(), order.end(),
+             [&](uint32_t a, uint32_t b) {
+               return std::strcmp (&pool[symbols[a].usr], &pool[symbols[b].usr]) < 0;
+             });
+  std::vector<uint32_t> newId (symbols.size());
+  std::vector<SymbolEntry> sortedSymbols (symbols.size());
+  for (uint32_t i = 0 ; i < order.size() ; ++i) {
+    newId[order[i]] = i;
+    sortedSymbols[i] = symbols[order[i]];
+  }
+  symbols.swap (sortedSymbols);
+
+  // Per-symbol reference lists (counting sort)
+  for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+    ref->symbol = newId[ref->symbol];
+    ++symbols[ref->symbol].refEnd;
+  }
+  uint32_t total = 0;
+  for (auto symbol = symbols.begin() ; symbol != symbols.end() ; ++symbol) {
+    symbol->refBegin = total;
+    total += symbol->refEnd;
+    symbol->refEnd = symbol->refBegin;
+  }
+  std::vector<uint32_t> symbolRefs (refs.size());
+  for (uint32_t i = 0 ; i < refs.size() ; ++i) {
+    SymbolEntry & symbol = symbols[refs[i].symbol];
+    symbolRefs[symbol.refEnd++] = i;
+  }
+
+  // Edges, remapped and sorted
+  auto remapEdges = [&] (std::vector<EdgeEntry> & edges) {
+    for (auto edge = edges.begin() ; edge != edges.end() ; ++edge) {
+      edge->from = newId[edge->from];
+      edge->to   = newId[edge->to];
+    }
+    std::sort (edges.begin(), edges.end(),
+               [](const EdgeEntry & a, const EdgeEntry & b) {
+                 return a.from < b.from || (a.from == b.from && a.to < b.to);
+               });
+    edges.erase (std::unique (edges.begin(), edges.end(),
+                              [](const EdgeEntry & a, const EdgeEntry & b) {
+                                return a.from == b.from && a.to == b.to;
+                              }),
+                 edges.end());
+  };
+  remapEdges (calls);
+  remapEdges (bases);
+
+  // Include graph, sorted by source file
+  std::vector<IncludeEntry> includes;
+  {
+    const std::vector<std::pair<int, int> > dbIncludes = storage.includes();
+    for (auto it = dbIncludes.begin() ; it != dbIncludes.end() ; ++it) {
+      auto source   = fileIndex.find (it->first);
+      auto included = fileIndex.find (it->second);
+      if (source == fileIndex.end() || included == fileIndex.end()) {
+        continue;
+      }
+      IncludeEntry entry;
+      entry.source   = source->second;
+      entry.included = included->second;
+      includes.push_back (entry);
+    }
+    std::sort (includes.begin(), includes.end(),
+               [](const IncludeEntry & a, const IncludeEntry & b) {
+                 return a.source < b.source
+                   || (a.source == b.source && a.included < b.included);
+               });
+    includes.erase (std::unique (includes.begin(), includes.end(),
+                                 [](const IncludeEntry & a, const IncludeEntry & b) {
+                                   return a.source == b.source && a.included == b.included;
+                                 }),
+                    includes.end());
+
+    for (auto file = files.begin() ; file != files.end() ; ++file) {
+      file->includeBegin = file->includeEnd = 0;
+    }
+    for (uint32_t i = includes.size() ; i > 0 ; --i) {
+      FileEntry & file = files[includes[i-1].source];
+      if (file.includeEnd == 0) {
+        file.includeEnd = i;
+      }
+      file.includeBegin = i-1;
+    }
+  }
+
+  // Layout
+  header.fileCount        = files.size();
+  header.symbolCount      = symbols.size();
+  header.refCount         = refs.size();
+  header.includeCount     = includes.size();
+  header.callCount        = calls.size();
+  header.baseCount        = bases.size();
+  header.stringsOffset    = align (sizeof(Header));
+  header.stringsSize      = pool.size();
+  header.filesOffset      = align (header.stringsOffset + header.stringsSize);
+  header.symbolsOffset    = align (header.filesOffset + files.size() * sizeof(FileEntry));
+  header.refsOffset       = align (header.symbolsOffset + symbols.size() * sizeof(SymbolEntry));
+  header.symbolRefsOffset = align (header.refsOffset + refs.size() * sizeof(RefEntry));
+  header.includesOffset   = align (header.symbolRefsOffset + symbolRefs.size() * sizeof(uint32_t));
+  header.callsOffset      = align (header.includesOffset + includes.size() * sizeof(IncludeEntry));
+  header.basesOffset      = align (header.callsOffset + calls.size() * sizeof(EdgeEntry));
+  const uint64_t size     = align (header.basesOffset + bases.size() * sizeof(EdgeEntry));
+
+  // Write to a temporary file first, so that a server mapping the previous
+  // snapshot never sees a partially written file.
+  const std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out (tmpName.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error ("Cannot open `" + tmpName + "' for writing");
+    }
+
+    out.write (reinterpret_cast<const char*> (&header), sizeof(header));
+    out.seekp (header.stringsOffset);
+    out.write (pool.data(), pool.size());
+    writeSection (out, files,      header.filesOffset);
+    writeSection (out, symbols,    header.symbolsOffset);
+    writeSection (out, refs,       header.refsOffset);
+    writeSection (out, symbolRefs, header.symbolRefsOffset);
+    writeSection (out, includes,   header.includesOffset);
+    writeSection (out, calls,      header.callsOffset);
+    writeSection (out, bases,      header.basesOffset);
+
+    // Pad the file up to its expected size
+    out.seekp (size - 1);
+    out.put ('\0');
+
+    if (!out) {
+      throw std::runtime_error ("Error while writing `" + tmpName + "'");
+    }
+  }
+
+  if (rename (tmpName.c_str(), fileName.c_str()) != 0) {
+    throw std::runtime_error ("Cannot rename `" + tmpName + "' to `" + fileName + "'");
+  }
+
+  return root;
+}
+
+
+Snapshot::Snapshot (const std::string & fileName, const std::string & root)
+  : data_ (MAP_FAILED),
+    size_ (0)
+{
+  int fd = open (fileName.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error ("Cannot open snapshot `" + fileName + "'");
+  }
+
+  struct stat fileStat;
+  if (fstat (fd, &fileStat) == 0) {
+    size_ = fileStat.st_size;
+  }
+
+  if (size_ >= sizeof(Header)) {
+    data_ = mmap (NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close (fd);
+
+  if (data_ == MAP_FAILED) {
+    throw std::runtime_error ("Cannot map snapshot `" + fileName + "'");
+  }
+
+  const char * base = static_cast<const char*> (data_);
+  header_ = reinterpret_cast<const Header*> (base);
+
+  // Every section must lie within the file, and strings must be terminated
+  const Header & h = *header_;
+  if (std::memcmp (h.magic, MAGIC, sizeof(MAGIC)) != 0
+      || h.version != VERSION
+      || !inFile (h.stringsOffset,    h.stringsSize,  1,                    size_)
+      || !inFile (h.filesOffset,      h.fileCount,    sizeof(FileEntry),    size_)
+      || !inFile (h.symbolsOffset,    h.symbolCount,  sizeof(SymbolEntry),  size_)
+      || !inFile (h.refsOffset,       h.refCount,     sizeof(RefEntry),     size_)
+      || !inFile (h.symbolRefsOffset, h.refCount,     sizeof(uint32_t),     size_)
+      || !inFile (h.includesOffset,   h.includeCount, sizeof(IncludeEntry), size_)
+      || !inFile (h.callsOffset,      h.callCount,    sizeof(EdgeEntry),    size_)
+      || !inFile (h.basesOffset,      h.baseCount,    sizeof(EdgeEntry),    size_)
+      || h.stringsSize == 0
+      || base[h.stringsOffset + h.stringsSize - 1] != '\0'
+      || h.root >= h.stringsSize) {
+    munmap (data_, size_);
+    throw std::runtime_error ("Invalid or incompatible snapshot `" + fileName + "'");
+  }
+
+  strings_    = base + header_->stringsOffset;
+  files_      = reinterpret_cast<const FileEntry*>    (base + header_->filesOffset);
+  symbols_    = reinterpret_cast<const SymbolEntry*>  (base + header_->symbolsOffset);
+  refs_       = reinterpret_cast<const RefEntry*>     (base + header_->refsOffset);
+  symbolRefs_ = reinterpret_cast<const uint32_t*>     (base + header_->symbolRefsOffset);
+  includes_   = reinterpret_cast<const IncludeEntry*> (base + header_->includesOffset);
+  calls_      = reinterpret_cast<const EdgeEntry*>    (base + header_->callsOffset);
+  bases_      = reinterpret_cast<const EdgeEntry*>    (base + header_->basesOffset);
+
+  if (!validRecords_()) {
+    munmap (data_, size_);
+    throw std::runtime_error ("Corrupted snapshot `" + fileName + "'");
+  }
+
+  root_ = (root == "") ? string_ (header_->root) : root;
+}
+
+bool Snapshot::validRecords_ () const {
+  // Accessors trust the strings and indices stored in records: check all of
+  // them once and for all
+  const Header & h = *header_;
+  for (uint32_t i = 0 ; i < h.fileCount ; ++i) {
+    const FileEntry & file = files_[i];
+    if (file.name >= h.stringsSize
+        || file.refBegin > file.refEnd || file.refEnd > h.refCount
+        || file.includeBegin > file.includeEnd || file.includeEnd > h.includeCount) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0 ; i < h.symbolCount ; ++i) {
+    const SymbolEntry & symbol = symbols_[i];
+    if (symbol.usr >= h.stringsSize || symbol.spelling >= h.stringsSize
+        || symbol.kind >= h.stringsSize
+        || symbol.refBegin > symbol.refEnd || symbol.refEnd > h.refCount) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0 ; i < h.refCount ; ++i) {
+    const RefEntry & ref = refs_[i];
+    if (ref.file >= h.fileCount || ref.symbol >= h.symbolCount
+        || ref.kind >= h.stringsSize || ref.spelling >= h.stringsSize
+        || symbolRefs_[i] >= h.refCount) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0 ; i < h.includeCount ; ++i) {
+    if (includes_[i].source >= h.fileCount || includes_[i].included >= h.fileCount) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0 ; i < h.callCount ; ++i) {
+    if (calls_[i].from >= h.symbolCount || calls_[i].to >= h.symbolCount) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0 ; i < h.baseCount ; ++i) {
+    if (bases_[i].from >= h.symbolCount || bases_[i].to >= h.symbolCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Snapshot::~Snapshot () {
+  munmap (data_, size_);
+}
+
+const char * Snapshot::string_ (uint32_t offset) const {
+  return strings_ + offset;
+}
+
+std::string Snapshot::fileName_ (uint32_t fileIndex) const {
+  const char * name = string_ (files_[fileIndex].name);
+  if (name[0] == '/' || root_ == "") {
+    return name;
+  }
+  return root_ + "/" + name;
+}
+
+int Snapshot::findFile_ (const std::string & fileName) const {
+  std::string name = fileName;
+  if (root_ != "" && String(name).startsWith (root_ + "/")) {
+    name = name.substr (root_.size() + 1);
+  }
+
+  const FileEntry * begin = files_;
+  const FileEntry * end   = files_ + header_->fileCount;
+  const FileEntry * it = std::lower_bound (begin, end, name,
+                                           [this](const FileEntry & file, const std::string & name) {
+                                             return std::strcmp (string_ (file.name), name.c_str()) < 0;
+                                           });
+  if (it == end || name != string_ (it->name)) {
+    return -1;
+  }
+  return it - begin;
+}
+
+int Snapshot::findSymbol_ (const std::string & usr) const {
+  const SymbolEntry * begin = symbols_;
+  const SymbolEntry * end   = symbols_ + header_->symbolCount;
+  const SymbolEntry * it = std::lower_bound (begin, end, usr,
+                                             [this](const SymbolEntry & symbol, const std::string & usr) {
+                                               return std::strcmp (string_ (symbol.usr), usr.c_str()) < 0;
+                                             });
+  if (it == end || usr != string_ (it->usr)) {
+    return -1;
+  }
+  return it - begin;
+}
+
+Storage::Reference Snapshot::reference_ (uint32_t refIndex) const {
+  const RefEntry & entry = refs_[refIndex];
+  Storage::Reference ref;
+  ref.file     = fileName_ (entry.file);
+  ref.line1    = entry.line1;
+  ref.line2    = entry.line2;
+  ref.col1     = entry.col1;
+  ref.col2     = entry.col2;
+  ref.offset1  = entry.offset1;
+  ref.offset2  = entry.offset2;
+  ref.kind     = string_ (entry.kind);
+  ref.spelling = string_ (entry.spelling);
+  return ref;
+}
+
+std::vector<Storage::RefDef> Snapshot::findDefinition (const std::string & fileName,
+                                                       int offset) const {
+  std::vector<Storage::RefDef> ret;
+
+  const int fileIndex = findFile_ (fileName);
+  if (fileIndex == -1) {
+    return ret;
+  }
+
+  const FileEntry & file = files_[fileIndex];
+  const RefEntry * begin = refs_ + file.refBegin;
+  const RefEntry * end = std::upper_bound (begin, refs_ + file.refEnd, (uint32_t)offset,
+                                           [](uint32_t offset, const RefEntry & ref) {
+                                             return offset < ref.offset1;
+                                           });
+
+  for (const RefEntry * ref = begin ; ref != end ; ++ref) {
+    if (ref->offset2 < (uint32_t)offset) {
+      continue;
+    }
+
+    const SymbolEntry & symbol = symbols_[ref->symbol];
+    for (uint32_t i = symbol.refBegin ; i < symbol.refEnd ; ++i) {
+      const RefEntry & def = refs_[symbolRefs_[i]];
+      if (! (def.flags & RefEntry::DECLARATION)) {
+        continue;
+      }
+
+      Storage::RefDef refDef;
+      refDef.ref.file     = fileName;
+      refDef.ref.offset1  = ref->offset1;
+      refDef.ref.offset2  = ref->offset2;
+      refDef.ref.kind     = string_ (ref->kind);
+      refDef.ref.spelling = string_ (ref->spelling);
+
+      refDef.def.usr       = string_ (symbol.usr);
+      refDef.def.file      = fileName_ (def.file);
+      refDef.def.line1     = def.line1;
+      refDef.def.line2     = def.line2;
+      refDef.def.col1      = def.col1;
+      refDef.def.col2      = def.col2;
+      refDef.def.kind      = string_ (def.kind);
+      refDef.def.spelling  = string_ (def.spelling);
+      refDef.def.isVirtual = (def.flags & RefEntry::VIRTUAL) ? 1 : 0;
+      ret.push_back (refDef);
+    }
+  }
+
+  std::stable_sort (ret.begin(), ret.end(),
+                    [](const Storage::RefDef & a, const Storage::RefDef & b) {
+                      return (a.ref.offset2 - a.ref.offset1) < (b.ref.offset2 - b.ref.offset1);
+                    });
+  return ret;
+}
+
+void Snapshot::fileSymbols (const std::string & fileName, int begin, int end,
+                            std::function<void (const Storage::RefDef & refDef)> fun) const {
+  const int fileIndex = findFile_ (fileName);
+  if (fileIndex == -1) {
+    return;
+  }
+
+  // References are sorted by offset in each file
+  const FileEntry & file = files_[fileIndex];
+  const RefEntry * first = std::lower_bound (refs_ + file.refBegin, refs_ + file.refEnd,
+                                             (uint32_t)std::max (begin, 0),
+                                             [](const RefEntry & ref, uint32_t offset) {
+                                               return ref.offset1 < offset;
+                                             });
+  // Declaration of each symbol referenced in the file (-1 if none), looked up
+  // once per symbol
+  std::unordered_map<uint32_t, int> declarations;
+  for (const RefEntry * ref = first ; ref != refs_ + file.refEnd ; ++ref) {
+    if (end >= 0 && ref->offset1 >= (uint32_t)end) {
+      break;
+    }
+
+    auto decl = declarations.find (ref->symbol);
+    if (decl == declarations.end()) {
+      const SymbolEntry & symbol = symbols_[ref->symbol];
+      int found = -1;
+      for (uint32_t i = symbol.refBegin ; i < symbol.refEnd ; ++i) {
+        if (refs_[symbolRefs_[i]].flags & RefEntry::DECLARATION) {
+          found = symbolRefs_[i];
+          break;
+        }
+      }
+      decl = declarations.insert (std::make_pair (ref->symbol, found)).first;
+    }
+
+    Storage::RefDef refDef;
+    refDef.ref.file     = fileName;
+    refDef.ref.offset1  = ref->offset1;
+    refDef.ref.offset2  = ref->offset2;
+    refDef.ref.kind     = string_ (ref->kind);
+    refDef.ref.spelling = string_ (ref->spelling);
+    if (decl->second != -1) {
+      definition_ (decl->second, refDef.def);
+    } else {
+      refDef.def.usr = string_ (symbols_[ref->symbol].usr);
+    }
+    fun (refDef);
+  }
+}
+
+bool Snapshot::matches_ (uint32_t refIndex, const Storage::GrepQuery & query,
+                         const std::string & pathPattern) const {
+  const RefEntry & entry = refs_[refIndex];
+  if (query.kind != "" && query.kind != string_ (entry.kind)) {
+    return false;
+  }
+  if (query.declOnly && !(entry.flags & RefEntry::DECLARATION)) {
+    return false;
+  }
+  // Same semantics as SQLite's GLOB operator
+  if (query.path != ""
+      && fnmatch (pathPattern.c_str(), fileName_ (entry.file).c_str(), 0) != 0) {
+    return false;
+  }
+  return true;
+}
+
+void Snapshot::grep (const Storage::GrepQuery & query,
+                     std::function<bool (const Storage::Reference & ref, int cursor)> fun) const {
+  const int symbolIndex = findSymbol_ (query.usr);
+  if (symbolIndex == -1) {
+    return;
+  }
+
+  // Cursors are positions in the list of references to the symbol, plus one
+  const std::string pathPattern = query.pathPattern();
+  const SymbolEntry & symbol = symbols_[symbolIndex];
+  int count = 0;
+  for (uint32_t i = symbol.refBegin + std::max (query.after, 0) ; i < symbol.refEnd ; ++i) {
+    if (!matches_ (symbolRefs_[i], query, pathPattern)) {
+      continue;
+    }
+    if (!fun (reference_ (symbolRefs_[i]), i - symbol.refBegin + 1)) {
+      return;
+    }
+    if (query.limit > 0 && ++count >= query.limit) {
+      return;
+    }
+  }
+}
+
+int Snapshot::grepCount (const Storage::GrepQuery & query) const {
+  const int symbolIndex = findSymbol_ (query.usr);
+  if (symbolIndex == -1) {
+    return 0;
+  }
+
+  const std::string pathPattern = query.pathPattern();
+  const SymbolEntry & symbol = symbols_[symbolIndex];
+  int count = 0;
+  for (uint32_t i = symbol.refBegin + std::max (query.after, 0) ; i < symbol.refEnd ; ++i) {
+    if (matches_ (symbolRefs_[i], query, pathPattern)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void Snapshot::definition_ (uint32_t refIndex, Storage::Definition & def) const {
+  const RefEntry & entry = refs_[refIndex];
+  def.usr       = string_ (symbols_[entry.symbol].usr);
+  def.file      = fileName_ (entry.file);
+  def.line1     = entry.line1;
+  def.line2     = entry.line2;
+  def.col1      = entry.col1;
+  def.col2      = entry.col2;
+  def.kind      = string_ (entry.kind);
+  def.spelling  = string_ (entry.spelling);
+  def.isVirtual = (entry.flags & RefEntry::VIRTUAL) ? 1 : 0;
+}
+
+void Snapshot::declarations (std::function<void (int id, const std::string & usr,
+                                                 const std::string & kind,
+                                                 const std::string & spelling)> fun) const {
+  for (uint32_t s = 0 ; s < header_->symbolCount ; ++s) {
+    const SymbolEntry & symbol = symbols_[s];
+    const std::string usr = string_ (symbol.usr);
+    for (uint32_t i = symbol.refBegin ; i < symbol.refEnd ; ++i) {
+      const RefEntry & ref = refs_[symbolRefs_[i]];
+      if (ref.flags & RefEntry::DECLARATION) {
+        fun (symbolRefs_[i], usr, string_ (ref.kind), string_ (ref.spelling));
+      }
+    }
+  }
+}
+
+bool Snapshot::declaration (int id, Storage::Definition & def) const {
+  if (id < 0 || (uint32_t)id >= header_->refCount
+      || !(refs_[id].flags & RefEntry::DECLARATION)) {
+    return false;
+  }
+  definition_ (id, def);
+  return true;
+}
+
+int Snapshot::definitionRef_ (uint32_t symbolIndex) const {
+  // Declarations spanning several lines (i.e. definitions) first
+  const SymbolEntry & symbol = symbols_[symbolIndex];
+  int found = -1;
+  for (uint32_t i = symbol.refBegin ; i < symbol.refEnd ; ++i) {
+    const RefEntry & ref = refs_[symbolRefs_[i]];
+    if (!(ref.flags & RefEntry::DECLARATION)) {
+      continue;
+    }
+    if (found == -1 || ref.line2 > ref.line1) {
+      found = symbolRefs_[i];
+    }
+    if (ref.line2 > ref.line1) {
+      break;
+    }
+  }
+  return found;
+}
+
+bool Snapshot::definition (const std::string & usr, Storage::Definition & def) const {
+  const int symbolIndex = findSymbol_ (usr);
+  if (symbolIndex == -1) {
+    return false;
+  }
+
+  const int found = definitionRef_ (symbolIndex);
+  if (found == -1) {
+    return false;
+  }
+  definition_ (found, def);
+  return true;
+}
+
+std::vector<Storage::Reference> Snapshot::findOverridenDefinition (const std::string & usr) const {
+  std::vector<Storage::Reference> ret;
+  const int symbolIndex = findSymbol_ (usr);
+  if (symbolIndex == -1) {
+    return ret;
+  }
+
+  // Overriding edges of a method are its edges in the class hierarchy, which
+  // are sorted by source symbol
+  const EdgeEntry * end = bases_ + header_->baseCount;
+  const EdgeEntry * edge = std::lower_bound (bases_, end, (uint32_t)symbolIndex,
+                                             [](const EdgeEntry & edge, uint32_t from) {
+                                               return edge.from < from;
+                                             });
+  for ( ; edge != end && edge->from == (uint32_t)symbolIndex ; ++edge) {
+    const int found = definitionRef_ (edge->to);
+    if (found != -1) {
+      ret.push_back (reference_ (found));
+    }
+  }
+  return ret;
+}
+
+void Snapshot::edges_ (const EdgeEntry * begin, const EdgeEntry * end,
+                       std::function<void (const std::string & from,
+                                           const std::string & to)> fun) const {
+  for (const EdgeEntry * edge = begin ; edge != end ; ++edge) {
+    fun (string_ (symbols_[edge->from].usr), string_ (symbols_[edge->to].usr));
+  }
+}
+
+void Snapshot::calls (std::function<void (const std::string & caller,
+                                          const std::string & callee)> fun) const {
+  edges_ (calls_, calls_ + header_->callCount, fun);
+}
+
+void Snapshot::bases (std::function<void (const std::string & usr,
+                                          const std::string & base)> fun) const {
+  edges_ (bases_, bases_ + header_->baseCount, fun);
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "storage.hxx"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @brief Read-only, memory-mapped snapshot of the index
+ *
+ * A snapshot is a compact binary image of the index database, made of:
+ * - a string pool (NUL-terminated strings),
+ * - a file table, sorted by name,
+ * - a symbol table, sorted by USR,
+ * - per-file reference arrays, sorted by offset,
+ * - per-symbol arrays of reference indices,
+ * - the include graph, sorted by source file,
+ * - the call graph and the class hierarchy, as edges between symbols.
+ *
+ * All sections are arrays of fixed-size records, so that a snapshot can be
+ * mmap()ed and queried without any parsing step.
+ *
+ * File names located under the snapshot root directory are stored relative to
+ * it, which makes the snapshot valid in any checkout of the same revision.
+ */
+class Snapshot {
+public:
+  /** @brief Snapshot format version
+   *
+   * Must be incremented whenever the binary layout changes.
+   */
+  static const uint32_t VERSION = 2;
+
+  /** @brief Default root directory of the snapshots of an index
+   *
+   * @return the longest common directory of all source files, or an empty
+   *         string if the index has none
+   */
+  static std::string sourceRoot (Storage & storage);
+
+  /** @brief Write a snapshot of the index
+   *
+   * @param storage   index database
+   * @param fileName  path to the snapshot file to create
+   * @param root      root directory; an empty string means the longest common
+   *                  directory of all source files
+   *
+   * @return the root directory actually used
+   * @throw std::runtime_error
+   */
+  static std::string write (Storage & storage,
+                            const std::string & fileName,
+                            const std::string & root);
+
+  /** @brief Map an existing snapshot in memory
+   *
+   * @param fileName  path to the snapshot file
+   * @param root      root directory relative file names are resolved against;
+   *                  an empty string means the root recorded at export time
+   *
+   * @throw std::runtime_error if the file is not a valid snapshot
+   */
+  Snapshot (const std::string & fileName, const std::string & root = "");
+
+  ~Snapshot ();
+
+  /** @brief Get the root directory relative file names are resolved against
+   */
+  const std::string & root () const {
+    return root_;
+  }
+
+  /** @brief Find the definitions of the symbols at a given location
+   *
+   * Same semantics as Storage::findDefinition.
+   */
+  std::vector<Storage::RefDef> findDefinition (const std::string & fileName,
+                                               int offset) const;
+
+  /** @brief List all references in a file, with their definitions
+   *
+   * Same semantics as Storage::fileSymbols.
+   */
+  void fileSymbols (const std::string & fileName, int begin, int end,
+                    std::function<void (const Storage::RefDef & refDef)> fun) const;
+
+  /** @brief Find all references to a symbol
+   *
+   * Same semantics as Storage::grep.
+   */
+  void grep (const Storage::GrepQuery & query,
+             std::function<bool (const Storage::Reference & ref, int cursor)> fun) const;
+
+  /** @brief Count the references to a symbol
+   *
+   * Same semantics as Storage::grepCount.
+   */
+  int grepCount (const Storage::GrepQuery & query) const;
+
+  /** @brief Scan all declarations
+   *
+   * Same semantics as Storage::declarations, except that all declarations are
+   * scanned at once, and that file ids are not given.
+   */
+  void declarations (std::function<void (int id, const std::string & usr,
+                                         const std::string & kind,
+                                         const std::string & spelling)> fun) const;
+
+  /** @brief Get a declaration by id, as given by declarations()
+   *
+   * @return @c false if the id does not denote a declaration
+   */
+  bool declaration (int id, Storage::Definition & def) const;
+
+  /** @brief Get the definition of a symbol
+   *
+   * Same semantics as Storage::definition.
+   */
+  bool definition (const std::string & usr, Storage::Definition & def) const;
+
+  /** @brief Find the definitions of the methods overridden by a method
+   *
+   * Same semantics as Storage::findOverridenDefinition.
+   */
+  std::vector<Storage::Reference> findOverridenDefinition (const std::string & usr) const;
+
+  /** @brief Scan all calls between functions
+   *
+   * Same semantics as Storage::calls, except that all calls are scanned at
+   * once.
+   */
+  void calls (std::function<void (const std::string & caller,
+                                  const std::string & callee)> fun) const;
+
+  /** @brief Scan all edges of the class hierarchy
+   *
+   * Same semantics as Storage::bases, except that all edges are scanned at
+   * once.
+   */
+  void bases (std::function<void (const std::string & usr,
+                                  const std::string & base)> fun) const;
+
+  // On-disk records
+  struct Header;
+  struct FileEntry;
+  struct SymbolEntry;
+  struct RefEntry;
+  struct IncludeEntry;
+  struct EdgeEntry;
+
+private:
+  Snapshot (const Snapshot &);
+  Snapshot & operator= (const Snapshot &);
+
+  bool validRecords_ () const;
+  const char * string_ (uint32_t offset) const;
+  std::string fileName_ (uint32_t fileIndex) const;
+  int findFile_ (const std::string & fileName) const;
+  int findSymbol_ (const std::string & usr) const;
+  Storage::Reference reference_ (uint32_t refIndex) const;
+  void definition_ (uint32_t refIndex, Storage::Definition & def) const;
+  int definitionRef_ (uint32_t symbolIndex) const;
+  bool matches_ (uint32_t refIndex, const Storage::GrepQuery & query,
+                 const std::string & pathPattern) const;
+  void edges_ (const EdgeEntry * begin, const EdgeEntry * end,
+               std::function<void (const std::string & from,
+                                   const std::string & to)> fun) const;
+
+  void * data_;
+  size_t size_;
+  std::string root_;
+
+  const Header       * header_;
+  const char         * strings_;
+  const FileEntry    * files_;
+  const SymbolEntry  * symbols_;
+  const RefEntry     * refs_;
+  const uint32_t     * symbolRefs_;
+  const IncludeEntry * includes_;
+  const EdgeEntry    * calls_;
+  const EdgeEntry    * bases_;
+};
@@ -7,6 +7,15 @@ namespace Sqlite {
       @{
   */
 
+  /** @brief Binary value
+   *
+   * Values of this type are bound and extracted as BLOBs, whereas strings are
+   * handled as text.
+   */
+  struct Blob {
+    std::string data;
+  };
+
   /** @brief Prepared SQL statement
    *
    * Objects of this type represent prepared SQL statements destined to be
@@ -56,6 +65,19 @@ namespace Sqlite {
       return bind_ (sqlite3_bind_text (raw(), bindI_, s.c_str(), s.size(), NULL));
     }
 
+    /** @brief Bind a placeholder to a binary value
+     *
+     * This method returns the Statement object itself, allowing chains of
+     * calls.
+     *
+     * @param b  binary value to be bound (must outlive the statement)
+     *
+     * @return the Statement object itself
+     */
+    Statement & bind (const Blob & b) {
+      return bind_ (sqlite3_bind_blob (raw(), bindI_, b.data.data(), b.data.size(), NULL));
+    }
+
     /** @brief Bind a placeholder to a value
      *
      * This method should be used for @c int values. This method returns the
@@ -98,6 +120,23 @@ namespace Sqlite {
       return *this;
     }
 
+    /** @brief Extract a binary value from the current result row
+     *
+     * NULL values are extracted as empty blobs. This method returns the
+     * Statement object itself, allowing chains of calls.
+     *
+     * @param b  variable where the value will be stored
+     *
+     * @return the Statement object itself
+     */
+    Statement & operator>> (Blob & b) {
+      const char * data = static_cast<char const *> (sqlite3_column_blob (raw(), colI_));
+      const int size = sqlite3_column_bytes (raw(), colI_);
+      b.data.assign (data ? data : "", data ? size : 0);
+      ++colI_;
+      return *this;
+    }
+
     /** @brief Execute the statement or fetch the next result row
      *
      * Execute the SQL statement, after all placeholders have been bound. If no
@@ -122,6 +161,23 @@ namespace Sqlite {
       return ret;
     }
 
+    /** @brief Reset the statement so that it can be executed again
+     *
+     * Reset the statement to its initial state and clear all bound values, so
+     * that new values can be bound before executing it again. Re-using a
+     * prepared statement avoids compiling the same SQL code repeatedly. This
+     * method returns the Statement object itself, allowing chains of calls.
+     *
+     * @return the Statement object itself
+     */
+    Statement & reset () {
+      sqlite3_reset (raw());
+      sqlite3_clear_bindings (raw());
+      bindI_ = 1;
+      colI_ = 0;
+      return *this;
+    }
+
   private:
     Statement & bind_ (int ret) {
       if (ret != SQLITE_OK) {
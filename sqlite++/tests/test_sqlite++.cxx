@@ -30,6 +30,36 @@ int main () {
     database.prepare ("INSERT INTO foo VALUES (NULL, ?)")
       .bind ("bar")  // bind it to a value, ...
       .step ();      // execute it
+
+    // Prepared statements can be reset and executed again
+    Statement insert = database.prepare ("INSERT INTO foo VALUES (NULL, ?)");
+    insert.bind ("baz").step();
+    insert.reset().bind ("qux").step();
+  }
+
+  // Transactions left because of an exception are rolled back
+  try {
+    Transaction transaction(database);
+    database.prepare ("INSERT INTO foo VALUES (NULL, ?)")
+      .bind ("quux")
+      .step ();
+    throw std::runtime_error ("abort");
+  } catch (std::runtime_error & e) {
+    std::cerr << "rolled back: " << e.what() << std::endl;
+  }
+
+  // Savepoints can be nested in transactions, and are rolled back the same way
+  {
+    Transaction transaction(database);
+    try {
+      Savepoint savepoint(database, "insertQuux");
+      database.prepare ("INSERT INTO foo VALUES (NULL, ?)")
+        .bind ("quux")
+        .step ();
+      throw std::runtime_error ("abort");
+    } catch (std::runtime_error & e) {
+      std::cerr << "rolled back to savepoint: " << e.what() << std::endl;
+    }
   }
 
   // Prepare an SQL statement
@@ -45,7 +75,27 @@ int main () {
     // and display them
     std::cerr << id << ": " << name << std::endl;
   }
+
+  // Binary values are handled as blobs
+  database.execute ("CREATE TABLE IF NOT EXISTS blobs (data BLOB)");
+  database.execute ("DELETE FROM blobs");
+  Blob in;
+  in.data = std::string ("a\0b", 3);
+  database.prepare ("INSERT INTO blobs VALUES (?)")
+    .bind (in)
+    .step();
+
+  Statement select = database.prepare ("SELECT data FROM blobs");
+  select.step();
+  Blob out;
+  select >> out;
+  std::cerr << "blob: " << out.data.size() << " bytes" << std::endl;
   //![main]
 
-  return 0;
+  Statement rolledBack = database.prepare ("SELECT count(*) FROM foo WHERE name = 'quux'");
+  rolledBack.step();
+  int count;
+  rolledBack >> count;
+
+  return (out.data == in.data && count == 0) ? 0 : 1;
 }
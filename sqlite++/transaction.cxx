@@ -2,6 +2,8 @@
 
 #include "database.hxx"
 
+#include <exception>
+
 namespace Sqlite {
   Transaction::Transaction (Database & db)
     : db_(db)
@@ -10,6 +12,31 @@ namespace Sqlite {
   }
 
   Transaction::~Transaction () {
+    if (std::uncaught_exception()) {
+      // Errors can not be reported while another exception propagates
+      try {
+        db_.execute("ROLLBACK TRANSACTION");
+      } catch (...) { }
+      return;
+    }
     db_.execute("END TRANSACTION");
   }
+
+  Savepoint::Savepoint (Database & db, const std::string & name)
+    : db_(db),
+      name_(name)
+  {
+    db_.execute(("SAVEPOINT " + name_).c_str());
+  }
+
+  Savepoint::~Savepoint () {
+    if (std::uncaught_exception()) {
+      try {
+        db_.execute(("ROLLBACK TO " + name_).c_str());
+        db_.execute(("RELEASE " + name_).c_str());
+      } catch (...) { }
+      return;
+    }
+    db_.execute(("RELEASE " + name_).c_str());
+  }
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 namespace Sqlite {
   class Database;
 
@@ -9,7 +11,9 @@ namespace Sqlite {
 
   /** @brief SQL transaction
    *
-   * The transaction is automatically ended when the object is destroyed.
+   * The transaction is automatically ended when the object is destroyed: it
+   * is committed if the scope is left normally, and rolled back if it is left
+   * because of an exception.
    */
   class Transaction {
   public:
@@ -24,7 +28,7 @@ namespace Sqlite {
 
     /** @brief Destructor
      *
-     * End the transaction.
+     * Commit the transaction, or roll it back during stack unwinding.
      */
     ~Transaction ();
 
@@ -32,5 +36,34 @@ namespace Sqlite {
     Database & db_;
   };
 
+  /** @brief SQL savepoint
+   *
+   * Unlike transactions, savepoints can be nested in an open transaction. The
+   * savepoint is released when the object is destroyed, or rolled back to and
+   * released during stack unwinding.
+   */
+  class Savepoint {
+  public:
+    /** @brief Constructor
+     *
+     * Open a savepoint on a given SQLite database connection.
+     *
+     * @param db    SQLite database connection.
+     * @param name  savepoint name, which must be a valid SQL identifier
+     * @throw Error
+     */
+    Savepoint (Database & db, const std::string & name);
+
+    /** @brief Destructor
+     *
+     * Release the savepoint, after rolling back to it during stack unwinding.
+     */
+    ~Savepoint ();
+
+  private:
+    Database & db_;
+    std::string name_;
+  };
+
   /** @} */
 }
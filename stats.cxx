@@ -0,0 +1,85 @@
+#include "application.hxx"
+#include <json/json.h>
+
+void Application::stats (std::ostream & cout) {
+  const Request::Cancellation::Stats & requests = cancellation_.stats();
+
+  Json::Value json;
+  json["requests"]["cancelled"] = requests.cancelled;
+  json["requests"]["expired"]   = requests.expired;
+
+  const Request::Scheduler::Stats & scheduler = scheduler_.stats();
+  json["queued"]["interactive"] = scheduler.queued[Request::INTERACTIVE];
+  json["queued"]["focused"]     = scheduler.queued[Request::FOCUSED];
+  json["queued"]["background"]  = scheduler.queued[Request::BACKGROUND];
+  json["scheduler"]["yields"]    = scheduler.yields;
+  json["scheduler"]["preempted"] = scheduler.preempted;
+
+  // Focused files waiting to be re-indexed
+  unsigned int focused = 0;
+  const auto & files = scheduler_.focused();
+  for (auto it = files.begin() ; it != files.end() ; ++it) {
+    if (storage_.nextFileFor (*it) != "") {
+      ++focused;
+    }
+  }
+  json["queued"]["focusedFiles"] = focused;
+
+  json["buffers"]["count"]           = (unsigned int)buffers_.size();
+  json["buffers"]["reparsesSkipped"] = reparsesSkipped_;
+  json["buffers"]["idleReparses"]    = idleReparses_;
+
+  json["find"]["fromIndex"]   = hybridFromIndex_;
+  json["find"]["fromSource"]  = hybridFromSource_;
+  json["find"]["reindexed"]   = staleIndexed_;
+  json["queued"]["stale"]     = (unsigned int)staleFiles_.size();
+
+  json["hotSet"]["restored"] = hotSetRestored_;
+  json["hotSet"]["pending"]  = (unsigned int)hotSet_.size();
+  json["hotSet"]["cached"]   = (unsigned int)tu_.size();
+
+  const ResultCache::Stats & results = results_.stats();
+  json["index"]["generation"]    = (Json::UInt64)storage_.generation();
+  json["results"]["hits"]        = results.hits;
+  json["results"]["misses"]      = results.misses;
+  json["results"]["invalidated"] = results.invalidated;
+  json["results"]["entries"]     = results.entries;
+  json["results"]["memory"]      = (Json::UInt64)results.memory;
+
+  json["symbols"]["count"]    = (Json::UInt64)(symbols_.current() ? symbols_.current()->size() : 0);
+  json["symbols"]["changed"]  = (Json::UInt64)(changedSymbols_ ? changedSymbols_->size() : 0);
+  json["symbols"]["memory"]   = (Json::UInt64)(symbols_.memoryUsage()
+                                               + (changedSymbols_ ? changedSymbols_->memoryUsage() : 0));
+  json["symbols"]["builds"]   = symbols_.builds();
+  json["symbols"]["building"] = symbols_.building();
+
+  json["calls"]["functions"] = (Json::UInt64)(calls_.current() ? calls_.current()->size() : 0);
+  json["calls"]["edges"]     = (Json::UInt64)(calls_.current() ? calls_.current()->edges() : 0);
+  json["calls"]["memory"]    = (Json::UInt64)calls_.memoryUsage();
+  json["calls"]["builds"]    = calls_.builds();
+  json["calls"]["building"]  = calls_.building();
+
+  json["hierarchy"]["symbols"]  = (Json::UInt64)(hierarchy_.current() ? hierarchy_.current()->size() : 0);
+  json["hierarchy"]["edges"]    = (Json::UInt64)(hierarchy_.current() ? hierarchy_.current()->edges() : 0);
+  json["hierarchy"]["memory"]   = (Json::UInt64)hierarchy_.memoryUsage();
+  json["hierarchy"]["builds"]   = hierarchy_.builds();
+  json["hierarchy"]["building"] = hierarchy_.building();
+
+  json["lite"]["enabled"]  = lite_();
+  json["lite"]["resolved"] = liteResolved_;
+  json["lite"]["parsed"]   = liteParsed_;
+
+  json["text"]["files"]     = (Json::UInt64)(text_.current() ? text_.current()->size() : 0);
+  json["text"]["unindexed"] = (Json::UInt64)(text_.current() ? text_.current()->unindexed() : 0);
+  json["text"]["memory"]    = (Json::UInt64)text_.memoryUsage();
+  json["text"]["scanned"]   = textScanned_;
+  json["text"]["skipped"]   = textSkipped_;
+  json["text"]["builds"]    = text_.builds();
+  json["text"]["building"]  = text_.building();
+
+  json["completion"]["hits"]   = completionHits_;
+  json["completion"]["misses"] = completionMisses_;
+
+  Json::StyledWriter writer;
+  cout << writer.write (json);
+}
@@ -1,18 +1,119 @@
 #include "storage.hxx"
+#include "util/util.hxx"
+#include <limits>
+
+namespace {
+    // Database attached to the connection while the object lives
+    class Attachment {
+    public:
+        Attachment (Sqlite::Database & db, const std::string & fileName,
+                    const std::string & schema)
+            : db_ (db),
+              schema_ (schema)
+        {
+            db_.prepare (("ATTACH DATABASE ? AS " + schema_).c_str())
+                .bind (fileName)
+                .step();
+        }
+
+        ~Attachment () {
+            try {
+                db_.execute (("DETACH DATABASE " + schema_).c_str());
+            } catch (...) {
+                // Never let an error escape the destructor
+            }
+        }
+
+    private:
+        Sqlite::Database & db_;
+        const std::string schema_;
+    };
+
+    // Temporary table, dropped when the object goes out of scope
+    class TempTable {
+    public:
+        TempTable (Sqlite::Database & db, const std::string & name)
+            : db_ (db),
+              name_ (name)
+        { }
+
+        ~TempTable () {
+            try {
+                db_.execute (("DROP TABLE IF EXISTS temp." + name_).c_str());
+            } catch (...) {
+                // Never let an error escape the destructor
+            }
+        }
+
+    private:
+        Sqlite::Database & db_;
+        const std::string name_;
+    };
+
+    bool hasTable (Sqlite::Database & db, const std::string & schema,
+                   const std::string & table) {
+        return db.prepare (("SELECT 1 FROM " + schema + ".sqlite_master "
+                            "WHERE type = 'table' AND name = ?").c_str())
+            .bind (table)
+            .step() == SQLITE_ROW;
+    }
+
+    bool hasColumn (Sqlite::Database & db, const std::string & schema,
+                    const std::string & table, const std::string & column) {
+        Sqlite::Statement stmt =
+            db.prepare (("PRAGMA " + schema + ".table_info(" + table + ")").c_str());
+        while (stmt.step() == SQLITE_ROW) {
+            int cid;
+            std::string name;
+            stmt >> cid >> name;
+            if (name == column) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Replace the rows of a per-file table for the files of the attached shard
+    // which are newer than in the main database (see temp.fileMap in
+    // Storage::merge()). The file id is the first column of the table, and
+    // shards created by older versions may not have the table at all.
+    void mergeNewerRows (Sqlite::Database & db, const std::string & table,
+                         const std::string & fileIdColumn, const std::string & columns) {
+        db.execute (("DELETE FROM main." + table + " "
+                     "WHERE " + fileIdColumn + " IN (SELECT mainId FROM fileMap WHERE newer)").c_str());
+        if (!hasTable (db, "shard", table)) {
+            return;
+        }
+        db.execute (("INSERT INTO main." + table + " "
+                     "SELECT fileMap.mainId, " + columns + " "
+                     "FROM shard." + table + " "
+                     "INNER JOIN fileMap ON fileMap.shardId = shard." + table + "." + fileIdColumn + " "
+                     "WHERE fileMap.newer").c_str());
+    }
+}
 
 Storage::Storage()
-    : db_(".ct.sqlite")
+    : db_(".ct.sqlite"),
+      generation_ (0),
+      resetGeneration_ (0),
+      includesGeneration_ (0),
+      usrGenerations_ (usrBuckets_, 0)
 {
     db_.execute ("CREATE TABLE IF NOT EXISTS files ("
             "  id      INTEGER PRIMARY KEY,"
             "  name    TEXT,"
             "  indexed INTEGER"
             ")");
-    db_.execute ("CREATE TABLE IF NOT EXISTS commands ("
-            "  fileId     INTEGER REFERENCES files(id),"
+    db_.execute ("CREATE TABLE IF NOT EXISTS argsets ("
+            "  id         INTEGER PRIMARY KEY,"
             "  directory  TEXT,"
             "  args       TEXT"
             ")");
+    migrateCommands_ ();
+    db_.execute ("CREATE TABLE IF NOT EXISTS commands ("
+            "  fileId     INTEGER REFERENCES files(id),"
+            "  argsetId   INTEGER REFERENCES argsets(id)"
+            ")");
     db_.execute ("CREATE TABLE IF NOT EXISTS includes ("
             "  sourceId   INTEGER REFERENCES files(id),"
             "  includedId INTEGER REFERENCES files(id)"
@@ -35,6 +136,34 @@ Storage::Storage()
             "  usr TEXT REFERENCES tags(usr),"
             "  overriden_usr TEXT"
             ")");
+    db_.execute ("CREATE TABLE IF NOT EXISTS fileTrigrams ("
+            "  fileId   INTEGER PRIMARY KEY REFERENCES files(id),"
+            "  trigrams BLOB"
+            ")");
+    db_.execute ("CREATE TABLE IF NOT EXISTS calls ("
+            "  fileId    INTEGER REFERENCES files(id),"
+            "  callerUsr TEXT,"
+            "  calleeUsr TEXT,"
+            "  offset    INTEGER"
+            ")");
+    db_.execute ("CREATE TABLE IF NOT EXISTS bases ("
+            "  fileId   INTEGER REFERENCES files(id),"
+            "  usr      TEXT,"
+            "  baseUsr  TEXT"
+            ")");
+    db_.execute ("CREATE TABLE IF NOT EXISTS diagnostics ("
+            "  sourceId INTEGER REFERENCES files(id),"
+            "  file     TEXT,"
+            "  severity TEXT,"
+            "  line1    INTEGER,"
+            "  col1     INTEGER,"
+            "  offset1  INTEGER,"
+            "  line2    INTEGER,"
+            "  col2     INTEGER,"
+            "  offset2  INTEGER,"
+            "  message  TEXT,"
+            "  fixIts   TEXT"
+            ")");
     db_.execute ("CREATE TABLE IF NOT EXISTS options ( "
             "  name   TEXT, "
             "  value  TEXT "
@@ -43,8 +172,49 @@ Storage::Storage()
     //build indexes
     db_.execute ("CREATE INDEX IF NOT EXISTS usr_offset_fileId_index ON tags (usr, offset1, offset2, fileId)");
     db_.execute ("CREATE INDEX IF NOT EXISTS usr_index ON tags (usr)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS fileId_offset_index ON tags (fileId, offset1)");
     db_.execute ("CREATE INDEX IF NOT EXISTS name_index ON options (name)");
-    db_.execute ("CREATE INDEX IF NOT EXISTS name_index ON files (name)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS files_name_index ON files (name)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS includes_index ON includes (sourceId, includedId)");
+    db_.execute ("CREATE UNIQUE INDEX IF NOT EXISTS argsets_index ON argsets (directory, args)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS commands_index ON commands (fileId)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS calls_fileId_index ON calls (fileId)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS bases_fileId_index ON bases (fileId)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS diagnostics_sourceId_index ON diagnostics (sourceId)");
+    db_.execute ("CREATE INDEX IF NOT EXISTS diagnostics_file_index ON diagnostics (file, offset1)");
+
+    // Generations go on from where the last server left them, but which files
+    // changed before is unknown
+    try {
+        generation_ = std::stoul (getOption ("generation"));
+    } catch (std::exception &) {
+        generation_ = 0;
+    }
+    resetGeneration_    = generation_;
+    includesGeneration_ = generation_;
+}
+
+void Storage::migrateCommands_ () {
+    // Older databases stored a copy of the arguments for each file in the
+    // `commands' table
+    if (!hasColumn (db_, "main", "commands", "args")) {
+        return;
+    }
+
+    Sqlite::Transaction transaction (db_);
+    db_.execute ("INSERT OR IGNORE INTO argsets (directory, args) "
+            "SELECT DISTINCT directory, args FROM commands");
+    db_.execute ("ALTER TABLE commands RENAME TO legacy_commands");
+    db_.execute ("CREATE TABLE commands ("
+            "  fileId     INTEGER REFERENCES files(id),"
+            "  argsetId   INTEGER REFERENCES argsets(id)"
+            ")");
+    db_.execute ("INSERT INTO commands "
+            "SELECT legacy_commands.fileId, argsets.id "
+            "FROM legacy_commands "
+            "INNER JOIN argsets ON argsets.directory = legacy_commands.directory "
+            "                  AND argsets.args = legacy_commands.args");
+    db_.execute ("DROP TABLE legacy_commands");
 }
 
 
@@ -54,44 +224,162 @@ int Storage::setCompileCommand (const std::string & fileName,
     int fileId = addFile_ (fileName);
     addInclude (fileId, fileId);
 
-        db_.prepare("DELETE FROM commands "
+    const std::string serializedArgs = serialize_ (args);
+    db_.prepare ("INSERT OR IGNORE INTO argsets (directory, args) VALUES (?,?)")
+        .bind (directory)
+        .bind (serializedArgs)
+        .step();
+
+    db_.prepare("DELETE FROM commands "
             "WHERE fileId=?").bind (fileId)
         .step();
 
-    db_.prepare ("INSERT INTO commands VALUES (?,?,?)")
+    db_.prepare ("INSERT INTO commands "
+            "SELECT ?, id FROM argsets WHERE directory = ? AND args = ?")
         .bind (fileId)
         .bind (directory)
-        .bind (serialize_ (args))
+        .bind (serializedArgs)
         .step();
 
+    fileArgsets_.clear();
     return fileId;
 }
 
-void Storage::getCompileCommand (const std::string & fileName,
+int Storage::getCompileCommand (const std::string & fileName,
         std::string & directory,
         std::vector<std::string> & args) {
 
-    int fileId = fileId_ (fileName);
-    Sqlite::Statement stmt
-        = db_.prepare ("SELECT commands.directory, commands.args "
-                "FROM includes "
-                "INNER JOIN commands ON includes.sourceId = commands.fileId "
-                "WHERE includes.includedId = ?")
-        .bind (fileId);
+    // Look for the argument set in the in-memory cache first
+    int argsetId;
+    auto file = fileArgsets_.find (fileName);
+    if (file != fileArgsets_.end()) {
+        argsetId = file->second;
+    } else {
+        int fileId = fileId_ (fileName);
+        Sqlite::Statement stmt
+            = db_.prepare ("SELECT commands.argsetId "
+                    "FROM includes "
+                    "INNER JOIN commands ON includes.sourceId = commands.fileId "
+                    "WHERE includes.includedId = ?")
+            .bind (fileId);
 
-    switch (stmt.step()) {
-        case SQLITE_DONE:
+        if (stmt.step() != SQLITE_ROW) {
             throw std::runtime_error ("no compilation command for file `"
                     + fileName + "'");
-            break;
-        default:
-            std::string serializedArgs;
-            stmt >> directory >> serializedArgs;
-            deserialize_ (serializedArgs, args);
+        }
+        stmt >> argsetId;
+        fileArgsets_[fileName] = argsetId;
+    }
+
+    const ArgSet & argset = argset_ (argsetId);
+    directory = argset.directory;
+    args = argset.args;
+    return argsetId;
+}
+
+const Storage::ArgSet & Storage::argset_ (int argsetId) {
+    auto it = argsets_.find (argsetId);
+    if (it != argsets_.end()) {
+        return it->second;
+    }
+
+    Sqlite::Statement stmt
+        = db_.prepare ("SELECT directory, args FROM argsets WHERE id = ?")
+        .bind (argsetId);
+    if (stmt.step() != SQLITE_ROW) {
+        throw std::runtime_error ("unknown argument set");
     }
+
+    ArgSet & argset = argsets_[argsetId];
+    std::string serializedArgs;
+    stmt >> argset.directory >> serializedArgs;
+    deserialize_ (serializedArgs, argset.args);
+    return argset;
 }
 
-std::string Storage::nextFile () {
+std::unordered_map<std::string, Storage::CompileCommand> Storage::compileCommands () {
+    Sqlite::Statement stmt
+        = db_.prepare ("SELECT files.name, argsets.directory, argsets.args "
+                "FROM commands "
+                "INNER JOIN files ON files.id = commands.fileId "
+                "INNER JOIN argsets ON argsets.id = commands.argsetId");
+
+    std::unordered_map<std::string, CompileCommand> ret;
+    while (stmt.step() == SQLITE_ROW) {
+        CompileCommand command;
+        std::string serializedArgs;
+        stmt >> command.fileName >> command.directory >> serializedArgs;
+        deserialize_ (serializedArgs, command.args);
+        ret[command.fileName] = command;
+    }
+    return ret;
+}
+
+void Storage::setCompileCommands (const std::vector<CompileCommand> & commands) {
+    if (commands.empty()) {
+        return;
+    }
+
+    // Changes are rolled back and the temporary table dropped on errors
+    Sqlite::Transaction transaction (db_);
+
+    // Stage all commands in a temporary table, then apply them with a few
+    // set-based statements
+    TempTable newCommands (db_, "newCommands");
+    db_.execute ("CREATE TEMP TABLE newCommands ("
+            "  name       TEXT PRIMARY KEY,"
+            "  directory  TEXT,"
+            "  args       TEXT"
+            ")");
+    {
+        Sqlite::Statement insert
+            = db_.prepare ("INSERT OR REPLACE INTO newCommands VALUES (?,?,?)");
+        for (auto it = commands.begin() ; it != commands.end() ; ++it) {
+            const std::string args = serialize_ (it->args);
+            insert.reset()
+                .bind (it->fileName)
+                .bind (it->directory)
+                .bind (args)
+                .step();
+        }
+    }
+
+    db_.execute ("INSERT INTO files (name, indexed) "
+            "SELECT name, 0 FROM newCommands "
+            "WHERE name NOT IN (SELECT name FROM files)");
+    db_.execute ("DELETE FROM commands "
+            "WHERE fileId IN (SELECT files.id FROM files "
+            "                 INNER JOIN newCommands ON newCommands.name = files.name)");
+    db_.execute ("INSERT OR IGNORE INTO argsets (directory, args) "
+            "SELECT DISTINCT directory, args FROM newCommands");
+    db_.execute ("INSERT INTO commands "
+            "SELECT files.id, argsets.id "
+            "FROM newCommands "
+            "INNER JOIN files ON files.name = newCommands.name "
+            "INNER JOIN argsets ON argsets.directory = newCommands.directory "
+            "                  AND argsets.args = newCommands.args");
+    db_.execute ("INSERT INTO includes "
+            "SELECT files.id, files.id "
+            "FROM newCommands "
+            "INNER JOIN files ON files.name = newCommands.name "
+            "WHERE NOT EXISTS (SELECT 1 FROM includes "
+            "                  WHERE sourceId = files.id AND includedId = files.id)");
+
+    // Forget argument sets which are not used anymore
+    db_.execute ("DELETE FROM argsets "
+            "WHERE id NOT IN (SELECT DISTINCT argsetId FROM commands)");
+    fileArgsets_.clear();
+    argsets_.clear();
+}
+
+std::string Storage::nextFile (const std::vector<std::string> & preferred) {
+    for (auto it = preferred.begin() ; it != preferred.end() ; ++it) {
+        const std::string sourceName = nextFileFor (*it);
+        if (sourceName != "") {
+            return sourceName;
+        }
+    }
+
     Sqlite::Statement stmt
         = db_.prepare ("SELECT included.name, included.indexed, source.name, "
                 "       count(source.name) AS sourceCount "
@@ -123,9 +411,142 @@ std::string Storage::nextFile () {
     return "";
 }
 
+std::string Storage::nextFileFor (const std::string & fileName) {
+    Sqlite::Statement stmt
+        = db_.prepare ("SELECT included.name, included.indexed, source.name "
+                "FROM includes "
+                "INNER JOIN files AS source ON source.id = includes.sourceId "
+                "INNER JOIN files AS included ON included.id = includes.includedId "
+                "WHERE source.name = ? OR included.name = ?")
+        .bind (fileName)
+        .bind (fileName);
+    while (stmt.step() == SQLITE_ROW) {
+        std::string includedName;
+        int indexed;
+        std::string sourceName;
+        stmt >> includedName >> indexed >> sourceName;
+
+        struct stat fileStat;
+        if (stat (includedName.c_str(), &fileStat) != 0) {
+            // Let nextFile() handle removed files
+            continue;
+        }
+
+        if (fileStat.st_mtime > indexed) {
+            return sourceName;
+        }
+    }
+
+    return "";
+}
+
 void Storage::cleanIndex () {
     db_.execute ("DELETE FROM tags");
+    db_.execute ("DELETE FROM fileTrigrams");
+    db_.execute ("DELETE FROM calls");
+    db_.execute ("DELETE FROM bases");
+    db_.execute ("DELETE FROM diagnostics");
     db_.execute ("UPDATE files SET indexed = 0");
+    resetGeneration_ = nextGeneration_();
+    fileGenerations_.clear();
+}
+
+unsigned long Storage::nextGeneration_ () {
+    setOption ("generation", std::to_string (++generation_));
+    return generation_;
+}
+
+void Storage::fileChanged_ (const std::string & fileName, int fileId) {
+    fileGenerations_[fileName] = nextGeneration_();
+
+    // Tags of the file are about to be removed
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT DISTINCT usr FROM tags WHERE fileId = ?")
+        .bind (fileId);
+    while (stmt.step() == SQLITE_ROW) {
+        std::string usr;
+        stmt >> usr;
+        usrChanged_ (usr);
+    }
+}
+
+void Storage::setFileTrigrams (const std::string & fileName,
+                               const std::vector<uint32_t> & trigrams) {
+    const int fileId = fileId_ (fileName);
+    if (fileId == -1) {
+        return;
+    }
+
+    Sqlite::Blob data;
+    data.data = encodeSet (trigrams);
+    db_.prepare ("INSERT OR REPLACE INTO fileTrigrams VALUES (?,?)")
+        .bind (fileId)
+        .bind (data)
+        .step();
+}
+
+bool Storage::fileTrigrams (const std::string & fileName, std::vector<uint32_t> & trigrams,
+                            time_t & indexed) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT fileTrigrams.trigrams, files.indexed FROM fileTrigrams "
+                "INNER JOIN files ON files.id = fileTrigrams.fileId "
+                "WHERE files.name = ?")
+        .bind (fileName);
+    if (stmt.step() != SQLITE_ROW) {
+        return false;
+    }
+
+    Sqlite::Blob data;
+    int time;
+    stmt >> data >> time;
+    trigrams = decodeSet (data.data);
+    indexed = time;
+    return true;
+}
+
+int Storage::fileTrigrams (int after, int limit,
+                           std::function<void (const std::string & fileName,
+                                               const std::vector<uint32_t> * trigrams,
+                                               time_t indexed)> fun) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT files.id, files.name, files.indexed, "
+                "       fileTrigrams.fileId IS NOT NULL, fileTrigrams.trigrams "
+                "FROM files "
+                "LEFT JOIN fileTrigrams ON fileTrigrams.fileId = files.id "
+                "WHERE files.id > ? "
+                "ORDER BY files.id "
+                "LIMIT ?")
+        .bind (after)
+        .bind (limit);
+
+    int id = -1;
+    while (stmt.step() == SQLITE_ROW) {
+        std::string fileName;
+        int time;
+        int indexed;
+        Sqlite::Blob data;
+        stmt >> id >> fileName >> time >> indexed >> data;
+
+        const std::vector<uint32_t> trigrams = decodeSet (data.data);
+        fun (fileName, indexed ? &trigrams : NULL, time);
+    }
+    return id;
+}
+
+bool Storage::changedFiles (unsigned long generation, std::vector<std::string> & files) const {
+    if (resetGeneration_ > generation) {
+        return false;
+    }
+    for (auto it = fileGenerations_.begin() ; it != fileGenerations_.end() ; ++it) {
+        if (it->second > generation) {
+            files.push_back (it->first);
+        }
+    }
+    return true;
+}
+
+void Storage::usrChanged_ (const std::string & usr) {
+    usrGenerations_[std::hash<std::string>() (usr) % usrBuckets_] = generation_;
 }
 
 bool Storage::beginFile (const std::string & fileName) {
@@ -145,14 +566,21 @@ bool Storage::beginFile (const std::string & fileName) {
     int modified = fileStat.st_mtime;
 
     if (modified > indexed) {
+        fileChanged_ (fileName, fileId);
+        includesGeneration_ = generation_;
         db_.prepare ("DELETE FROM tags WHERE fileId=?").bind (fileId).step();
+        db_.prepare ("DELETE FROM calls WHERE fileId=?").bind (fileId).step();
+        db_.prepare ("DELETE FROM bases WHERE fileId=?").bind (fileId).step();
         db_.prepare ("DELETE FROM includes WHERE sourceId=?").bind (fileId).step();
+        // Argument sets cached for the files it includes remain valid
+        fileArgsets_.erase (fileName);
         db_.prepare ("UPDATE files "
                 "SET indexed=? "
                 "WHERE id=?")
             .bind (modified)
             .bind (fileId)
             .step();
+        db_.prepare ("DELETE FROM fileTrigrams WHERE fileId=?").bind (fileId).step();
         return true;
     } else {
         return false;
@@ -186,6 +614,8 @@ void Storage::addInclude (const std::string & includedFile,
 
 void Storage::removeFile (const std::string & fileName) {
     int fileId = fileId_ (fileName);
+    fileChanged_ (fileName, fileId);
+    includesGeneration_ = generation_;
     db_
         .prepare ("DELETE FROM commands WHERE fileId = ?")
         .bind (fileId)
@@ -206,9 +636,31 @@ void Storage::removeFile (const std::string & fileName) {
         .bind (fileId)
         .step();
 
+    db_
+        .prepare ("DELETE FROM fileTrigrams WHERE fileId = ?")
+        .bind (fileId)
+        .step();
+
+    db_
+        .prepare ("DELETE FROM calls WHERE fileId = ?")
+        .bind (fileId)
+        .step();
+
+    db_
+        .prepare ("DELETE FROM bases WHERE fileId = ?")
+        .bind (fileId)
+        .step();
+
+    db_
+        .prepare ("DELETE FROM diagnostics WHERE sourceId = ?")
+        .bind (fileId)
+        .step();
+
     db_.prepare ("DELETE FROM files WHERE id = ?")
         .bind (fileId)
         .step();
+
+    fileArgsets_.clear();
 }
 
 void Storage::addTag (const std::string & usr,
@@ -232,6 +684,7 @@ void Storage::addTag (const std::string & usr,
                 "  AND offset2=?")
         .bind (fileId).bind (usr).bind (offset1).bind (offset2);
     if (stmt.step() == SQLITE_DONE) { // no matching row
+        usrChanged_ (usr);
         db_.prepare ("INSERT INTO tags VALUES (?,?,?,?,?,?,?,?,?,?,?,?)")
             .bind(fileId) .bind(usr)  .bind(kind)    .bind(spelling)
             .bind(line1)  .bind(col1) .bind(offset1)
@@ -249,6 +702,30 @@ void Storage::addTag (const std::string & usr,
     }
 }
 
+void Storage::addCall (const std::string & caller, const std::string & callee,
+        const std::string & fileName, int offset) {
+    int fileId = fileId_ (fileName);
+    if (fileId == -1) {
+        return;
+    }
+
+    db_.prepare ("INSERT INTO calls VALUES (?,?,?,?)")
+        .bind (fileId) .bind (caller) .bind (callee) .bind (offset)
+        .step();
+}
+
+void Storage::addBase (const std::string & usr, const std::string & base,
+        const std::string & fileName) {
+    int fileId = fileId_ (fileName);
+    if (fileId == -1) {
+        return;
+    }
+
+    db_.prepare ("INSERT INTO bases VALUES (?,?,?)")
+        .bind (fileId) .bind (usr) .bind (base)
+        .step();
+}
+
 std::vector<Storage::RefDef> Storage::findOverridenDefinition (const std::string fileName, const std::string usr)
 {
     Sqlite::Statement stmt =
@@ -315,6 +792,41 @@ std::vector<Storage::RefDef> Storage::findDefinition (const std::string fileName
     return ret;
 }
 
+void Storage::fileSymbols (const std::string & fileName, int begin, int end,
+                           std::function<void (const RefDef & refDef)> fun) {
+    // One declaration is picked for each reference, using the usr index
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT ref.offset1, ref.offset2, ref.kind, ref.spelling, "
+                "       ref.usr, IFNULL(defFile.name, ''), "
+                "       def.line1, def.line2, def.col1, def.col2, "
+                "       IFNULL(def.kind, ''), IFNULL(def.spelling, ''), def.isVirtual "
+                "FROM (SELECT offset1, offset2, kind, spelling, usr, "
+                "             (SELECT rowid FROM tags "
+                "              WHERE tags.usr = fileTags.usr AND isDecl = 1 "
+                "              LIMIT 1) AS defId "
+                "      FROM tags AS fileTags "
+                "      WHERE fileId = ? AND offset1 >= ? AND offset1 < ?) AS ref "
+                "LEFT JOIN tags AS def ON def.rowid = ref.defId "
+                "LEFT JOIN files AS defFile ON defFile.id = def.fileId "
+                "ORDER BY ref.offset1, ref.offset2")
+        .bind (fileId_ (fileName))
+        .bind (begin)
+        .bind (end >= 0 ? end : std::numeric_limits<int>::max());
+
+    while (stmt.step() == SQLITE_ROW) {
+        RefDef refDef;
+        Reference & ref = refDef.ref;
+        Definition & def = refDef.def;
+
+        stmt >> ref.offset1 >> ref.offset2 >> ref.kind >> ref.spelling
+            >> def.usr >> def.file
+            >> def.line1 >> def.line2 >> def.col1 >> def.col2
+            >> def.kind >> def.spelling >> def.isVirtual;
+        ref.file = fileName;
+        fun (refDef);
+    }
+}
+
 std::vector<Storage::Reference> Storage::findOverridenDefinition(const std::string usr) {
     Sqlite::Statement stmt =
         db_.prepare("SELECT ref.line1, ref.line2, ref.col1, ref.col2, "
@@ -336,21 +848,497 @@ std::vector<Storage::Reference> Storage::findOverridenDefinition(const std::stri
     return ret;
 }
 
-std::vector<Storage::Reference> Storage::grep (const std::string usr) {
+Sqlite::Statement Storage::grepStatement_ (const GrepQuery & query,
+                                           const std::string & columns,
+                                           const std::string & pathPattern,
+                                           bool paginate) {
+    // Filters are only added when needed, so that SQLite can use the usr index
+    std::string sql = "SELECT " + columns + " "
+        "FROM tags AS ref "
+        "INNER JOIN files AS refFile ON ref.fileId = refFile.id "
+        "WHERE ref.usr = ? AND ref.rowid > ?";
+    if (query.kind != "") {
+        sql += " AND ref.kind = ?";
+    }
+    if (query.declOnly) {
+        sql += " AND ref.isDecl";
+    }
+    if (query.path != "") {
+        sql += " AND refFile.name GLOB ?";
+    }
+    if (paginate) {
+        sql += " ORDER BY ref.rowid";
+        if (query.limit > 0) {
+            sql += " LIMIT ?";
+        }
+    }
+
+    Sqlite::Statement stmt = db_.prepare (sql.c_str());
+    stmt.bind (query.usr)
+        .bind (query.after);
+    if (query.kind != "") {
+        stmt.bind (query.kind);
+    }
+    if (query.path != "") {
+        stmt.bind (pathPattern);
+    }
+    if (paginate && query.limit > 0) {
+        stmt.bind (query.limit);
+    }
+    return stmt;
+}
+
+void Storage::grep (const GrepQuery & query,
+                    std::function<bool (const Reference & ref, int cursor)> fun) {
+    // Bound strings must outlive the statement
+    const std::string pathPattern = query.pathPattern();
     Sqlite::Statement stmt =
-        db_.prepare("SELECT ref.line1, ref.line2, ref.col1, ref.col2, "
-                "       ref.offset1, ref.offset2, refFile.name, ref.kind "
-                "FROM tags AS ref "
-                "INNER JOIN files AS refFile ON ref.fileId = refFile.id "
-                "WHERE ref.usr = ?")
-        .bind (usr);
+        grepStatement_ (query,
+                        "ref.rowid, ref.line1, ref.line2, ref.col1, ref.col2, "
+                        "ref.offset1, ref.offset2, refFile.name, ref.kind, ref.spelling",
+                        pathPattern, /*paginate=*/true);
 
-    std::vector<Storage::Reference> ret;
     while (stmt.step() == SQLITE_ROW) {
+        int cursor;
         Storage::Reference ref;
-        stmt >> ref.line1 >> ref.line2 >> ref.col1 >> ref.col2
-            >> ref.offset1 >> ref.offset2 >> ref.file >> ref.kind;
-        ret.push_back (ref);
+        stmt >> cursor >> ref.line1 >> ref.line2 >> ref.col1 >> ref.col2
+            >> ref.offset1 >> ref.offset2 >> ref.file >> ref.kind >> ref.spelling;
+        if (!fun (ref, cursor)) {
+            break;
+        }
+    }
+}
+
+int Storage::grepCount (const GrepQuery & query) {
+    const std::string pathPattern = query.pathPattern();
+    Sqlite::Statement stmt =
+        grepStatement_ (query, "count(*)", pathPattern, /*paginate=*/false);
+
+    int count = 0;
+    if (stmt.step() == SQLITE_ROW) {
+        stmt >> count;
+    }
+    return count;
+}
+
+std::vector<std::string> Storage::includingSources (const std::string & usr) {
+    // The include graph is stored flattened: each translation unit is linked
+    // to all files it includes, transitively
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT DISTINCT source.name FROM tags "
+                "INNER JOIN includes ON includes.includedId = tags.fileId "
+                "INNER JOIN files AS source ON source.id = includes.sourceId "
+                "WHERE tags.usr = ? AND tags.isDecl = 1 "
+                "ORDER BY source.name")
+        .bind (usr);
+
+    std::vector<std::string> res;
+    while (stmt.step() == SQLITE_ROW) {
+        std::string name;
+        stmt >> name;
+        res.push_back (name);
+    }
+    return res;
+}
+
+std::vector<std::string> Storage::includedFiles (const std::string & sourceFile) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT included.name FROM includes "
+                "INNER JOIN files AS source ON source.id = includes.sourceId "
+                "INNER JOIN files AS included ON included.id = includes.includedId "
+                "WHERE source.name = ?")
+        .bind (sourceFile);
+
+    std::vector<std::string> res (1, sourceFile);
+    while (stmt.step() == SQLITE_ROW) {
+        std::string name;
+        stmt >> name;
+        if (name != sourceFile) {
+            res.push_back (name);
+        }
+    }
+    return res;
+}
+
+int Storage::declarations (int after, int limit,
+                           std::function<void (int id, int fileId,
+                                               const std::string & usr,
+                                               const std::string & kind,
+                                               const std::string & spelling)> fun) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT rowid, fileId, usr, kind, spelling FROM tags "
+                "WHERE rowid > ? AND isDecl = 1 "
+                "ORDER BY rowid "
+                "LIMIT ?")
+        .bind (after)
+        .bind (limit);
+
+    int id = -1;
+    while (stmt.step() == SQLITE_ROW) {
+        int fileId;
+        std::string usr, kind, spelling;
+        stmt >> id >> fileId >> usr >> kind >> spelling;
+        fun (id, fileId, usr, kind, spelling);
+    }
+    return id;
+}
+
+int Storage::fileDeclarations (const std::string & fileName,
+                               std::function<void (int id, int fileId,
+                                                   const std::string & usr,
+                                                   const std::string & kind,
+                                                   const std::string & spelling)> fun) {
+    const int fileId = fileId_ (fileName);
+    if (fileId == -1) {
+        return -1;
+    }
+
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT rowid, usr, kind, spelling FROM tags "
+                "WHERE fileId = ? AND isDecl = 1 "
+                "ORDER BY rowid")
+        .bind (fileId);
+    while (stmt.step() == SQLITE_ROW) {
+        int id;
+        std::string usr, kind, spelling;
+        stmt >> id >> usr >> kind >> spelling;
+        fun (id, fileId, usr, kind, spelling);
+    }
+    return fileId;
+}
+
+bool Storage::declaration (int id, Definition & def) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT tags.usr, files.name, "
+                "       tags.line1, tags.line2, tags.col1, tags.col2, "
+                "       tags.kind, tags.spelling, tags.isVirtual "
+                "FROM tags "
+                "INNER JOIN files ON files.id = tags.fileId "
+                "WHERE tags.rowid = ? AND tags.isDecl = 1")
+        .bind (id);
+
+    if (stmt.step() != SQLITE_ROW) {
+        return false;
+    }
+    stmt >> def.usr >> def.file
+        >> def.line1 >> def.line2 >> def.col1 >> def.col2
+        >> def.kind >> def.spelling >> def.isVirtual;
+    return true;
+}
+
+bool Storage::definition (const std::string & usr, Definition & def) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT tags.usr, files.name, "
+                "       tags.line1, tags.line2, tags.col1, tags.col2, "
+                "       tags.kind, tags.spelling, tags.isVirtual "
+                "FROM tags "
+                "INNER JOIN files ON files.id = tags.fileId "
+                "WHERE tags.usr = ? AND tags.isDecl = 1 "
+                "ORDER BY tags.line2 > tags.line1 DESC "
+                "LIMIT 1")
+        .bind (usr);
+
+    if (stmt.step() != SQLITE_ROW) {
+        return false;
+    }
+    stmt >> def.usr >> def.file
+        >> def.line1 >> def.line2 >> def.col1 >> def.col2
+        >> def.kind >> def.spelling >> def.isVirtual;
+    return true;
+}
+
+int Storage::calls (int after, int limit,
+                    std::function<void (const std::string & caller,
+                                        const std::string & callee)> fun) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT rowid, callerUsr, calleeUsr FROM calls "
+                "WHERE rowid > ? "
+                "ORDER BY rowid "
+                "LIMIT ?")
+        .bind (after)
+        .bind (limit);
+
+    int id = -1;
+    while (stmt.step() == SQLITE_ROW) {
+        std::string caller, callee;
+        stmt >> id >> caller >> callee;
+        fun (caller, callee);
+    }
+    return id;
+}
+
+int Storage::bases (int after, int limit,
+                    std::function<void (const std::string & usr,
+                                        const std::string & base)> fun) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT rowid, usr, baseUsr FROM bases "
+                "WHERE rowid > ? "
+                "ORDER BY rowid "
+                "LIMIT ?")
+        .bind (after)
+        .bind (limit);
+
+    int id = -1;
+    while (stmt.step() == SQLITE_ROW) {
+        std::string usr, base;
+        stmt >> id >> usr >> base;
+        fun (usr, base);
+    }
+    return id;
+}
+
+void Storage::setDiagnostics (const std::string & sourceFile,
+                              const std::vector<Diagnostic> & diagnostics) {
+    int sourceId = fileId_ (sourceFile);
+    if (sourceId == -1) {
+        return;
+    }
+
+    // Translation units may be re-parsed while the index is being updated, in
+    // which case a transaction is already open
+    Sqlite::Savepoint savepoint (db_, "setDiagnostics");
+    db_.prepare ("DELETE FROM diagnostics WHERE sourceId = ?")
+        .bind (sourceId)
+        .step();
+
+    Json::FastWriter writer;
+    for (auto it = diagnostics.begin() ; it != diagnostics.end() ; ++it) {
+        const std::string fixIts = writer.write (it->fixIts);
+        db_.prepare ("INSERT INTO diagnostics VALUES (?,?,?,?,?,?,?,?,?,?,?)")
+            .bind (sourceId)   .bind (it->file)  .bind (it->severity)
+            .bind (it->line1)  .bind (it->col1)  .bind (it->offset1)
+            .bind (it->line2)  .bind (it->col2)  .bind (it->offset2)
+            .bind (it->message) .bind (fixIts)
+            .step();
+    }
+}
+
+void Storage::diagnostics (const std::string & fileName,
+                           const std::set<std::string> & skippedSources,
+                           std::function<void (const Diagnostic & diagnostic)> fun) {
+    std::set<int> skipped;
+    for (auto it = skippedSources.begin() ; it != skippedSources.end() ; ++it) {
+        const int sourceId = fileId_ (*it);
+        if (sourceId != -1) {
+            skipped.insert (sourceId);
+        }
+    }
+
+    // Separate statements let the file index be used when listing one file
+    Sqlite::Statement stmt = fileName.empty()
+        ? db_.prepare ("SELECT sourceId, file, severity, line1, col1, offset1, "
+                "       line2, col2, offset2, message, fixIts "
+                "FROM diagnostics "
+                "ORDER BY file, offset1")
+        : db_.prepare ("SELECT sourceId, file, severity, line1, col1, offset1, "
+                "       line2, col2, offset2, message, fixIts "
+                "FROM diagnostics "
+                "WHERE file = ? "
+                "ORDER BY offset1")
+          .bind (fileName);
+
+    // Identical diagnostics emitted for several translation units are output
+    // once. Rows being sorted, they all have the same file and offset.
+    std::set<std::string> seen;
+    std::string seenFile;
+    int seenOffset = -1;
+
+    Json::Reader reader;
+    while (stmt.step() == SQLITE_ROW) {
+        int sourceId;
+        Diagnostic diag;
+        std::string fixIts;
+        stmt >> sourceId >> diag.file >> diag.severity
+             >> diag.line1 >> diag.col1 >> diag.offset1
+             >> diag.line2 >> diag.col2 >> diag.offset2
+             >> diag.message >> fixIts;
+        if (skipped.count (sourceId) > 0) {
+            continue;
+        }
+
+        if (diag.file != seenFile || diag.offset1 != seenOffset) {
+            seen.clear();
+            seenFile   = diag.file;
+            seenOffset = diag.offset1;
+        }
+        std::ostringstream key;
+        key << diag.severity << '\0' << diag.line1 << ':' << diag.col1
+            << '-' << diag.line2 << ':' << diag.col2 << ':' << diag.offset2
+            << '\0' << diag.message << '\0' << fixIts;
+        if (!seen.insert (key.str()).second) {
+            continue;
+        }
+
+        reader.parse (fixIts, diag.fixIts);
+        fun (diag);
+    }
+}
+
+Storage::MergeStats Storage::merge (const std::string & shardPath) {
+    MergeStats stats;
+
+    // Attaching a missing database would silently create an empty one
+    struct stat fileStat;
+    if (stat (shardPath.c_str(), &fileStat) != 0) {
+        throw std::runtime_error ("cannot find shard `" + shardPath + "'");
+    }
+
+    {
+        Attachment attachment (db_, shardPath, "shard");
+
+        // Nothing is written before the shard schema is known to be current
+        const char * const tables[] = {"files", "tags", "includes", "commands",
+                                       "argsets", "overriden_methods"};
+        for (auto table = std::begin (tables) ; table != std::end (tables) ; ++table) {
+            if (!hasTable (db_, "shard", *table)) {
+                throw std::runtime_error ("`" + shardPath + "' is not an index database");
+            }
+        }
+        if (!hasColumn (db_, "shard", "commands", "argsetId")) {
+            throw std::runtime_error ("`" + shardPath + "' uses a legacy schema:"
+                                      " update it with this version first");
+        }
+
+        // Changes are rolled back and temporary tables dropped on any error
+        Sqlite::Transaction transaction (db_);
+
+        // Unify file ids: every shard file gets an id in the main database
+        db_.execute ("INSERT INTO main.files (name, indexed) "
+                "SELECT name, 0 FROM shard.files "
+                "WHERE name NOT IN (SELECT name FROM main.files)");
+        TempTable fileMap (db_, "fileMap");
+        db_.execute ("CREATE TEMP TABLE fileMap AS "
+                "SELECT shardFile.id AS shardId, mainFile.id AS mainId, "
+                "       shardFile.indexed AS indexed, "
+                "       shardFile.indexed > mainFile.indexed AS newer "
+                "FROM shard.files AS shardFile "
+                "INNER JOIN main.files AS mainFile ON mainFile.name = shardFile.name");
+        db_.execute ("CREATE INDEX temp.fileMap_index ON fileMap (shardId)");
+
+        // Tags are taken per file, from the most recently indexed copy. Headers
+        // indexed by several shards are thus only stored once. So are file
+        // contents trigrams, call and inheritance edges, and diagnostics (per
+        // translation unit).
+        mergeNewerRows (db_, "tags", "fileId",
+                        "usr, kind, spelling, line1, col1, offset1, "
+                        "line2, col2, offset2, isDecl, isVirtual");
+        mergeNewerRows (db_, "fileTrigrams", "fileId", "trigrams");
+        mergeNewerRows (db_, "calls", "fileId", "callerUsr, calleeUsr, offset");
+        mergeNewerRows (db_, "bases", "fileId", "usr, baseUsr");
+        mergeNewerRows (db_, "diagnostics", "sourceId",
+                        "file, severity, line1, col1, offset1, "
+                        "line2, col2, offset2, message, fixIts");
+        db_.execute ("UPDATE main.files "
+                "SET indexed = (SELECT indexed FROM fileMap WHERE mainId = main.files.id) "
+                "WHERE id IN (SELECT mainId FROM fileMap WHERE newer)");
+
+        {
+            Sqlite::Statement count = db_.prepare ("SELECT count(*), sum(newer) FROM fileMap");
+            count.step();
+            count >> stats.files >> stats.updatedFiles;
+        }
+
+        // The include graph is the union of all shards' graphs
+        db_.execute ("INSERT INTO main.includes "
+                "SELECT DISTINCT source.mainId, included.mainId "
+                "FROM shard.includes "
+                "INNER JOIN fileMap AS source   ON source.shardId   = shard.includes.sourceId "
+                "INNER JOIN fileMap AS included ON included.shardId = shard.includes.includedId "
+                "WHERE NOT EXISTS (SELECT 1 FROM main.includes "
+                "                  WHERE sourceId = source.mainId "
+                "                    AND includedId = included.mainId)");
+
+        // Compilation commands from the shard replace existing ones
+        db_.execute ("INSERT OR IGNORE INTO main.argsets (directory, args) "
+                "SELECT directory, args FROM shard.argsets");
+        db_.execute ("DELETE FROM main.commands "
+                "WHERE fileId IN (SELECT fileMap.mainId FROM shard.commands "
+                "                 INNER JOIN fileMap ON fileMap.shardId = shard.commands.fileId)");
+        db_.execute ("INSERT INTO main.commands "
+                "SELECT fileMap.mainId, mainArgs.id "
+                "FROM shard.commands "
+                "INNER JOIN fileMap ON fileMap.shardId = shard.commands.fileId "
+                "INNER JOIN shard.argsets AS shardArgs ON shardArgs.id = shard.commands.argsetId "
+                "INNER JOIN main.argsets AS mainArgs "
+                "        ON mainArgs.directory = shardArgs.directory "
+                "       AND mainArgs.args = shardArgs.args");
+
+        // USRs are global identifiers: identical USRs coming from different
+        // shards denote the same symbol, so that overriding relations only
+        // need to be de-duplicated.
+        db_.execute ("INSERT INTO main.overriden_methods "
+                "SELECT usr, overriden_usr FROM shard.overriden_methods "
+                "EXCEPT "
+                "SELECT usr, overriden_usr FROM main.overriden_methods");
+    }
+
+    fileArgsets_.clear();
+
+    // Any file may have changed
+    resetGeneration_ = nextGeneration_();
+    fileGenerations_.clear();
+    return stats;
+}
+
+std::vector<Storage::File> Storage::files () {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT id, name, indexed FROM files");
+
+    std::vector<Storage::File> ret;
+    while (stmt.step() == SQLITE_ROW) {
+        Storage::File file;
+        stmt >> file.id >> file.name >> file.indexed;
+        ret.push_back (file);
+    }
+    return ret;
+}
+
+std::vector<Storage::Tag> Storage::fileTags (int fileId) {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT usr, kind, spelling, "
+                "       line1, col1, offset1, line2, col2, offset2, "
+                "       isDecl, isVirtual "
+                "FROM tags "
+                "WHERE fileId = ? "
+                "ORDER BY offset1, offset2")
+        .bind (fileId);
+
+    std::vector<Storage::Tag> ret;
+    while (stmt.step() == SQLITE_ROW) {
+        Storage::Tag tag;
+        stmt >> tag.usr >> tag.kind >> tag.spelling
+            >> tag.line1 >> tag.col1 >> tag.offset1
+            >> tag.line2 >> tag.col2 >> tag.offset2
+            >> tag.isDecl >> tag.isVirtual;
+        ret.push_back (tag);
+    }
+    return ret;
+}
+
+std::vector<std::pair<int, int> > Storage::includes () {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT sourceId, includedId FROM includes");
+
+    std::vector<std::pair<int, int> > ret;
+    while (stmt.step() == SQLITE_ROW) {
+        int sourceId, includedId;
+        stmt >> sourceId >> includedId;
+        ret.push_back (std::make_pair (sourceId, includedId));
+    }
+    return ret;
+}
+
+std::vector<std::string> Storage::sourceFiles () {
+    Sqlite::Statement stmt =
+        db_.prepare ("SELECT files.name "
+                "FROM commands "
+                "INNER JOIN files ON files.id = commands.fileId");
+
+    std::vector<std::string> ret;
+    while (stmt.step() == SQLITE_ROW) {
+        std::string name;
+        stmt >> name;
+        ret.push_back (name);
     }
     return ret;
 }
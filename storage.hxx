@@ -5,7 +5,12 @@
 
 #include <sys/stat.h>
 #include <unistd.h>
+#include <set>
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
 #include <sstream>
 #include <iostream>
 
@@ -17,14 +22,82 @@ public:
                          const std::string & directory,
                          const std::vector<std::string> & args);
 
-  void getCompileCommand (const std::string & fileName,
-                          std::string & directory,
-                          std::vector<std::string> & args);
+  // Get the compilation command for a file (header files get the command of a
+  // source file including them). Returns the argument set id: files sharing it
+  // are compiled with the same flags in the same directory.
+  int getCompileCommand (const std::string & fileName,
+                         std::string & directory,
+                         std::vector<std::string> & args);
+
+  struct CompileCommand {
+    std::string fileName;
+    std::string directory;
+    std::vector<std::string> args;
+  };
+
+  // All stored compilation commands, by source file name
+  std::unordered_map<std::string, CompileCommand> compileCommands ();
+
+  // Store compilation commands in bulk, replacing existing ones
+  void setCompileCommands (const std::vector<CompileCommand> & commands);
 
-  std::string nextFile ();
+  // Next source file to (re-)index, or "" if the index is up to date. Sources
+  // needed to update the preferred files come first.
+  std::string nextFile (const std::vector<std::string> & preferred = std::vector<std::string>());
+
+  // Next source file to (re-)index in order to update fileName (a source or
+  // header), or "" if it is up to date
+  std::string nextFileFor (const std::string & fileName);
 
   void cleanIndex () ;
 
+  // Index generation, incremented each time tags change. The generations of
+  // the last change of each file and USR are recorded too, so that cached
+  // results can be checked for validity (see ResultCache). It is stored in the
+  // database, so that it keeps increasing across server restarts.
+  unsigned long generation () const {
+    return generation_;
+  }
+
+  // Generation of the last change of the tags in a file
+  unsigned long fileGeneration (const std::string & fileName) const {
+    auto it = fileGenerations_.find (fileName);
+    return std::max (resetGeneration_,
+                     it == fileGenerations_.end() ? 0 : it->second);
+  }
+
+  // Generation of the last tag added or removed for a USR. USRs are hashed into
+  // a fixed number of buckets: the result may be too recent, never too old.
+  unsigned long usrGeneration (const std::string & usr) const {
+    return std::max (resetGeneration_,
+                     usrGenerations_[std::hash<std::string>() (usr) % usrBuckets_]);
+  }
+
+  // Generation of the last change of the include graph
+  unsigned long includesGeneration () const {
+    return std::max (resetGeneration_, includesGeneration_);
+  }
+
+  // Files whose tags changed since a given generation. Returns false if any
+  // file may have changed (e.g. after cleanIndex() or merge()).
+  bool changedFiles (unsigned long generation, std::vector<std::string> & files) const;
+
+  // Sorted trigrams of the contents of a file, computed when it is indexed
+  // (see TextIndex) and dropped by beginFile() when the file changed
+  void setFileTrigrams (const std::string & fileName, const std::vector<uint32_t> & trigrams);
+
+  // Returns false if the contents of the file are not indexed; indexed is the
+  // modification time of the file when it was indexed
+  bool fileTrigrams (const std::string & fileName, std::vector<uint32_t> & trigrams,
+                     time_t & indexed);
+
+  // Scan file trigrams after a given file id (0 to start), with NULL trigrams
+  // for files whose contents are not indexed. Returns the last id, or -1.
+  int fileTrigrams (int after, int limit,
+                    std::function<void (const std::string & fileName,
+                                        const std::vector<uint32_t> * trigrams,
+                                        time_t indexed)> fun);
+
   Sqlite::Transaction beginTransaction () {
     return Sqlite::Transaction(db_);
   }
@@ -48,6 +121,15 @@ public:
                bool isDeclaration, bool isVirtual,
                const std::vector<std::string> overriden_usrs);
 
+  // Record a call from caller to callee at a given offset of fileName
+  void addCall (const std::string & caller, const std::string & callee,
+                const std::string & fileName, int offset);
+
+  // Record that a class derives from another, or that a method overrides
+  // another
+  void addBase (const std::string & usr, const std::string & base,
+                const std::string & fileName);
+
   struct Reference {
     std::string file;
     int line1;
@@ -118,7 +200,158 @@ public:
   std::vector<RefDef> findOverridenDefinition (const std::string fileName, const std::string usr);
   std::vector<Reference> findOverridenDefinition(const std::string usr);
 
-  std::vector<Reference> grep (const std::string usr);
+  // All references in a file starting in [begin, end) (end = -1 for the end of
+  // file), by offset, with one declaration of each referenced symbol
+  void fileSymbols (const std::string & fileName, int begin, int end,
+                    std::function<void (const RefDef & refDef)> fun);
+
+  // Filters and pagination for grep()
+  struct GrepQuery {
+    std::string usr;       // USR of the referenced symbol
+    std::string kind;      // only references of this cursor kind (if not empty)
+    bool        declOnly;  // only declarations
+    std::string path;      // path prefix, or glob pattern if it contains "*?["
+    int         after;     // cursor of the last reference of the previous page
+    int         limit;     // maximum number of references (0 = unlimited)
+
+    // GLOB pattern corresponding to path
+    std::string pathPattern () const {
+      return path.find_first_of ("*?[") == std::string::npos
+        ? path + "*"
+        : path;
+    }
+  };
+
+  // Stream the references to a symbol, in a stable order, with their
+  // pagination cursor. Returning false from fun stops the search.
+  void grep (const GrepQuery & query,
+             std::function<bool (const Reference & ref, int cursor)> fun);
+
+  // Count the references to a symbol (query.limit is ignored)
+  int grepCount (const GrepQuery & query);
+
+  // Sorted source files of the translation units which include, directly or
+  // not, a file in which the symbol is declared
+  std::vector<std::string> includingSources (const std::string & usr);
+
+  // Files included by a translation unit, directly or not, including the
+  // source file itself
+  std::vector<std::string> includedFiles (const std::string & sourceFile);
+
+  // Scan at most limit declarations with an id greater than after, so that
+  // in-memory indices can be built in short steps (see SymbolIndex). Returns
+  // the last id scanned, or -1 if there is none left.
+  int declarations (int after, int limit,
+                    std::function<void (int id, int fileId,
+                                        const std::string & usr,
+                                        const std::string & kind,
+                                        const std::string & spelling)> fun);
+
+  // Scan the declarations of a file, to update indices built by declarations().
+  // Returns the file id, or -1 if the file is not indexed.
+  int fileDeclarations (const std::string & fileName,
+                        std::function<void (int id, int fileId,
+                                            const std::string & usr,
+                                            const std::string & kind,
+                                            const std::string & spelling)> fun);
+
+  // Declaration given by its id; false if it is not in the index anymore
+  bool declaration (int id, Definition & def);
+
+  // A declaration of a symbol, preferably a definition (i.e. one spanning
+  // several lines); false if none is indexed
+  bool definition (const std::string & usr, Definition & def);
+
+  // Scan call edges by increasing id, in short steps (see CallGraph). Returns
+  // the last id scanned, or -1 if there is none left.
+  int calls (int after, int limit,
+             std::function<void (const std::string & caller,
+                                 const std::string & callee)> fun);
+
+  // Scan inheritance and overriding edges by increasing id, in short steps
+  // (see ClassHierarchy). Returns the last id scanned, or -1 if there is none
+  // left.
+  int bases (int after, int limit,
+             std::function<void (const std::string & usr,
+                                 const std::string & base)> fun);
+
+  // Compiler diagnostic, as stored in the index
+  struct Diagnostic {
+    std::string file;
+    std::string severity;  // "note", "warning", "error" or "fatal"
+    int line1;
+    int col1;
+    int offset1;
+    int line2;
+    int col2;
+    int offset2;
+    std::string message;
+    Json::Value fixIts;    // array of {line1, col1, offset1, line2, col2,
+                           //           offset2, replacement} objects
+
+    Json::Value json () const {
+      Json::Value json;
+      json["file"]     = file;
+      json["severity"] = severity;
+      json["line1"]    = line1;
+      json["col1"]     = col1;
+      json["offset1"]  = offset1;
+      json["line2"]    = line2;
+      json["col2"]     = col2;
+      json["offset2"]  = offset2;
+      json["message"]  = message;
+      json["fixIts"]   = fixIts;
+      return json;
+    }
+  };
+
+  // Replace the diagnostics of a translation unit, in any file
+  void setDiagnostics (const std::string & sourceFile,
+                       const std::vector<Diagnostic> & diagnostics);
+
+  // Stored diagnostics, by file and offset, in fileName (all files if empty).
+  // Diagnostics in headers are output once, and those of skippedSources are
+  // skipped.
+  void diagnostics (const std::string & fileName,
+                    const std::set<std::string> & skippedSources,
+                    std::function<void (const Diagnostic & diagnostic)> fun);
+
+  struct File {
+    int id;
+    std::string name;
+    int indexed;
+  };
+
+  struct Tag {
+    std::string usr;
+    std::string kind;
+    std::string spelling;
+    int line1;
+    int col1;
+    int offset1;
+    int line2;
+    int col2;
+    int offset2;
+    int isDecl;
+    int isVirtual;
+  };
+
+  struct MergeStats {
+    int files;
+    int updatedFiles;
+  };
+
+  // Merge another index database into this one. File ids are unified by name,
+  // and the most recently indexed copy of each file wins.
+  MergeStats merge (const std::string & shardPath);
+
+  std::vector<File> files ();
+
+  std::vector<Tag> fileTags (int fileId);
+
+  std::vector<std::pair<int, int> > includes ();
+
+  std::vector<std::string> sourceFiles ();
 
   void setOption (const std::string & name, const std::string & value);
 
@@ -130,15 +363,43 @@ public:
   std::vector<std::string> getOption (const std::string & name, const Vector & v);
 
 private:
+  struct ArgSet {
+    std::string directory;
+    std::vector<std::string> args;
+  };
+
+  void migrateCommands_ ();
+
+  const ArgSet & argset_ (int argsetId);
+
   int fileId_ (const std::string & fileName);
 
   int addFile_ (const std::string & fileName);
 
+  Sqlite::Statement grepStatement_ (const GrepQuery & query, const std::string & columns,
+                                    const std::string & pathPattern, bool paginate);
+
   std::string serialize_ (const std::vector<std::string> & v);
 
   void deserialize_ (const std::string & s, std::vector<std::string> & v);
 
+  unsigned long nextGeneration_ ();
+  void fileChanged_ (const std::string & fileName, int fileId);
+  void usrChanged_ (const std::string & usr);
+
   Sqlite::Database db_;
+
+  // Index generations
+  enum { usrBuckets_ = 65536 };
+  unsigned long generation_;
+  unsigned long resetGeneration_;
+  unsigned long includesGeneration_;
+  std::unordered_map<std::string, unsigned long> fileGenerations_;
+  std::vector<unsigned long> usrGenerations_;
+
+  // In-memory compilation commands store
+  std::unordered_map<std::string, int> fileArgsets_;
+  std::unordered_map<int, ArgSet>      argsets_;
   /*
   Sqlite::Statement preparedDeleteFileFromCommand;
   Sqlite::Statement preparedInsertIntoCommands;
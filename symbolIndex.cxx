@@ -0,0 +1,313 @@
+#include "symbolIndex.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+  std::string lower (const std::string & s) {
+    std::string res (s);
+    for (size_t i = 0 ; i < res.size() ; ++i) {
+      res[i] = tolower (res[i]);
+    }
+    return res;
+  }
+
+  // Characters are folded to 6 bits: letters, digits and underscores get
+  // distinct codes, and other characters share the remaining ones. Collisions
+  // only produce candidates which do not actually match.
+  unsigned int charCode (char c) {
+    if (c >= 'a' && c <= 'z') return 1 + (c - 'a');
+    if (c >= '0' && c <= '9') return 27 + (c - '0');
+    if (c == '_')             return 37;
+    return 38 + (unsigned char)c % 26;
+  }
+
+  uint32_t trigram (const char * s) {
+    return (charCode (s[0]) << 12) | (charCode (s[1]) << 6) | charCode (s[2]);
+  }
+
+  bool startsWith (const char * s, size_t length, const std::string & prefix) {
+    return length >= prefix.size()
+      && std::memcmp (s, prefix.data(), prefix.size()) == 0;
+  }
+
+  size_t find (const char * s, size_t length, const std::string & needle) {
+    const char * end = s + length;
+    const char * it = std::search (s, end, needle.begin(), needle.end());
+    return it == end ? std::string::npos : it - s;
+  }
+
+  // Number of characters skipped to match the query as a subsequence of the
+  // name, or -1 if it does not match
+  int gaps (const char * s, size_t length, const std::string & query) {
+    int gaps = 0;
+    size_t j = 0;
+    for (size_t i = 0 ; i < query.size() ; ++i, ++j) {
+      const size_t start = j;
+      while (j < length && s[j] != query[i]) {
+        ++j;
+      }
+      if (j == length) {
+        return -1;
+      }
+      gaps += j - start;
+    }
+    return gaps;
+  }
+
+  // Identifiers are made of words separated by underscores, scope operators
+  // or case changes
+  bool wordBoundary (const char * name, size_t pos) {
+    if (pos == 0) {
+      return true;
+    }
+    const char prev = name[pos-1];
+    return prev == '_' || prev == ':'
+      || (islower (prev) && isupper (name[pos]));
+  }
+
+  enum Score {
+    EXACT     = 0,
+    PREFIX    = 1,
+    WORD      = 2,
+    SUBSTRING = 3,
+    FUZZY     = 4  // + number of gaps
+  };
+}
+
+SymbolIndex::SymbolIndex () { }
+
+void SymbolIndex::add (int id, int file, const std::string & usr,
+                       const std::string & kind, const std::string & name) {
+  if (name == "" || !usrs_.insert (std::hash<std::string>() (usr)).second) {
+    return;
+  }
+
+  auto it = kindIndex_.find (kind);
+  if (it == kindIndex_.end()) {
+    it = kindIndex_.insert (std::make_pair (kind, (uint32_t)kinds_.size())).first;
+    kinds_.push_back (kind);
+  }
+
+  Symbol_ symbol;
+  symbol.offset = names_.size();
+  symbol.length = name.size();
+  symbol.kind   = it->second;
+  symbol.id     = id;
+  symbol.file   = file;
+  symbols_.push_back (symbol);
+  names_ += name;
+}
+
+void SymbolIndex::finish () {
+  std::unordered_set<size_t>().swap (usrs_);
+  lowerNames_ = lower (names_);
+
+  // Sort by lower-case name
+  std::sort (symbols_.begin(), symbols_.end(),
+             [this] (const Symbol_ & a, const Symbol_ & b) {
+               const int cmp = std::memcmp (lower_ (a), lower_ (b),
+                                            std::min (a.length, b.length));
+               if (cmp != 0)
+                 return cmp < 0;
+               if (a.length != b.length)
+                 return a.length < b.length;
+               return a.id < b.id;
+             });
+
+  // Build posting lists in two passes (count, then fill), so that all of
+  // them fit in a single array. Symbols are visited in order, hence the lists
+  // are sorted.
+  std::vector<uint32_t> nameTrigrams;
+  trigrams_.assign (trigramCount_ + 1, 0);
+  for (auto it = symbols_.begin() ; it != symbols_.end() ; ++it) {
+    nameTrigrams_ (*it, nameTrigrams);
+    for (auto t = nameTrigrams.begin() ; t != nameTrigrams.end() ; ++t) {
+      ++trigrams_[*t + 1];
+    }
+  }
+  for (uint32_t t = 0 ; t < trigramCount_ ; ++t) {
+    trigrams_[t + 1] += trigrams_[t];
+  }
+
+  postings_.resize (trigrams_[trigramCount_]);
+  std::vector<uint32_t> next (trigrams_.begin(), trigrams_.end() - 1);
+  for (uint32_t i = 0 ; i < symbols_.size() ; ++i) {
+    nameTrigrams_ (symbols_[i], nameTrigrams);
+    for (auto t = nameTrigrams.begin() ; t != nameTrigrams.end() ; ++t) {
+      postings_[next[*t]++] = i;
+    }
+  }
+}
+
+void SymbolIndex::nameTrigrams_ (const Symbol_ & symbol, std::vector<uint32_t> & res) const {
+  res.clear();
+  for (uint32_t i = 0 ; i + 3 <= symbol.length ; ++i) {
+    res.push_back (trigram (lower_ (symbol) + i));
+  }
+  std::sort (res.begin(), res.end());
+  res.erase (std::unique (res.begin(), res.end()), res.end());
+}
+
+std::pair<uint32_t, uint32_t> SymbolIndex::prefixRange_ (const std::string & prefix) const {
+  auto begin = std::partition_point (symbols_.begin(), symbols_.end(),
+                                     [&] (const Symbol_ & symbol) {
+                                       const int cmp = std::memcmp (lower_ (symbol), prefix.data(),
+                                                                    std::min<size_t> (symbol.length,
+                                                                                      prefix.size()));
+                                       return cmp < 0 || (cmp == 0 && symbol.length < prefix.size());
+                                     });
+  auto end = std::partition_point (begin, symbols_.end(),
+                                   [&] (const Symbol_ & symbol) {
+                                     return startsWith (lower_ (symbol), symbol.length, prefix);
+                                   });
+  return std::make_pair (begin - symbols_.begin(), end - symbols_.begin());
+}
+
+std::vector<SymbolIndex::Match> SymbolIndex::search (const std::string & query,
+                                                     const std::string & kind,
+                                                     size_t limit,
+                                                     std::function<void()> check,
+                                                     const std::unordered_set<int> & hidden) const {
+  std::vector<Match> matches;
+  const std::string q = lower (query);
+  if (q == "") {
+    return matches;
+  }
+
+  uint32_t kindFilter = 0;
+  if (kind != "") {
+    auto it = kindIndex_.find (kind);
+    if (it == kindIndex_.end()) {
+      return matches;
+    }
+    kindFilter = it->second;
+  }
+
+  // All kinds of matches share the same budget of examined candidates
+  std::vector<Ranked_> ranked;
+  uint32_t budget = maxScanned_;
+  auto accept = [&] (uint32_t i, int score) {
+    if ((kind == "" || symbols_[i].kind == kindFilter)
+        && (hidden.empty() || hidden.count (symbols_[i].file) == 0)) {
+      ranked.push_back (Ranked_ (score, i));
+    }
+  };
+  auto step = [&] () {
+    if (budget == 0) {
+      return false;
+    }
+    if (check && budget % 256 == 0) {
+      check();
+    }
+    --budget;
+    return true;
+  };
+  auto enough = [&] () {
+    return limit > 0 && ranked.size() >= limit;
+  };
+
+  // Exact and prefix matches
+  auto range = prefixRange_ (q);
+  for (uint32_t i = range.first ; i < range.second && step() ; ++i) {
+    accept (i, symbols_[i].length == q.size() ? EXACT : PREFIX);
+  }
+
+  // Substring matches: intersect the posting lists of all trigrams in the
+  // query, starting with the shortest one
+  const bool substrings = q.size() >= 3 && !enough();
+  if (substrings) {
+    typedef std::pair<const uint32_t *, const uint32_t *> List;
+    std::vector<List> lists;
+    for (size_t i = 0 ; i + 3 <= q.size() ; ++i) {
+      const uint32_t t = trigram (q.data() + i);
+      lists.push_back (List (postings_.data() + trigrams_[t],
+                             postings_.data() + trigrams_[t + 1]));
+    }
+    std::sort (lists.begin(), lists.end(),
+               [] (const List & a, const List & b) {
+                 return a.second - a.first < b.second - b.first;
+               });
+
+    for (const uint32_t * it = lists[0].first ; it != lists[0].second && step() ; ++it) {
+      const uint32_t i = *it;
+      bool inAll = true;
+      for (size_t l = 1 ; inAll && l < lists.size() ; ++l) {
+        inAll = std::binary_search (lists[l].first, lists[l].second, i);
+      }
+      if (!inAll) {
+        continue;
+      }
+
+      // Trigrams may appear in a different order in the name
+      const Symbol_ & symbol = symbols_[i];
+      const size_t pos = find (lower_ (symbol), symbol.length, q);
+      if (pos == std::string::npos || pos == 0) {
+        continue;
+      }
+      accept (i, wordBoundary (names_.data() + symbol.offset, pos) ? WORD : SUBSTRING);
+    }
+  }
+
+  // Fuzzy matches, only if needed
+  const bool fuzzy = !enough();
+  if (fuzzy) {
+    auto range = prefixRange_ (q.substr (0, 1));
+    for (uint32_t i = range.first ; i < range.second && step() ; ++i) {
+      const Symbol_ & symbol = symbols_[i];
+      const int g = gaps (lower_ (symbol), symbol.length, q);
+      if (g > 0) {
+        accept (i, FUZZY + g);
+      }
+    }
+  }
+
+  // Symbols found as both substring and fuzzy matches only keep their best
+  // score
+  if (substrings && fuzzy) {
+    std::sort (ranked.begin(), ranked.end(),
+               [] (const Ranked_ & a, const Ranked_ & b) {
+                 return a.second < b.second || (a.second == b.second && a.first < b.first);
+               });
+    ranked.erase (std::unique (ranked.begin(), ranked.end(),
+                               [] (const Ranked_ & a, const Ranked_ & b) {
+                                 return a.second == b.second;
+                               }),
+                  ranked.end());
+  }
+
+  // Best score first, then shortest names, then alphabetical order
+  const size_t count = (limit > 0 && limit < ranked.size()) ? limit : ranked.size();
+  std::partial_sort (ranked.begin(), ranked.begin() + count, ranked.end(),
+                     [this] (const Ranked_ & a, const Ranked_ & b) {
+                       if (a.first != b.first)
+                         return a.first < b.first;
+                       const uint32_t la = symbols_[a.second].length;
+                       const uint32_t lb = symbols_[b.second].length;
+                       if (la != lb)
+                         return la < lb;
+                       return a.second < b.second;
+                     });
+
+  matches.reserve (count);
+  for (size_t i = 0 ; i < count ; ++i) {
+    const Symbol_ & symbol = symbols_[ranked[i].second];
+    Match match;
+    match.id    = symbol.id;
+    match.name  = names_.substr (symbol.offset, symbol.length);
+    match.kind  = kinds_[symbol.kind];
+    match.score = ranked[i].first;
+    matches.push_back (match);
+  }
+  return matches;
+}
+
+size_t SymbolIndex::memoryUsage () const {
+  // Hash set nodes are counted as a value and two pointers
+  return names_.capacity() + lowerNames_.capacity()
+    + symbols_.capacity() * sizeof (Symbol_)
+    + trigrams_.capacity() * sizeof (uint32_t)
+    + postings_.capacity() * sizeof (uint32_t)
+    + usrs_.size() * (sizeof (size_t) + 2 * sizeof (void*));
+}
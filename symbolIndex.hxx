@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/** @brief In-memory index of declared symbol names
+ *
+ * Symbols are added one by one (typically by chunks of declarations read from
+ * the index database, see Storage::declarations()), then the index is frozen
+ * by finish() before being searched. It is made of:
+ * - a string pool holding the names of all symbols, and their lower-case
+ *   versions,
+ * - a symbol table, sorted by lower-case name, where symbols whose names
+ *   start with a given prefix form a contiguous range,
+ * - posting lists giving, for each trigram (3 consecutive lower-case
+ *   characters), the sorted list of symbols whose names contain it. Posting
+ *   lists are stored contiguously, and indexed by a table of all possible
+ *   trigrams (characters are folded to 6 bits, see symbolIndex.cxx).
+ *
+ * Searches are case-insensitive. Matches are ranked as follows: exact names
+ * first, then prefixes, then substrings (starting at a word boundary first),
+ * then fuzzy matches (subsequences starting with the same character, with as
+ * few gaps as possible). Ties are broken by name length.
+ */
+class SymbolIndex {
+public:
+  /** @brief Search result */
+  struct Match {
+    int         id;     /**< @brief declaration id (see Storage::declaration()) */
+    std::string name;
+    std::string kind;
+    int         score;  /**< @brief rank of the match (lower is better) */
+  };
+
+  SymbolIndex ();
+
+  /** @brief Add a symbol to the index
+   *
+   * Only the first declaration of each USR is kept.
+   *
+   * @param id    declaration id
+   * @param file  id of the file containing the declaration
+   * @param usr   USR of the declared symbol
+   * @param kind  cursor kind of the declaration
+   * @param name  spelling of the declaration
+   */
+  void add (int id, int file, const std::string & usr,
+            const std::string & kind, const std::string & name);
+
+  /** @brief Sort symbols and build posting lists
+   *
+   * This must be called once, after all symbols have been added.
+   */
+  void finish ();
+
+  /** @brief Search symbols by name
+   *
+   * The number of examined candidates is bounded, so that searches stay fast
+   * even for very short queries. Weaker kinds of matches are not looked for
+   * once enough matches have been found.
+   *
+   * @param query  (part of) the name to look for
+   * @param kind   only symbols of this kind (if not empty)
+   * @param limit  maximum number of matches (0 = unlimited)
+   * @param check  function called periodically, which may throw to abandon
+   *               the search
+   * @param hidden  ids of files whose symbols are ignored
+   *
+   * @return the best matches, best first
+   */
+  std::vector<Match> search (const std::string & query, const std::string & kind,
+                             size_t limit,
+                             std::function<void()> check = std::function<void()>(),
+                             const std::unordered_set<int> & hidden = std::unordered_set<int>()) const;
+
+  /** @brief Number of distinct symbols in the index
+   */
+  size_t size () const {
+    return symbols_.size();
+  }
+
+  /** @brief Estimated memory usage, in bytes
+   */
+  size_t memoryUsage () const;
+
+private:
+  struct Symbol_ {
+    uint32_t offset;  // in names_ and lowerNames_
+    uint32_t length;
+    uint32_t kind;    // in kinds_
+    int      id;
+    int      file;
+  };
+
+  typedef std::pair<int, uint32_t> Ranked_;  // score, symbol index
+
+  const char * lower_ (const Symbol_ & symbol) const {
+    return lowerNames_.data() + symbol.offset;
+  }
+
+  std::pair<uint32_t, uint32_t> prefixRange_ (const std::string & prefix) const;
+  void nameTrigrams_ (const Symbol_ & symbol, std::vector<uint32_t> & res) const;
+
+  enum { maxScanned_   = 50000,     // candidates examined per search
+         trigramCount_ = 1 << 18 };
+
+  std::string names_;
+  std::string lowerNames_;
+  std::vector<Symbol_> symbols_;
+  std::vector<std::string> kinds_;
+  std::unordered_map<std::string, uint32_t> kindIndex_;
+  std::vector<uint32_t> trigrams_;  // start of the posting list of each trigram
+  std::vector<uint32_t> postings_;
+
+  // USRs already added (hashed), only needed until finish()
+  std::unordered_set<size_t> usrs_;
+};
@@ -0,0 +1,134 @@
+#include "application.hxx"
+
+#include <algorithm>
+#include <set>
+
+int Application::scanSymbols_ (int cursor, SymbolIndex & index) {
+  return storage_.declarations (
+    cursor, symbolsChunk_,
+    [&index] (int id, int fileId, const std::string & usr,
+              const std::string & kind, const std::string & spelling) {
+      index.add (id, fileId, usr, kind, spelling);
+    });
+}
+
+bool Application::updateChangedSymbols_ () {
+  if (!symbols_.current()
+      || (changedSymbols_
+          && changedSymbolsGeneration_ == storage_.generation()
+          && changedSymbolsBuild_ == symbols_.builds())) {
+    return false;
+  }
+
+  changedSymbolsGeneration_ = storage_.generation();
+  changedSymbolsBuild_ = symbols_.builds();
+  changedSymbols_.reset (new SymbolIndex);
+  changedSymbolFiles_.clear();
+
+  std::vector<std::string> files;
+  if (!storage_.changedFiles (symbols_.generation(), files)) {
+    // Any declaration may have changed (e.g. after a merge)
+    if (!symbols_.building()) {
+      symbols_.start (storage_.generation());
+    }
+    changedSymbols_->finish();
+    return true;
+  }
+
+  for (auto file = files.begin() ; file != files.end() ; ++file) {
+    const int fileId = storage_.fileDeclarations (
+      *file,
+      [this] (int id, int fileId, const std::string & usr,
+              const std::string & kind, const std::string & spelling) {
+        changedSymbols_->add (id, fileId, usr, kind, spelling);
+      });
+    if (fileId != -1) {
+      changedSymbolFiles_.insert (fileId);
+    }
+  }
+  changedSymbols_->finish();
+
+  // Rebuild the whole index once too many files changed since the last build
+  if (!symbols_.building()
+      && changedSymbols_->size() > symbols_.current()->size() / 4) {
+    symbols_.start (storage_.generation());
+  }
+  return true;
+}
+
+bool Application::indexSymbols_ () {
+  if (!symbols_.current() && !symbols_.building()) {
+    symbols_.start (storage_.generation());
+  }
+  return updateChangedSymbols_() || symbols_.step();
+}
+
+void Application::symbols (SymbolsArgs & args, std::ostream & cout) {
+  auto check = [this] () { cancellation_.check(); };
+  Json::FastWriter writer;
+
+  if (snapshot_) {
+    // Snapshots never change: their symbols are indexed once
+    if (!snapshotSymbols_) {
+      std::unique_ptr<SymbolIndex> index (new SymbolIndex);
+      snapshot_->declarations (
+        [&index] (int id, const std::string & usr,
+                  const std::string & kind, const std::string & spelling) {
+          index->add (id, 0, usr, kind, spelling);
+        });
+      index->finish();
+      snapshotSymbols_ = std::move (index);
+    }
+
+    const auto matches = snapshotSymbols_->search (args.query, args.kind, args.limit, check);
+    for (auto it = matches.begin() ; it != matches.end() ; ++it) {
+      Storage::Definition def;
+      if (!snapshot_->declaration (it->id, def)) {
+        continue;
+      }
+      Json::Value json = def.json();
+      json["score"] = it->score;
+      cout << writer.write (json);
+    }
+    return;
+  }
+
+  // The first request has to wait for the whole index to be built
+  const SymbolIndex & index = symbols_.get (storage_.generation(),
+                                            [this] () { cancellation_.check (/*force=*/true); });
+  updateChangedSymbols_();
+
+  // Symbols of changed files are only searched in the separate index
+  auto matches = index.search (args.query, args.kind, args.limit, check,
+                               changedSymbolFiles_);
+  const auto changed = changedSymbols_->search (args.query, args.kind, args.limit, check);
+  matches.insert (matches.end(), changed.begin(), changed.end());
+  std::stable_sort (matches.begin(), matches.end(),
+                    [] (const SymbolIndex::Match & a, const SymbolIndex::Match & b) {
+                      if (a.score != b.score)
+                        return a.score < b.score;
+                      return a.name.size() < b.name.size();
+                    });
+
+  std::set<std::string> usrs;
+  int count = 0;
+  for (auto it = matches.begin() ; it != matches.end() ; ++it) {
+    if (args.limit > 0 && count >= args.limit) {
+      break;
+    }
+
+    // Declarations removed since the index was built are skipped (their ids
+    // may have been reused by other declarations), and so are symbols
+    // declared both in changed and unchanged files
+    Storage::Definition def;
+    if (!storage_.declaration (it->id, def)
+        || def.spelling != it->name
+        || !usrs.insert (def.usr).second) {
+      continue;
+    }
+    Json::Value json = def.json();
+    json["score"] = it->score;
+    cout << writer.write (json);
+    ++count;
+  }
+}
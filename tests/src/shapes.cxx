@@ -0,0 +1,28 @@
+struct Shape {                                           //(ref:shape)
+  virtual ~Shape () {}
+  virtual int area () const = 0;                         //(ref:area)
+};
+
+struct Rectangle : Shape {                               //(ref:rectangle)
+  Rectangle (int w, int h) : w_ (w), h_ (h) {}
+  int area () const { return w_ * h_; }                  //(ref:rectangleArea)
+  int w_, h_;
+};
+
+struct Square : Rectangle {                              //(ref:square)
+  Square (int side) : Rectangle (side, side) {}
+};
+
+int totalArea (const Shape & a, const Shape & b) {       //(ref:totalArea)
+  return a.area() + b.area();
+}
+
+int squareArea (int side) {                              //(ref:squareArea)
+  Square s (side);
+  return totalArea (s, s) / 2;
+}
+
+int positiveArea (int side) {                            //(ref:positiveArea)
+  if (side > 0)
+    return squareArea (side);
+}                                                        //(ref:noReturn)
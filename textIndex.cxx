@@ -0,0 +1,387 @@
+#include "textIndex.hxx"
+#include "util/util.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+  // Characters which have a special meaning in ECMAScript regular expressions
+  bool special (char c) {
+    return std::string ("\\^$.|?*+()[]{}").find (c) != std::string::npos;
+  }
+
+  // Index following a character class starting at i
+  size_t skipClass (const std::string & pattern, size_t i) {
+    ++i;
+    // A leading ']' (possibly after '^') is part of the class
+    if (i < pattern.size() && pattern[i] == '^') ++i;
+    if (i < pattern.size() && pattern[i] == ']') ++i;
+    while (i < pattern.size() && pattern[i] != ']') {
+      if (pattern[i] == '\\') ++i;
+      ++i;
+    }
+    return std::min (i + 1, pattern.size());
+  }
+
+  // Index following a group or character class starting at i
+  size_t skipGroup (const std::string & pattern, size_t i) {
+    if (pattern[i] == '[') {
+      return skipClass (pattern, i);
+    }
+
+    int depth = 0;
+    while (i < pattern.size()) {
+      const char c = pattern[i];
+      if (c == '\\') {
+        i += 2;
+      } else if (c == '[') {
+        i = skipClass (pattern, i);
+      } else {
+        ++i;
+        if (c == '(') {
+          ++depth;
+        } else if (c == ')' && --depth == 0) {
+          break;
+        }
+      }
+    }
+    return std::min (i, pattern.size());
+  }
+
+  // Index following a quantifier starting at i
+  size_t skipQuantifier (const std::string & pattern, size_t i) {
+    if (pattern[i] == '{') {
+      const size_t end = pattern.find ('}', i);
+      return end == std::string::npos ? pattern.size() : end + 1;
+    }
+    return i + 1;
+  }
+
+  // Literal strings which must appear in all matches of a regular expression
+  // without top-level alternatives
+  std::vector<std::string> requiredLiterals (const std::string & pattern) {
+    std::vector<std::string> literals;
+    std::string current;
+    auto flush = [&] () {
+      if (current != "") {
+        literals.push_back (current);
+        current = "";
+      }
+    };
+
+    size_t i = 0;
+    while (i < pattern.size()) {
+      const char c = pattern[i];
+      bool literal = false;
+      char value = c;
+      if (c == '\\') {
+        if (i + 1 < pattern.size() && special (pattern[i+1])) {
+          literal = true;
+          value = pattern[i+1];
+        } else {
+          // Character class escape, back-reference...
+          flush();
+        }
+        i += 2;
+      } else if (c == '(' || c == '[') {
+        flush();
+        i = skipGroup (pattern, i);
+      } else if (c == '.' || c == '^' || c == '$') {
+        flush();
+        ++i;
+      } else if (c == '*' || c == '+' || c == '?' || c == '{') {
+        // Quantifier following a group or class
+        flush();
+        i = skipQuantifier (pattern, i);
+      } else {
+        literal = true;
+        ++i;
+      }
+
+      if (!literal) {
+        continue;
+      }
+
+      // Quantifiers make the character optional or repeated
+      if (i < pattern.size()) {
+        const char q = pattern[i];
+        const bool optional = q == '*' || q == '?'
+          || (q == '{' && std::atoi (pattern.c_str() + i + 1) == 0);
+        if (optional) {
+          flush();
+          i = skipQuantifier (pattern, i);
+          continue;
+        }
+        if (q == '+' || q == '{') {
+          // The character appears at least once, but what follows may not
+          // come right after it
+          current += value;
+          flush();
+          i = skipQuantifier (pattern, i);
+          continue;
+        }
+      }
+      current += value;
+    }
+    flush();
+    return literals;
+  }
+}
+
+std::vector<uint32_t> TextIndex::trigrams (const std::string & text) {
+  std::vector<uint32_t> res;
+  if (text.size() < 3) {
+    return res;
+  }
+  res.reserve (text.size() - 2);
+
+  uint32_t t = ((uint32_t)(unsigned char)tolower (text[0]) << 8)
+    |           (uint32_t)(unsigned char)tolower (text[1]);
+  for (size_t i = 2 ; i < text.size() ; ++i) {
+    t = ((t << 8) | (unsigned char)tolower (text[i])) & 0xffffff;
+    res.push_back (t);
+  }
+  std::sort (res.begin(), res.end());
+  res.erase (std::unique (res.begin(), res.end()), res.end());
+  return res;
+}
+
+TextIndex::Query TextIndex::literalQuery (const std::string & literal) {
+  return Query (1, trigrams (literal));
+}
+
+TextIndex::Query TextIndex::regexQuery (const std::string & pattern) {
+  // Split top-level alternatives
+  std::vector<std::string> branches;
+  size_t begin = 0;
+  size_t i = 0;
+  while (i < pattern.size()) {
+    const char c = pattern[i];
+    if (c == '\\') {
+      i += 2;
+    } else if (c == '(' || c == '[') {
+      i = skipGroup (pattern, i);
+    } else if (c == '|') {
+      branches.push_back (pattern.substr (begin, i - begin));
+      begin = ++i;
+    } else {
+      ++i;
+    }
+  }
+  branches.push_back (pattern.substr (begin));
+
+  Query query;
+  for (auto branch = branches.begin() ; branch != branches.end() ; ++branch) {
+    std::vector<uint32_t> all;
+    const std::vector<std::string> literals = requiredLiterals (*branch);
+    for (auto it = literals.begin() ; it != literals.end() ; ++it) {
+      const std::vector<uint32_t> t = trigrams (*it);
+      all.insert (all.end(), t.begin(), t.end());
+    }
+    std::sort (all.begin(), all.end());
+    all.erase (std::unique (all.begin(), all.end()), all.end());
+    query.push_back (all);
+  }
+  return query;
+}
+
+TextIndex::TextIndex ()
+  : stale_ (0)
+{ }
+
+void TextIndex::update (const std::string & fileName,
+                        const std::vector<uint32_t> * trigrams,
+                        time_t indexed) {
+  remove_ (fileName);
+  if (!trigrams) {
+    unindexed_.insert (fileName);
+    return;
+  }
+
+  const uint32_t slot = files_.size();
+  files_.push_back (fileName);
+  times_.push_back (indexed);
+  slots_[fileName] = slot;
+  add_ (slot, *trigrams);
+
+  if (stale_ > 1024 && stale_ > slots_.size()) {
+    compact_();
+  }
+}
+
+void TextIndex::remove (const std::string & fileName) {
+  remove_ (fileName);
+}
+
+void TextIndex::clear () {
+  files_.clear();
+  times_.clear();
+  slots_.clear();
+  unindexed_.clear();
+  postings_.clear();
+  stale_ = 0;
+}
+
+void TextIndex::add_ (uint32_t slot, const std::vector<uint32_t> & trigrams) {
+  for (auto it = trigrams.begin() ; it != trigrams.end() ; ++it) {
+    // New posting lists are value-initialized
+    Posting_ & p = postings_[*it];
+    putVarint (p.data, slot - p.last);
+    p.last = slot;
+    ++p.count;
+  }
+}
+
+void TextIndex::remove_ (const std::string & fileName) {
+  unindexed_.erase (fileName);
+  auto it = slots_.find (fileName);
+  if (it != slots_.end()) {
+    files_[it->second] = "";
+    slots_.erase (it);
+    ++stale_;
+  }
+}
+
+std::vector<uint32_t> TextIndex::decode_ (const Posting_ & posting) const {
+  std::vector<uint32_t> slots;
+  slots.reserve (posting.count);
+  uint32_t slot = 0;
+  size_t pos = 0;
+  while (pos < posting.data.size()) {
+    slot += getVarint (posting.data, pos);
+    slots.push_back (slot);
+  }
+  return slots;
+}
+
+void TextIndex::compact_ () {
+  // Live slots are renumbered in the same order, so that posting lists stay
+  // sorted
+  std::vector<uint32_t> renumber (files_.size());
+  std::vector<std::string> files;
+  std::vector<time_t> times;
+  for (uint32_t slot = 0 ; slot < files_.size() ; ++slot) {
+    if (files_[slot] != "") {
+      renumber[slot] = files.size();
+      slots_[files_[slot]] = files.size();
+      files.push_back (files_[slot]);
+      times.push_back (times_[slot]);
+    }
+  }
+
+  for (auto it = postings_.begin() ; it != postings_.end() ; ) {
+    const std::vector<uint32_t> slots = decode_ (it->second);
+    Posting_ & posting = it->second;
+    posting.data.clear();
+    posting.last  = 0;
+    posting.count = 0;
+    for (auto slot = slots.begin() ; slot != slots.end() ; ++slot) {
+      if (files_[*slot] != "") {
+        putVarint (posting.data, renumber[*slot] - posting.last);
+        posting.last = renumber[*slot];
+        ++posting.count;
+      }
+    }
+
+    if (posting.count == 0) {
+      it = postings_.erase (it);
+    } else {
+      std::string (posting.data).swap (posting.data);
+      ++it;
+    }
+  }
+
+  files_.swap (files);
+  times_.swap (times);
+  stale_ = 0;
+}
+
+void TextIndex::finish () {
+  if (stale_ > 0) {
+    compact_();
+    return;
+  }
+  for (auto it = postings_.begin() ; it != postings_.end() ; ++it) {
+    std::string (it->second.data).swap (it->second.data);
+  }
+}
+
+std::vector<std::string> TextIndex::candidates (const Query & query,
+                                                std::function<bool (const std::string & fileName,
+                                                                    time_t indexed)> modified) const {
+  std::vector<std::string> res (unindexed_.begin(), unindexed_.end());
+
+  std::vector<uint32_t> matching;
+  for (auto alternative = query.begin() ; alternative != query.end() ; ++alternative) {
+    if (alternative->empty()) {
+      // No trigram to narrow the search
+      for (auto it = slots_.begin() ; it != slots_.end() ; ++it) {
+        res.push_back (it->first);
+      }
+      std::sort (res.begin(), res.end());
+      return res;
+    }
+
+    // Intersect posting lists, shortest first
+    std::vector<const Posting_ *> postings;
+    bool found = true;
+    for (auto t = alternative->begin() ; t != alternative->end() ; ++t) {
+      auto it = postings_.find (*t);
+      if (it == postings_.end()) {
+        found = false;
+        break;
+      }
+      postings.push_back (&it->second);
+    }
+    if (!found) {
+      continue;
+    }
+    std::sort (postings.begin(), postings.end(),
+               [] (const Posting_ * a, const Posting_ * b) { return a->count < b->count; });
+
+    std::vector<uint32_t> slots = decode_ (*postings[0]);
+    for (size_t i = 1 ; i < postings.size() && !slots.empty() ; ++i) {
+      const std::vector<uint32_t> other = decode_ (*postings[i]);
+      std::vector<uint32_t> both;
+      std::set_intersection (slots.begin(), slots.end(), other.begin(), other.end(),
+                             std::back_inserter (both));
+      slots.swap (both);
+    }
+    matching.insert (matching.end(), slots.begin(), slots.end());
+  }
+
+  std::sort (matching.begin(), matching.end());
+  matching.erase (std::unique (matching.begin(), matching.end()), matching.end());
+
+  // Trigrams of files modified since they were indexed can not be trusted
+  auto it = matching.begin();
+  for (uint32_t slot = 0 ; slot < files_.size() ; ++slot) {
+    while (it != matching.end() && *it < slot) {
+      ++it;
+    }
+    if (files_[slot] == "") {
+      continue;
+    }
+    if ((it != matching.end() && *it == slot)
+        || modified (files_[slot], times_[slot])) {
+      res.push_back (files_[slot]);
+    }
+  }
+  std::sort (res.begin(), res.end());
+  return res;
+}
+
+size_t TextIndex::memoryUsage () const {
+  // Hash table nodes are counted as a key, a value and two pointers
+  size_t memory = 0;
+  for (auto it = postings_.begin() ; it != postings_.end() ; ++it) {
+    memory += it->second.data.capacity()
+      + sizeof (uint32_t) + sizeof (Posting_) + 2 * sizeof (void*);
+  }
+  for (auto it = files_.begin() ; it != files_.end() ; ++it) {
+    memory += sizeof (std::string) + 2 * it->capacity();  // + key in slots_
+  }
+  memory += times_.capacity() * sizeof (time_t);
+  return memory;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** @brief In-memory trigram index of file contents
+ *
+ * Each file is described by the set of trigrams (3 consecutive bytes, in lower
+ * case) found in its contents. For each trigram, the index keeps a posting
+ * list of the files containing it, from which the files possibly matching a
+ * query can be found without reading any file.
+ *
+ * Files are identified by slots, allocated in increasing order, so that
+ * posting lists are naturally sorted and can be stored as variable-length
+ * deltas. Updating a file allocates it a new slot; stale slots are skipped
+ * until the index is compacted.
+ *
+ * Files whose contents are not indexed (for example because they were indexed
+ * by an older version) are always candidates, and so are files modified since
+ * their trigrams were computed.
+ */
+class TextIndex {
+public:
+  /** @brief Files candidate for a query
+   *
+   * A query is a list of alternatives; files match an alternative if they
+   * contain all of its trigrams. An empty alternative matches all files.
+   */
+  typedef std::vector<std::vector<uint32_t> > Query;
+
+  /** @brief Sorted set of the trigrams in a text */
+  static std::vector<uint32_t> trigrams (const std::string & text);
+
+  /** @brief Query for files containing a literal string */
+  static Query literalQuery (const std::string & literal);
+
+  /** @brief Query for files possibly matching an ECMAScript regular expression
+   *
+   * Literal strings which must appear in all matches are extracted from the
+   * top-level alternatives of the expression. Groups, character classes and
+   * optional parts are skipped, so that no matching file is missed.
+   */
+  static Query regexQuery (const std::string & pattern);
+
+  TextIndex ();
+
+  /** @brief Add or update a file
+   *
+   * @param fileName  full path to the file
+   * @param trigrams  trigrams of the file contents, as given by trigrams(), or
+   *                  NULL if its contents are not indexed
+   * @param indexed   modification time of the file when its trigrams were
+   *                  computed
+   */
+  void update (const std::string & fileName, const std::vector<uint32_t> * trigrams,
+               time_t indexed = 0);
+
+  /** @brief Remove a file
+   */
+  void remove (const std::string & fileName);
+
+  /** @brief Remove all files
+   */
+  void clear ();
+
+  /** @brief Release unused memory once all files have been added
+   */
+  void finish ();
+
+  /** @brief Find files possibly matching a query
+   *
+   * @param query     alternatives of trigrams
+   * @param modified  function telling whether a file was modified after the
+   *                  given time; files ruled out by the query are candidates
+   *                  if it returns @c true
+   *
+   * @return file names, sorted
+   */
+  std::vector<std::string> candidates (const Query & query,
+                                       std::function<bool (const std::string & fileName,
+                                                           time_t indexed)> modified) const;
+
+  /** @brief Number of files */
+  size_t size () const {
+    return slots_.size() + unindexed_.size();
+  }
+
+  /** @brief Number of files whose contents are not indexed */
+  size_t unindexed () const {
+    return unindexed_.size();
+  }
+
+  /** @brief Estimated memory usage, in bytes */
+  size_t memoryUsage () const;
+
+private:
+  // Posting list: deltas between consecutive slots, as variable-length integers
+  struct Posting_ {
+    std::string data;
+    uint32_t    last;
+    uint32_t    count;
+  };
+
+  void add_ (uint32_t slot, const std::vector<uint32_t> & trigrams);
+  void remove_ (const std::string & fileName);
+  void compact_ ();
+  std::vector<uint32_t> decode_ (const Posting_ & posting) const;
+
+  std::vector<std::string> files_;                    // by slot ("" if stale)
+  std::vector<time_t> times_;                         // by slot
+  std::unordered_map<std::string, uint32_t> slots_;   // by file name
+  std::set<std::string> unindexed_;
+  std::unordered_map<uint32_t, Posting_> postings_;  // by trigram
+  size_t stale_;
+};
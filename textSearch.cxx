@@ -0,0 +1,187 @@
+#include "application.hxx"
+
+#include <sys/stat.h>
+#include <fnmatch.h>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <regex>
+#include <stdexcept>
+
+int Application::scanText_ (int cursor, TextIndex & index) {
+  return storage_.fileTrigrams (
+    cursor, textChunk_,
+    [&index] (const std::string & fileName, const std::vector<uint32_t> * trigrams,
+              time_t indexed) {
+      index.update (fileName, trigrams, indexed);
+    });
+}
+
+bool Application::updateText_ () {
+  TextIndex * index = text_.current();
+  if (!index) {
+    return false;
+  }
+
+  // A completed build reflects the index as it was when it started
+  if (textBuild_ != text_.builds()) {
+    textBuild_ = text_.builds();
+    textGeneration_ = text_.generation();
+    textReset_ = false;
+  }
+
+  const unsigned long generation = storage_.generation();
+  if (textGeneration_ == generation) {
+    return false;
+  }
+
+  std::vector<std::string> changed;
+  if (!storage_.changedFiles (textGeneration_, changed)) {
+    // Any file may have changed (e.g. after a merge): the current index can
+    // not be used until it is rebuilt
+    text_.start (generation);
+    textGeneration_ = generation;
+    textReset_ = true;
+    return true;
+  }
+
+  for (auto it = changed.begin() ; it != changed.end() ; ++it) {
+    std::vector<uint32_t> trigrams;
+    time_t indexed;
+    struct stat fileStat;
+    if (storage_.fileTrigrams (*it, trigrams, indexed)) {
+      index->update (*it, &trigrams, indexed);
+    } else if (stat (it->c_str(), &fileStat) == 0) {
+      index->update (*it, NULL);
+    } else {
+      index->remove (*it);
+    }
+  }
+  textGeneration_ = generation;
+  return true;
+}
+
+bool Application::indexText_ () {
+  if (!text_.current() && !text_.building()) {
+    text_.start (storage_.generation());
+  }
+  return updateText_() || text_.step();
+}
+
+void Application::textSearch (TextSearchArgs & args, std::ostream & cout) {
+  if (args.pattern == "") {
+    return;
+  }
+
+  // The first request, or the first one after a merge, has to wait for the
+  // whole index to be loaded
+  auto check = [this] () { cancellation_.check (/*force=*/true); };
+  text_.get (storage_.generation(), check);
+  updateText_();
+  while (textReset_) {
+    check();
+    text_.step();
+    updateText_();
+  }
+  const TextIndex & index = *text_.current();
+
+  // Candidate files are found case-insensitively in any case
+  std::regex regex;
+  TextIndex::Query query;
+  std::string literal = args.pattern;
+  try {
+    if (args.regex) {
+      regex = std::regex (args.pattern, args.ignoreCase
+                          ? std::regex::ECMAScript | std::regex::icase
+                          : std::regex::ECMAScript);
+      query = TextIndex::regexQuery (args.pattern);
+    } else {
+      query = TextIndex::literalQuery (args.pattern);
+    }
+  } catch (std::regex_error & e) {
+    cout << "Error: invalid regular expression `" << args.pattern << "'" << std::endl;
+    return;
+  }
+
+  auto lower = [] (std::string & s) {
+    std::transform (s.begin(), s.end(), s.begin(), ::tolower);
+  };
+  if (args.ignoreCase) {
+    lower (literal);
+  }
+
+  Storage::GrepQuery pathQuery;
+  pathQuery.path = args.path;
+  const std::string pathPattern = pathQuery.pathPattern();
+
+  // Files modified since they were indexed are scanned in any case
+  const std::vector<std::string> files = index.candidates (
+    query,
+    [] (const std::string & fileName, time_t indexed) {
+      struct stat fileStat;
+      return stat (fileName.c_str(), &fileStat) == 0 && fileStat.st_mtime > indexed;
+    });
+  textSkipped_ += index.size() - files.size();
+
+  Json::FastWriter writer;
+  int count = 0;
+  for (auto file = files.begin() ; file != files.end() ; ++file) {
+    // Same semantics as grep
+    if (args.path != "" && fnmatch (pathPattern.c_str(), file->c_str(), 0) != 0) {
+      continue;
+    }
+
+    cancellation_.check (/*force=*/true);
+    std::ifstream in (file->c_str());
+    if (!in) {
+      continue;
+    }
+    ++textScanned_;
+
+    std::string line;
+    int lineno = 0;
+    int offset = 0;
+    while (std::getline (in, line)) {
+      ++lineno;
+      size_t begin = std::string::npos;
+      size_t length = 0;
+      if (args.regex) {
+        std::smatch match;
+        if (std::regex_search (line, match, regex)) {
+          begin  = match.position (0);
+          length = match.length (0);
+        }
+      } else if (args.ignoreCase) {
+        std::string lowerLine (line);
+        lower (lowerLine);
+        begin  = lowerLine.find (literal);
+        length = literal.size();
+      } else {
+        begin  = line.find (literal);
+        length = literal.size();
+      }
+
+      if (begin != std::string::npos) {
+        Json::Value json;
+        json["file"]         = *file;
+        json["line1"]        = lineno;
+        json["line2"]        = lineno;
+        json["col1"]         = (int)begin + 1;
+        json["col2"]         = (int)(begin + length) + 1;
+        json["offset1"]      = offset + (int)begin;
+        json["offset2"]      = offset + (int)(begin + length);
+        json["lineContents"] = line;
+        cout << writer.write (json);
+
+        // Stream results to the client as they come
+        if (++count % 64 == 0) {
+          cout << std::flush;
+        }
+        if (args.limit > 0 && count >= args.limit) {
+          return;
+        }
+      }
+      offset += line.size() + 1;
+    }
+  }
+}
@@ -53,11 +53,79 @@ void testTee () {
 }
 
 
+void testShellSplit () {
+  std::cout << "Testing shellSplit..." << std::endl;
+
+  // Usage example
+  //![shellSplit]
+  std::vector<std::string> args
+    = shellSplit ("g++ -DNAME='\"a b\"' -I\"my dir\" -c main.cxx");
+
+  check (args.size() == 5);
+  check (args[1] == "-DNAME=\"a b\"");
+  check (args[2] == "-Imy dir");
+  //![shellSplit]
+
+
+  // Additional tests
+  check (shellSplit ("").size() == 0);
+  check (shellSplit ("  a   b  ").size() == 2);
+  check (shellSplit ("a\\ b")[0] == "a b");
+  check (shellSplit ("\"a\\\"b\\c\"")[0] == "a\"b\\c");
+  check (shellSplit ("''").size() == 1);
+  check (shellSplit ("'unterminated")[0] == "unterminated");
+  check (shellSplit ("a \\\n  b\\\nc").size() == 2);
+  check (shellSplit ("a \\\n  b\\\nc")[1] == "bc");
+  check (shellSplit ("\"a\\\nb\"")[0] == "ab");
+  check (shellSplit ("'a\\\nb'")[0] == "a\\\nb");
+}
+
+
+void testNormalizePath () {
+  std::cout << "Testing normalizePath..." << std::endl;
+
+  // Usage example
+  //![normalizePath]
+  check (normalizePath ("/build/dir/../src/./main.cxx") == "/build/src/main.cxx");
+  //![normalizePath]
+
+
+  // Additional tests
+  check (normalizePath ("/") == "/");
+  check (normalizePath ("/..//a/") == "/a");
+  check (normalizePath ("a/../..") == "..");
+  check (normalizePath ("./") == ".");
+}
+
+
+void testEncodeSet () {
+  std::cout << "Testing encodeSet..." << std::endl;
+
+  // Usage example
+  //![encodeSet]
+  std::vector<uint32_t> values = {1, 130, 100000};
+  const std::string data = encodeSet (values);
+  check (data.size() == 1 + 2 + 3);
+  check (decodeSet (data) == values);
+  //![encodeSet]
+
+
+  // Additional tests
+  check (encodeSet (std::vector<uint32_t>()) == "");
+  check (decodeSet ("") == std::vector<uint32_t>());
+  values = {0, 0xffffffff};
+  check (decodeSet (encodeSet (values)) == values);
+}
+
+
 int main () {
   try {
     testTimer();
     testString();
     testTee();
+    testShellSplit();
+    testNormalizePath();
+    testEncodeSet();
   }
   catch (...) {
     std::cerr << "Caught exception!" << std::endl;
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <sys/time.h>
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
 
 /** @defgroup util Utilities
  *  @brief Various utilities
@@ -132,4 +135,200 @@ private:
   std::ostream & stream2_;
 };
 
+/** @brief Split a command line into arguments
+ *
+ * Arguments are separated by unquoted blanks, and quoting follows POSIX shell
+ * rules:
+ * - characters between single quotes are taken literally,
+ * - between double quotes, a backslash only escapes <tt>" \\ $ `</tt>,
+ * - elsewhere, a backslash escapes any character,
+ * - outside single quotes, a backslash followed by a newline (line
+ *   continuation) is removed.
+ *
+ * Example use:
+ * @snippet test_util.cxx shellSplit
+ *
+ * @param command  command line
+ *
+ * @return the vector of arguments
+ */
+inline std::vector<std::string> shellSplit (const std::string & command) {
+  std::vector<std::string> args;
+  std::string arg;
+  bool inArg = false;
+
+  for (auto c = command.begin() ; c != command.end() ; ++c) {
+    switch (*c) {
+    case ' ': case '\t': case '\n':
+      if (inArg) {
+        args.push_back (arg);
+        arg.clear();
+        inArg = false;
+      }
+      break;
+
+    case '\'':
+      inArg = true;
+      for (++c ; c != command.end() && *c != '\'' ; ++c) {
+        arg += *c;
+      }
+      if (c == command.end()) {
+        --c;
+      }
+      break;
+
+    case '"':
+      inArg = true;
+      for (++c ; c != command.end() && *c != '"' ; ++c) {
+        if (*c == '\\' && c+1 != command.end() && c[1] == '\n') {
+          ++c;
+          continue;
+        }
+        if (*c == '\\' && c+1 != command.end()
+            && (c[1] == '"' || c[1] == '\\' || c[1] == '$' || c[1] == '`')) {
+          ++c;
+        }
+        arg += *c;
+      }
+      if (c == command.end()) {
+        --c;
+      }
+      break;
+
+    case '\\':
+      if (c+1 != command.end() && c[1] == '\n') {
+        // Line continuation
+        ++c;
+        break;
+      }
+      inArg = true;
+      if (c+1 != command.end()) {
+        ++c;
+      }
+      arg += *c;
+      break;
+
+    default:
+      inArg = true;
+      arg += *c;
+    }
+  }
+
+  if (inArg) {
+    args.push_back (arg);
+  }
+  return args;
+}
+
+/** @brief Normalize a path, without accessing the file system
+ *
+ * Empty components and @c "." components are removed, and @c ".."
+ * components are resolved against the preceding component (symbolic links
+ * are not taken into account).
+ *
+ * Example use:
+ * @snippet test_util.cxx normalizePath
+ *
+ * @param path  absolute or relative path
+ *
+ * @return the normalized path
+ */
+inline std::string normalizePath (const std::string & path) {
+  const bool absolute = (path != "" && path[0] == '/');
+
+  std::vector<std::string> components;
+  size_t begin = 0;
+  while (begin <= path.size()) {
+    size_t end = path.find ('/', begin);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    const std::string component = path.substr (begin, end - begin);
+    begin = end + 1;
+
+    if (component == "" || component == ".") {
+      continue;
+    }
+    if (component == ".." && !components.empty() && components.back() != "..") {
+      components.pop_back();
+      continue;
+    }
+    if (component == ".." && absolute) {
+      // The parent of the root directory is itself
+      continue;
+    }
+    components.push_back (component);
+  }
+
+  std::string res = absolute ? "/" : "";
+  for (size_t i = 0 ; i < components.size() ; ++i) {
+    if (i > 0) {
+      res += '/';
+    }
+    res += components[i];
+  }
+  return (res == "") ? "." : res;
+}
+
+/** @brief Append an unsigned integer to a string, as a variable-length integer
+ *
+ * Integers are written by groups of 7 bits, least significant first, so that
+ * small values take a single byte.
+ */
+inline void putVarint (std::string & data, uint32_t value) {
+  while (value >= 0x80) {
+    data += (char)(0x80 | (value & 0x7f));
+    value >>= 7;
+  }
+  data += (char)value;
+}
+
+/** @brief Read a variable-length integer written by putVarint()
+ *
+ * @param data  encoded data
+ * @param pos   position of the integer in @c data, moved past it
+ */
+inline uint32_t getVarint (const std::string & data, size_t & pos) {
+  uint32_t value = 0;
+  for (int shift = 0 ; pos < data.size() ; shift += 7) {
+    const unsigned char byte = data[pos++];
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      break;
+    }
+  }
+  return value;
+}
+
+/** @brief Compact binary representation of a sorted set of integers
+ *
+ * Differences between consecutive values are stored as variable-length
+ * integers.
+ *
+ * Example use:
+ * @snippet test_util.cxx encodeSet
+ */
+inline std::string encodeSet (const std::vector<uint32_t> & values) {
+  std::string data;
+  uint32_t last = 0;
+  for (auto it = values.begin() ; it != values.end() ; ++it) {
+    putVarint (data, *it - last);
+    last = *it;
+  }
+  return data;
+}
+
+/** @brief Inverse of encodeSet()
+ */
+inline std::vector<uint32_t> decodeSet (const std::string & data) {
+  std::vector<uint32_t> values;
+  uint32_t last = 0;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    last += getVarint (data, pos);
+    values.push_back (last);
+  }
+  return values;
+}
+
 /** @} */